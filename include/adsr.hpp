@@ -1,5 +1,6 @@
 #ifndef KEYBOARD_ADSR_HPP
 #define KEYBOARD_ADSR_HPP
+#include "config.hpp"
 #include <json.hpp>
 #include <optional>
 #include <stdio.h>
@@ -11,7 +12,7 @@ class ADSR {
 public:
   ADSR() {
     float duration = 0.8f;
-    int samplerate = 44100;
+    int samplerate = Config::instance().getSampleRate();
     this->amplitude = ADSRAmplitude;
     this->qadsr[0] = 1;
     this->qadsr[1] = 1;
@@ -0,0 +1,38 @@
+#pragma once
+
+// -----------------------------------------------------------------------------
+// Debug check that the audio thread doesn't allocate.
+//
+// Built with -DWITH_ALLOC_CHECK=ON, the global operator new reports every
+// allocation made while an AudioThreadScope is alive on the calling thread,
+// with a stack trace. Set KEYBOARD_ALLOC_CHECK=abort in the environment to
+// abort on the first one instead. In normal builds the scope compiles to
+// nothing.
+// -----------------------------------------------------------------------------
+namespace alloccheck {
+
+#ifdef KEYBOARD_ALLOC_CHECK
+class AudioThreadScope {
+public:
+  AudioThreadScope();
+  ~AudioThreadScope();
+
+  AudioThreadScope(const AudioThreadScope &) = delete;
+  AudioThreadScope &operator=(const AudioThreadScope &) = delete;
+
+private:
+  bool previous_;
+};
+
+// Allocations seen on the audio thread so far
+long getViolations();
+#else
+class AudioThreadScope {
+public:
+  AudioThreadScope() {}
+};
+
+inline long getViolations() { return 0; }
+#endif
+
+} // namespace alloccheck
@@ -0,0 +1,84 @@
+#pragma once
+#include "dft.hpp"
+#include "ringbuffer.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Analyzer: a tap on the synth's output for the live scope and spectrum.
+//
+// The audio thread writes every block it plays to a lock-free ring, once it
+// is mixed down and through the effects and the looper, so what is analyzed
+// is what sounds. A thread of the analyzer's own drains the ring a number of
+// times a second, and hands a scope frame and a spectrum frame to the sink
+// as binary messages:
+//
+//   byte 0      kind, 1 for the scope and 2 for the spectrum
+//   bytes 4-7   number of values, uint32
+//   bytes 8-11  sample rate, uint32
+//   bytes 12-15 samples per scope point, or Hz per spectrum bin, float32
+//   bytes 16-   the values, float32: samples in [-1, 1], or levels in dB
+//
+// All little endian. Nothing is written to the ring while inactive, so the
+// tap costs the audio thread nothing when no one is watching.
+// -----------------------------------------------------------------------------
+class Analyzer {
+public:
+  static constexpr int FFT_SIZE = 2048;
+  static constexpr int SCOPE_POINTS = 512;
+  static constexpr double MAX_RATE = 60.0;
+  static constexpr float FLOOR_DB = -120.0f;
+
+  enum Kind : std::uint8_t { Scope = 1, Spectrum = 2 };
+
+  using Message = std::vector<unsigned char>;
+  using Sink = std::function<void(const Message &)>;
+
+  explicit Analyzer(int sampleRate);
+  ~Analyzer();
+
+  Analyzer(const Analyzer &) = delete;
+  Analyzer &operator=(const Analyzer &) = delete;
+
+  // Frames sent per second, clamped to [1, MAX_RATE]
+  void start(double rate, Sink sink);
+  void stop();
+
+  void setActive(bool active) { active_ = active; }
+  bool isActive() const { return active_; }
+
+  // --- Audio thread ---
+  // 'right' is null for mono, the two are mixed down
+  void write(const float *left, const float *right, int frames);
+
+private:
+  static constexpr int WRITE_CHUNK = 256;
+
+  const int sampleRate_;
+  std::atomic<bool> active_{false};
+  SpscRing<float> ring_;
+
+  // Analysis thread
+  Sink sink_;
+  double rate_ = 20.0;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool running_ = false;
+  // The latest 2 * FFT_SIZE samples, oldest first
+  std::vector<float> history_;
+  std::vector<float> incoming_;
+  std::vector<float> window_;
+  RealFFT fft_;
+  Message scope_;
+  Message spectrum_;
+
+  void run();
+  void drain();
+  void analyze();
+};
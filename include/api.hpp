@@ -2,6 +2,7 @@
 #define KEYBOARD_API_HPP
 
 #include <civetweb.h>
+#include <vector>
 
 int presets_api_handler(struct mg_connection *conn, void *cbdata);
 int input_release_handler(struct mg_connection *conn, void *cbdata);
@@ -11,5 +12,19 @@ int waveform_api_handler(struct mg_connection *conn, void *cbdata);
 int waveform_combined_api_handler(struct mg_connection *conn, void *cbdata);
 int input_push_handler(struct mg_connection *conn, void *cbdata);
 int recorder_handler(struct mg_connection *conn, void *cbdata);
+int sequencer_handler(struct mg_connection *conn, void *cbdata);
+int stream_handler(struct mg_connection *conn, void *cbdata);
+int input_ws_connect_handler(const struct mg_connection *conn, void *cbdata);
+int input_ws_data_handler(struct mg_connection *conn, int bits, char *data,
+                          size_t len, void *cbdata);
+int scope_ws_connect_handler(const struct mg_connection *conn, void *cbdata);
+void scope_ws_ready_handler(struct mg_connection *conn, void *cbdata);
+int scope_ws_data_handler(struct mg_connection *conn, int bits, char *data,
+                          size_t len, void *cbdata);
+void scope_ws_close_handler(const struct mg_connection *conn, void *cbdata);
+// Sends an analyzer frame to the /ws/scope clients
+void scope_ws_broadcast(const std::vector<unsigned char> &message);
+// /api/session of a session server, 'cbdata' is the SessionServer
+int session_api_handler(struct mg_connection *conn, void *cbdata);
 
 #endif
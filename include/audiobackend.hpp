@@ -0,0 +1,128 @@
+#pragma once
+#include "waveread.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// AudioBackend: where the synth's output goes.
+//
+// A backend pulls blocks from a render function, KeyboardStream::fillBuffer()
+// under the lock, the same way a sound card callback does: 'frames' frames of
+// interleaved float samples in [-1, 1] at a time. Besides the SDL2 device of
+// main_stream there are backends that need no sound device at all, for
+// headless machines:
+//
+//   null       renders in real time and drops the audio
+//   null-fast  renders as fast as it can, for benchmarks
+//   wav        renders in real time to a 16 bit WAVE file
+//   pipe       renders in real time to stdout as raw 16 bit PCM in the
+//              machine's byte order, for `| aplay -f S16_LE -r <rate> -c 2`
+//
+// These render on a thread of their own, which plays the audio thread. A
+// backend's destructor stops it before anything it delivers to goes away.
+// -----------------------------------------------------------------------------
+class AudioBackend {
+public:
+  using Render = std::function<void(float *buffer, int len)>;
+
+  virtual ~AudioBackend() = default;
+
+  // Prepares to play, false if the output can't be opened
+  virtual bool open(int sampleRate, int channels, int frames,
+                    Render render) = 0;
+  virtual void start() = 0;
+  virtual void stop() = 0;
+  virtual const char *name() const = 0;
+
+  // Frames rendered since start()
+  std::uint64_t getFramesRendered() const { return framesRendered_; }
+
+  // The backend called 'name', or null for an unknown name. 'file' is what
+  // the wav backend writes to.
+  static std::unique_ptr<AudioBackend> create(const std::string &name,
+                                              const std::string &file);
+
+protected:
+  std::atomic<std::uint64_t> framesRendered_{0};
+};
+
+// A backend rendering on its own thread, in real time or as fast as it can,
+// and handing every block to deliver()
+class ThreadedAudioBackend : public AudioBackend {
+public:
+  explicit ThreadedAudioBackend(bool realTime) : realTime_(realTime) {}
+  ~ThreadedAudioBackend() override;
+
+  bool open(int sampleRate, int channels, int frames, Render render) override;
+  void start() override;
+  void stop() override;
+
+protected:
+  const bool realTime_;
+  int sampleRate_ = 0;
+  int channels_ = 0;
+  int frames_ = 0;
+
+  // Called on the render thread with every block of 'len' samples
+  virtual void deliver(const float *buffer, int len) = 0;
+
+private:
+  Render render_;
+  std::vector<float> buffer_;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+
+  void run();
+};
+
+class NullAudioBackend : public ThreadedAudioBackend {
+public:
+  explicit NullAudioBackend(bool realTime) : ThreadedAudioBackend(realTime) {}
+  ~NullAudioBackend() override { stop(); }
+  const char *name() const override {
+    return realTime_ ? "null" : "null-fast";
+  }
+
+protected:
+  void deliver(const float *, int) override {}
+};
+
+class WaveAudioBackend : public ThreadedAudioBackend {
+public:
+  explicit WaveAudioBackend(const std::string &file)
+      : ThreadedAudioBackend(true), file_(file) {}
+  ~WaveAudioBackend() override;
+
+  bool open(int sampleRate, int channels, int frames, Render render) override;
+  void stop() override;
+  const char *name() const override { return "wav"; }
+
+protected:
+  void deliver(const float *buffer, int len) override;
+
+private:
+  const std::string file_;
+  WaveWriter writer_;
+};
+
+class PipeAudioBackend : public ThreadedAudioBackend {
+public:
+  PipeAudioBackend() : ThreadedAudioBackend(true) {}
+  ~PipeAudioBackend() override;
+
+  // Moves stdout out of the way, what the program prints goes to stderr
+  bool open(int sampleRate, int channels, int frames, Render render) override;
+  const char *name() const override { return "pipe"; }
+
+protected:
+  void deliver(const float *buffer, int len) override;
+
+private:
+  int fd_ = -1;
+  std::vector<std::int16_t> pcm_;
+};
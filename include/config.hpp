@@ -8,6 +8,8 @@
 namespace defaults {
 constexpr int sampleRate = 44100;
 constexpr int sampleBufferSize = 206;
+constexpr int channels = 2;
+constexpr int renderWorkers = -1; // one per core besides the audio thread
 } // namespace defaults
 
 class Config {
@@ -26,6 +28,16 @@ public:
   void setSampleRate(int rate) { sampleRate_ = rate; }
   int getSampleRate() const { return sampleRate_; }
 
+  // ---- Channels ----
+  void setChannels(int channels) { channels_ = channels; }
+  int getChannels() const { return channels_; }
+
+  // ---- RenderWorkers ----
+  // Worker threads rendering voices next to the audio thread, 0 disables
+  // and a negative value picks one per spare core
+  void setRenderWorkers(int workers) { renderWorkers_ = workers; }
+  int getRenderWorkers() const { return renderWorkers_; }
+
   // ---- BufferSize ----
   void setBufferSize(std::size_t size) { bufferSize_ = size; }
   std::size_t getBufferSize() const { return bufferSize_; }
@@ -48,10 +60,14 @@ private:
   Config()
       : sampleRate_(defaults::sampleRate),       // default = 44100 Hz
         bufferSize_(defaults::sampleBufferSize), // default = 512 frames
+        channels_(defaults::channels),           // default = stereo
+        renderWorkers_(defaults::renderWorkers),
         metronomeBpm_(100), metronomeVolume_(0.25f), numTracks_(4) {}
 
   int sampleRate_;
   std::size_t bufferSize_;
+  int channels_;
+  int renderWorkers_;
   int metronomeBpm_;
   float metronomeVolume_;
   int numTracks_ = 4;
@@ -18,4 +18,30 @@ public:
   static std::vector<short> IDFT(const std::vector<Complex> &X);
 };
 
+// A forward transform of real input of a fixed size, planned once. Running
+// it takes no lock and allocates nothing, for transforms done over and over.
+class RealFFT {
+public:
+  explicit RealFFT(int size);
+  ~RealFFT();
+
+  RealFFT(const RealFFT &) = delete;
+  RealFFT &operator=(const RealFFT &) = delete;
+
+  int size() const { return size_; }
+  // size() samples, transformed by execute()
+  double *input() { return in_; }
+  void execute();
+  // Bins 0 to size() / 2
+  std::complex<double> bin(int k) const {
+    return {out_[2 * k], out_[2 * k + 1]};
+  }
+
+private:
+  int size_;
+  double *in_;
+  double *out_; // fftw_complex
+  void *plan_;  // fftw_plan
+};
+
 #endif // FOURIER_TRANSFORM_HPP
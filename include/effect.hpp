@@ -1,6 +1,7 @@
 #ifndef KEYBOARD_EFFECTS_HPP
 #define KEYBOARD_EFFECTS_HPP
 
+#include <algorithm>
 #include <cmath>
 #include <json.hpp>
 #include <map>
@@ -17,7 +18,9 @@ template <typename T> class Piper;
 
 template <typename T> class AllPassEffect {
 public:
-  AllPassEffect(size_t delaySamples, T g) : buf(delaySamples, 0), g(g), w(0) {}
+  AllPassEffect(size_t delaySamples, T g)
+      : buf(delaySamples, 0), g(g), w(0),
+        bufRight(delaySamples + stereoSpread, 0) {}
   T process(T x) {
     size_t r = (w + 1) % buf.size();
     T y = -g * x + buf[r] + g * z; // z = earlier output
@@ -45,9 +48,26 @@ public:
 
     return AllPassEffect(size, gain);
   }
+  // The right channel runs a slightly longer line (as in Freeverb) so that
+  // the two sides of a stereo reverb decorrelate
+  void processStereo(T &left, T &right) {
+    left = process(left);
+    size_t r = (wRight + 1) % bufRight.size();
+    T y = -g * right + bufRight[r] + g * zRight;
+    bufRight[wRight] = right + g * y;
+    zRight = y;
+    wRight = r;
+    right = y;
+  }
+
+  static constexpr size_t stereoSpread = 23;
+
   std::vector<T> buf;
   T g, z{0};
   size_t w;
+  std::vector<T> bufRight;
+  T zRight{0};
+  size_t wRight = 0;
 };
 
 template <typename T> class EchoEffect {
@@ -77,6 +97,7 @@ public:
   float getSampleRate() const { return sampleRate; }
 
   T process(T inputSample);
+  void processStereo(T &left, T &right);
 
   // ── JSON serialisation ────────────────────────────────────────────────
   nlohmann::json toJson() const {
@@ -116,9 +137,11 @@ public:
     if (newDelay > delaySamples) {
       // grow: keep existing data, zero-fill the new tail
       buffer.resize(newDelay, 0.0f);
+      bufferRight.resize(newDelay, 0.0f);
     } else if (newDelay < delaySamples) {
       // shrink: just shorten the window, preserve the first newDelay samples
       buffer.resize(newDelay);
+      bufferRight.resize(newDelay);
       // make sure writeIndex still in range [0, newDelay)
       writeIndex %= newDelay;
     }
@@ -132,11 +155,13 @@ public:
 
 private:
   std::vector<T> buffer;
+  std::vector<T> bufferRight;
   size_t writeIndex;
   size_t delaySamples;
 
   void updateBuffer() {
     buffer.assign(delaySamples > 0 ? delaySamples : 1, 0.0f);
+    bufferRight.assign(buffer.size(), 0.0f);
     writeIndex = 0;
   }
 };
@@ -461,6 +486,26 @@ public:
     }
     return result;
   }
+  void processStereo(T &left, T &right) {
+    for (std::size_t e = 0; e < effects.size(); e++) {
+      T l = left, r = right;
+      if (auto echo = std::get_if<EchoEffect<T>>(&effects[e].config)) {
+        echo->processStereo(l, r);
+      } else if (auto allpass =
+                     std::get_if<AllPassEffect<T>>(&effects[e].config)) {
+        allpass->processStereo(l, r);
+      } else if (auto sum = std::get_if<Adder<T>>(&effects[e].config)) {
+        sum->processStereo(l, r);
+      } else if (auto pipe = std::get_if<Piper<T>>(&effects[e].config)) {
+        pipe->processStereo(l, r);
+      } else {
+        l = 0;
+        r = 0;
+      }
+      left = (left + l) / effects.size();
+      right = (right + r) / effects.size();
+    }
+  }
   std::vector<Effect<T>> effects;
 };
 
@@ -492,10 +537,134 @@ public:
     }
     return final_result;
   }
+  void processStereo(T &left, T &right) {
+    T finalLeft = 0, finalRight = 0;
+    for (std::size_t p = 0; p < pipes.size(); p++) {
+      T l = left, r = right;
+      auto &effects = pipes[p];
+      for (std::size_t e = 0; e < effects.size(); e++) {
+        if (auto echo = std::get_if<EchoEffect<float>>(&effects[e].config)) {
+          echo->processStereo(l, r);
+        } else if (auto allpass =
+                       std::get_if<AllPassEffect<float>>(&effects[e].config)) {
+          allpass->processStereo(l, r);
+        } else if (auto sum = std::get_if<Adder<float>>(&effects[e].config)) {
+          sum->processStereo(l, r);
+        } else if (auto pipe = std::get_if<Piper<float>>(&effects[e].config)) {
+          pipe->processStereo(l, r);
+        }
+      }
+      finalLeft += l * mix[p];
+      finalRight += r * mix[p];
+    }
+    left = finalLeft;
+    right = finalRight;
+  }
   std::vector<std::vector<Effect<T>>> pipes;
   std::vector<float> mix;
 };
 
+// Real-time chorus for the streaming stereo bus. Every voice reads the delay
+// line through its own slow LFO. The right channel uses the same LFO a
+// quarter period later (cosine instead of sine), which is what spreads the
+// voices across the stereo field. Parameters follow Effect::ChorusConfig:
+// base delay in seconds and pitch depth in cents.
+template <typename T> class StereoChorus {
+public:
+  void configure(float delaySeconds, float depthCents, int numVoices,
+                 float sampleRate) {
+    numVoices = std::clamp(numVoices, 1, 8);
+    if (delaySeconds == delaySeconds_ && depthCents == depthCents_ &&
+        numVoices == static_cast<int>(voices_.size()) &&
+        sampleRate == sampleRate_)
+      return;
+    delaySeconds_ = delaySeconds;
+    depthCents_ = depthCents;
+    sampleRate_ = sampleRate;
+
+    baseDelay_ = std::clamp(delaySeconds, 0.005f, 0.05f) * sampleRate;
+    size_t size = 1;
+    while (size < static_cast<size_t>(2.0f * baseDelay_) + 4)
+      size <<= 1;
+    left_.assign(size, 0);
+    right_.assign(size, 0);
+    mask_ = size - 1;
+    write_ = 0;
+
+    const float twoPi = 2.0f * static_cast<float>(M_PI);
+    voices_.resize(numVoices);
+    for (int v = 0; v < numVoices; v++) {
+      Voice &voice = voices_[v];
+      float rate = 0.25f + 0.13f * v; // Hz, spread so voices never lock
+      // A delay swinging by A samples at 'rate' Hz bends the pitch by at
+      // most 2*pi*rate*A/sampleRate, solve for the requested depth
+      float ratio = std::pow(2.0f, depthCents / 1200.0f) - 1.0f;
+      voice.depth = std::min(ratio * sampleRate / (twoPi * rate),
+                             baseDelay_ - 1.0f);
+      float angle = twoPi * rate / sampleRate;
+      voice.stepCos = std::cos(angle);
+      voice.stepSin = std::sin(angle);
+      float start = twoPi * v / numVoices;
+      voice.s = std::sin(start);
+      voice.c = std::cos(start);
+    }
+  }
+
+  void process(T &left, T &right) {
+    left_[write_] = left;
+    right_[write_] = right;
+
+    T wetLeft = 0, wetRight = 0;
+    for (Voice &voice : voices_) {
+      wetLeft += read(left_, baseDelay_ + voice.depth * voice.s);
+      wetRight += read(right_, baseDelay_ + voice.depth * voice.c);
+
+      // Rotate the LFO phasor instead of calling sin/cos per sample
+      float s = voice.s * voice.stepCos + voice.c * voice.stepSin;
+      float c = voice.c * voice.stepCos - voice.s * voice.stepSin;
+      voice.s = s;
+      voice.c = c;
+    }
+    if (++renormalize_ == 4096) {
+      renormalize_ = 0;
+      for (Voice &voice : voices_) {
+        float n = 1.0f / std::sqrt(voice.s * voice.s + voice.c * voice.c);
+        voice.s *= n;
+        voice.c *= n;
+      }
+    }
+    write_ = (write_ + 1) & mask_;
+
+    const float wet = 1.0f / voices_.size();
+    left = 0.5f * (left + wetLeft * wet);
+    right = 0.5f * (right + wetRight * wet);
+  }
+
+private:
+  struct Voice {
+    float depth = 0; // samples
+    float s = 0, c = 1;
+    float stepCos = 1, stepSin = 0;
+  };
+
+  T read(const std::vector<T> &line, float delay) const {
+    float pos = static_cast<float>(write_) - delay;
+    int i0 = static_cast<int>(std::floor(pos));
+    float frac = pos - i0;
+    T a = line[static_cast<size_t>(i0) & mask_];
+    T b = line[static_cast<size_t>(i0 + 1) & mask_];
+    return a + (b - a) * frac;
+  }
+
+  std::vector<T> left_, right_;
+  std::vector<Voice> voices_;
+  size_t mask_ = 0;
+  size_t write_ = 0;
+  float baseDelay_ = 0;
+  float delaySeconds_ = -1, depthCents_ = -1, sampleRate_ = 0;
+  int renormalize_ = 0;
+};
+
 namespace PresetEffects {
 Effect<float> syntheticReverb(float dry, float wet);
 }
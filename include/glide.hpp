@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <optional>
+#include <string>
+
+// -----------------------------------------------------------------------------
+// Portamento for legato playing.
+//
+// A gliding voice keeps rendering the rank it started on and scales the phase
+// increment of every pipe by a ratio that slews towards the pitch being
+// played. A pitch change is a retarget of that ratio, which is O(1) and never
+// touches the ranks. Linear slews move the frequency by the same amount every
+// sample, exponential ones by the same number of cents.
+// -----------------------------------------------------------------------------
+namespace glide {
+
+enum class Curve { Linear, Exponential };
+
+// Poly gives every note its own voice, gliding from the previous note. The
+// others play one voice, sounding the last, lowest or highest held key.
+enum class Mode { Poly, Last, Low, High };
+
+inline std::optional<Curve> curveFromString(const std::string &s) {
+  if (s == "linear")
+    return Curve::Linear;
+  if (s == "exponential" || s == "exp")
+    return Curve::Exponential;
+  return std::nullopt;
+}
+
+inline std::optional<Mode> modeFromString(const std::string &s) {
+  if (s == "poly")
+    return Mode::Poly;
+  if (s == "last")
+    return Mode::Last;
+  if (s == "low")
+    return Mode::Low;
+  if (s == "high")
+    return Mode::High;
+  return std::nullopt;
+}
+
+inline std::string modeToString(Mode mode) {
+  switch (mode) {
+  case Mode::Poly:
+    return "poly";
+  case Mode::Last:
+    return "last";
+  case Mode::Low:
+    return "low";
+  case Mode::High:
+    return "high";
+  }
+  return "invalid";
+}
+
+inline std::string curveToString(Curve curve) {
+  return curve == Curve::Linear ? "linear" : "exponential";
+}
+
+// Frequency ratio of one voice, advanced once per sample
+class Slew {
+public:
+  // Sets the ratio right away
+  void jump(float ratio) {
+    ratio_ = ratio;
+    target_ = ratio;
+    remaining_ = 0;
+  }
+
+  // Slews from wherever the ratio is to 'ratio' in 'samples' samples
+  void retarget(float ratio, int samples, Curve curve) {
+    target_ = ratio;
+    if (samples <= 0 || ratio_ <= 0.0f || ratio <= 0.0f) {
+      jump(ratio);
+      return;
+    }
+    curve_ = curve;
+    remaining_ = samples;
+    if (curve == Curve::Linear)
+      step_ = (ratio - ratio_) / samples;
+    else
+      step_ = static_cast<float>(
+          std::pow(static_cast<double>(ratio) / ratio_, 1.0 / samples));
+  }
+
+  float next() {
+    if (remaining_ > 0) {
+      ratio_ = curve_ == Curve::Linear ? ratio_ + step_ : ratio_ * step_;
+      // Land exactly, whatever rounding did on the way
+      if (--remaining_ == 0)
+        ratio_ = target_;
+    }
+    return ratio_;
+  }
+
+  float value() const { return ratio_; }
+  float target() const { return target_; }
+
+private:
+  float ratio_ = 1.0f;
+  float target_ = 1.0f;
+  float step_ = 0.0f;
+  int remaining_ = 0;
+  Curve curve_ = Curve::Linear;
+};
+
+// Keys held down on a mono voice, oldest first. Fixed size, a key pressed
+// with the stack full pushes out the oldest one.
+class NoteStack {
+public:
+  static constexpr int CAPACITY = 16;
+
+  void push(int pitch) {
+    remove(pitch);
+    if (size_ == CAPACITY)
+      remove(pitches_[0]);
+    pitches_[size_++] = pitch;
+  }
+
+  void remove(int pitch) {
+    auto end = pitches_.begin() + size_;
+    auto it = std::remove(pitches_.begin(), end, pitch);
+    size_ = static_cast<int>(it - pitches_.begin());
+  }
+
+  void clear() { size_ = 0; }
+  bool empty() const { return size_ == 0; }
+
+  // The key that should sound, -1 when none is held
+  int pick(Mode mode) const {
+    if (size_ == 0)
+      return -1;
+    auto begin = pitches_.begin();
+    auto end = begin + size_;
+    switch (mode) {
+    case Mode::Low:
+      return *std::min_element(begin, end);
+    case Mode::High:
+      return *std::max_element(begin, end);
+    case Mode::Poly:
+    case Mode::Last:
+      break;
+    }
+    return pitches_[size_ - 1];
+  }
+
+private:
+  std::array<int, CAPACITY> pitches_{};
+  int size_ = 0;
+};
+
+} // namespace glide
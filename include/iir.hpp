@@ -17,6 +17,8 @@ public:
     memoryY.clear();
     memoryX.resize(memory, 0);
     memoryY.resize(memory, 0);
+    memoryXRight.assign(memory, 0);
+    memoryYRight.assign(memory, 0);
   }
 
   // Set the zeros coefficients (as)
@@ -27,6 +29,8 @@ public:
 
   // Example processing methods (to be implemented)
   T process(T in);
+  // Same filter on the right channel of a stereo stream, with its own state
+  T processRight(T in);
   T peek();
 
   nlohmann::json toJson() const {
@@ -66,6 +70,8 @@ public:
   int memory;
   std::vector<T> memoryX;
   std::vector<T> memoryY;
+  std::vector<T> memoryXRight;
+  std::vector<T> memoryYRight;
   std::vector<double> as;
   std::vector<double> bs;
   float presentable = 0;
@@ -19,6 +19,7 @@
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -26,6 +27,7 @@
 
 #include "effect.hpp"
 #include "note.hpp"
+#include "notecache.hpp"
 #include "notes.hpp"
 #include "sound.hpp"
 #include "term.hpp"
@@ -116,6 +118,16 @@ public:
     this->loaderFunc = func;
   }
 
+  // Keeps the rendered notes in 'directory' and loads them from there when
+  // the same sound is prepared again, an empty directory turns it off
+  void setNoteCache(const std::string &directory) {
+    if (directory.empty()) {
+      this->noteCache.reset();
+    } else {
+      this->noteCache = std::make_unique<NoteCache>(directory);
+    }
+  }
+
   void prepareSound(int sampleRate, ADSR &adsr, Sound::WaveForm f,
                     std::vector<Effect<short>> &effects, int nbrThreads);
   void prepareSound(int sampleRate, ADSR &adsr,
@@ -140,9 +152,25 @@ public:
     nlohmann::json j;
     file >> j;
 
-    // Map the content to soundMap
+    // Map the content to soundMap. Velocity layered entries are accepted
+    // too, the buffers here are prerendered so only the last (loudest)
+    // layer is used.
     for (const auto &[key, value] : j.items()) {
-      soundMap[key] = value.get<std::string>();
+      if (value.is_string()) {
+        soundMap[key] = value.get<std::string>();
+      } else if (value.is_array() && !value.empty()) {
+        const auto &layer = value.back();
+        if (layer.is_string()) {
+          soundMap[key] = layer.get<std::string>();
+        } else if (layer.is_object() && layer.contains("file") &&
+                   layer["file"].is_string()) {
+          soundMap[key] = layer["file"].get<std::string>();
+        } else if (layer.is_object() && layer.contains("files") &&
+                   layer["files"].is_array() && !layer["files"].empty() &&
+                   layer["files"][0].is_string()) {
+          soundMap[key] = layer["files"][0].get<std::string>();
+        }
+      }
     }
   }
 
@@ -158,6 +186,38 @@ private:
 
   std::map<std::string, int> keyToBufferIndex;
   std::map<std::string, Note> notes;
+  std::unique_ptr<NoteCache> noteCache;
+
+  // A note rendered by prepareSound(), waiting to be uploaded to its buffer
+  struct RenderedNote {
+    Note note;
+    std::vector<short> samples;
+    ALenum format = AL_FORMAT_MONO16;
+    int bytes = 0;
+    int sampleRate = 0;
+    bool ready = false;
+    // Printed once all notes are rendered
+    std::string warning;
+  };
+  // Renders the note of buffer 'index' with the thread's own copy of the
+  // effects. Runs on several threads at once.
+  using RenderTask = std::function<void(
+      int index, std::vector<Effect<short>> &effects, RenderedNote &out)>;
+  // Renders every note on 'nbrThreads' threads, each taking the next note
+  // in 'order' when it is done with one, and uploads them to OpenAL on the
+  // calling thread. The notes are cached under 'description'.
+  void renderNotes(const std::vector<std::string> &keys,
+                   const std::vector<int> &order,
+                   const std::vector<Effect<short>> &effects, int nbrThreads,
+                   const RenderTask &render,
+                   const nlohmann::json &description);
+  // What the notes are rendered from besides the waveform or preset, for
+  // the note cache
+  nlohmann::json describeNotes(int sampleRate, int length, const ADSR &adsr,
+                               const std::vector<Effect<short>> &effects);
+  // Uploads the notes cached under 'description', false if there are none
+  bool loadCachedNotes(const std::vector<std::string> &keys, int sampleRate,
+                       int length, const nlohmann::json &description);
 
   float volume = 1.0;
 
@@ -1,43 +1,51 @@
 #ifndef KEYBOARDSTREAM_HPP
 #define KEYBOARDSTREAM_HPP
 
+#include <algorithm>
+#include <array>
 #include <chrono> // for std::chrono::seconds
 #include <cmath>
 #include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "analyzer.hpp"
 #include "effect.hpp"
+#include "glide.hpp"
 #include "looper.hpp"
+#include "midiinput.hpp"
+#include "networksink.hpp"
 #include "note.hpp"
 #include "notes.hpp"
+#include "sequencer.hpp"
 #include "sound.hpp"
 #include "term.hpp"
+#include "transport.hpp"
 #include "waveread.hpp"
+#include "workerpool.hpp"
 #include "yin.hpp"
 
 #include "json.hpp"
 
-#ifndef SAMPLERATE
-#define SAMPLERATE 44100
-#endif
-
 class KeyboardStream {
 public:
   KeyboardStream(int sampleRate, notes::TuningSystem tuning)
-      : sampleRate(sampleRate), tuning(tuning) {}
+      : sampleRate(sampleRate), tuning(tuning), yin(sampleRate) {}
   ~KeyboardStream() { teardown(); }
 
   void setup() {}
 
-  void teardown() {}
+  // Stops the hot swap thread (see swapSynth())
+  void teardown();
 
   void setVolume(float volume_) { this->volume = volume_; }
 
@@ -77,8 +85,27 @@ public:
   void prepareSound(int sampleRate, ADSR &adsr,
                     std::vector<Effect<float>> &effects);
   void fillBuffer(float *buffer, const int len);
-  void registerNote(const std::string &note);
-  void registerNoteRelease(const std::string &note);
+  // 'at' is the audio frame to start or release the note at (see
+  // toAudioFrame()), 0 for the next block. Called under lock(), they remove
+  // the notes that have ended from the map the audio thread renders.
+  void registerNote(const std::string &note, int velocity = 127,
+                    std::uint64_t at = 0);
+  void registerNoteRelease(const std::string &note, std::uint64_t at = 0);
+  // The frame a note played at 'time' sounds at, one block later, so that
+  // notes keep their spacing whatever point of a block they come in at
+  std::uint64_t toAudioFrame(std::chrono::steady_clock::time_point time) const;
+  // Keys released while the pedal is down sound until it is let go
+  void setSustain(bool down);
+  void releaseAll();
+  // Bends every voice, the sampled ones excepted
+  void setPitchBend(float semitones) {
+    this->pitchBend = static_cast<float>(std::pow(2.0, semitones / 12.0));
+  }
+  // A live MIDI message, from the MIDI input or the input websocket. Notes
+  // keep the timing they were played with, pitch bend spans two semitones,
+  // and the sustain pedal (CC 64) and all notes/sound off (CC 123/120) are
+  // followed. Called with the lock held.
+  void applyMidiEvent(const MidiInput::Event &event);
   void registerButtonPress(int note);
   void registerButtonRelease(int note);
   void printInstructions();
@@ -86,23 +113,79 @@ public:
   void setLegato(bool mode, float speedMs = 500) {
     this->legatoMode = mode;
     this->legatoSpeed = speedMs;
-    for (Oscillator &oscillator : this->synth) {
-      oscillator.setLegato(mode, speedMs);
-    }
+    this->heldNotes.clear();
   }
 
-  void resetLegato() {
-    for (Oscillator &oscillator : this->synth) {
-      oscillator.resetLegato();
-    }
+  // How legato notes are voiced and how they slew (see glide.hpp)
+  void setGlide(glide::Mode mode, glide::Curve curve) {
+    this->glideMode = mode;
+    this->glideCurve = curve;
+    this->heldNotes.clear();
+  }
+
+  void setTuning(notes::TuningSystem tuning) {
+    this->tuning = tuning;
+    this->editSynth([tuning](std::vector<Oscillator> &bank) {
+      for (Oscillator &oscillator : bank)
+        oscillator.setTuning(tuning);
+    });
   }
 
+  // The oscillators are rebuilt with the effects, so they are swapped in
   void copyEffectsToSynths() {
-    for (int i = 0; i < this->synth.size(); i++) {
-      this->synth[i].setEffects(this->effects);
-    }
+    this->swapSynth([effects = this->effects](std::vector<Oscillator> &bank) {
+      for (Oscillator &oscillator : bank)
+        oscillator.effects = effects;
+    });
   }
 
+  // One velocity layer of a note in the sound map. A layer holding several
+  // files is a round-robin group, cycled through on every note on.
+  struct SampleLayer {
+    int velocityLow = 0;
+    int velocityHigh = 127;
+    std::vector<std::string> files;
+
+    // Accepts either a plain file name (full velocity range) or an object
+    // {"velocity": [lo, hi], "file": "a.wav"} / {"files": ["a.wav", ...]}
+    static std::optional<SampleLayer> fromJson(const nlohmann::json &j) {
+      SampleLayer layer;
+      if (j.is_string()) {
+        layer.files.push_back(j.get<std::string>());
+        return layer;
+      }
+      if (!j.is_object())
+        return std::nullopt;
+
+      if (j.contains("velocity")) {
+        const auto &v = j["velocity"];
+        if (!v.is_array() || v.size() != 2 || !v[0].is_number_integer() ||
+            !v[1].is_number_integer())
+          return std::nullopt;
+        layer.velocityLow = std::clamp(v[0].get<int>(), 0, 127);
+        layer.velocityHigh = std::clamp(v[1].get<int>(), 0, 127);
+        if (layer.velocityLow > layer.velocityHigh)
+          return std::nullopt;
+      }
+
+      if (j.contains("file") && j["file"].is_string())
+        layer.files.push_back(j["file"].get<std::string>());
+      if (j.contains("files") && j["files"].is_array())
+        for (const auto &f : j["files"])
+          if (f.is_string())
+            layer.files.push_back(f.get<std::string>());
+
+      if (layer.files.empty())
+        return std::nullopt;
+      return layer;
+    }
+  };
+
+  // The sound map maps a note to a file name, or to a list of velocity
+  // layers:
+  //   "C4": "c4.wav"
+  //   "C4": [{"velocity": [0, 63], "file": "c4_pp.wav"},
+  //          {"velocity": [64, 127], "files": ["c4_f1.wav", "c4_f2.wav"]}]
   void loadSoundMap(std::string soundMapFile) {
     // Open the file for reading
     std::ifstream file(soundMapFile);
@@ -119,7 +202,21 @@ public:
 
     // Map the content to soundMap
     for (const auto &[key, value] : j.items()) {
-      soundMap[key] = value.get<std::string>();
+      std::vector<SampleLayer> layers;
+      if (value.is_array()) {
+        for (const auto &l : value) {
+          if (auto layer = SampleLayer::fromJson(l))
+            layers.push_back(*layer);
+        }
+      } else if (auto layer = SampleLayer::fromJson(value)) {
+        layers.push_back(*layer);
+      }
+
+      if (layers.empty()) {
+        std::cerr << "Ignoring invalid sound map entry: " << key << std::endl;
+        continue;
+      }
+      soundMap[key] = layers;
     }
   }
 
@@ -131,7 +228,8 @@ public:
     return static_cast<long>(millis);
   }
 
-  float generateSample(std::string note, float phase, int index);
+  void generateFrame(int pitch, int index, const std::vector<int> &sampleSlots,
+                     float &left, float &right);
   struct mutex_holder {
     std::mutex mutex;
     mutex_holder() : mutex() {}
@@ -149,10 +247,17 @@ public:
     notes::TuningSystem tuning = notes::TuningSystem::EqualTemperament;
 
     Oscillator(int sampleRate, notes::TuningSystem tuning)
-        : sampleRate(sampleRate), tuning(tuning) {
+        : sampleRate(sampleRate), tuning(tuning),
+          pitches(&notes::getTuning(tuning)) {
       this->initialize();
     }
 
+    // The ranks don't depend on the tuning, so this is cheap
+    void setTuning(notes::TuningSystem tuning) {
+      this->tuning = tuning;
+      this->pitches = &notes::getTuning(tuning);
+    }
+
     // In the future, add effects here too
     nlohmann::json toJson() const {
       return {{"sound", Sound::Rank<float>::presetToJson(this->sound)},
@@ -174,7 +279,7 @@ public:
 
       int sampleRate = j["sampleRate"].get<int>();
       notes::TuningSystem tuning = j["tuning"].get<notes::TuningSystem>();
-      Oscillator osc(sampleRate, tuning);
+      Oscillator osc(Unbuilt{}, sampleRate, tuning);
 
       // Parse volume, octave, detune (optional; default to existing values)
       if (j.contains("volume") && j["volume"].is_number())
@@ -202,11 +307,14 @@ public:
         osc.sound = *presetOpt;
       }
 
-      osc.initialize();
-
+      // Built by initialize(), or on its first block (see beginBlock())
       return osc;
     }
 
+    // A copy of the settings and samples without the ranks, cheap enough
+    // to take with the lock held. Built by initialize().
+    Oscillator unbuilt() const;
+
     void setVolume(float volume);
     void setOctave(int octave);
     void setDetune(int detune);
@@ -217,74 +325,144 @@ public:
 
     std::string printSynthConfig() const;
 
-    float getSample(const std::string &note, int index);
+    // Rendering may run on several threads at once, one note per thread.
+    // beginBlock() takes the rank lock for the whole block so getFrame()
+    // doesn't have to, endBlock() releases it.
+    void beginBlock() {
+      this->ranksMtx.mutex.lock();
+      if (!this->initialized)
+        this->initialize();
+    }
+    void endBlock() { this->ranksMtx.mutex.unlock(); }
+    void getFrame(int pitch, int index, int sampleSlot, float &left,
+                  float &right);
+    // Renders the rank of 'pitch' with its frequency scaled by 'ratio', for
+    // a gliding voice. 'phases' holds up to 'count' pipe phases.
+    void getGlideFrame(int pitch, int index, int sampleSlot, float ratio,
+                       float *phases, std::size_t count, float &left,
+                       float &right);
+    // Where getFrame() left the pipe phases of 'pitch' at 'index', for a
+    // voice that goes on with getGlideFrame()
+    void glidePhases(int pitch, int index, float *phases, std::size_t count);
     void reset(const std::string &note);
+    // Applies the octave and detune to the ranks, and to any built later
     void updateFrequencies() {
       std::lock_guard<std::mutex> lk(this->ranksMtx.mutex);
-      for (auto &kv : this->ranks) {
-        Sound::Rank<float> &r = kv.second;
-        for (Sound::Pipe &pipe : r.pipes) {
-          Note &note = pipe.first;
-          note.frequencyAltered = note.frequency * 2 *
-                                  pow(2, this->detune / 1200.0) * 2 *
-                                  pow(2, this->octave);
-        }
-      }
+      this->retuned = true;
+      this->applyFrequencies();
     }
 
-    void applyLegatoFrequency(float frequency) {
-      if (frequency != this->legatoFreq) {
-        this->legatoFreq = frequency;
-        this->legatoRank->setLegato(frequency, this->legatoSpeed,
-                                    this->sampleRate);
-      }
-    }
-    void setSoundMap(std::map<std::string, std::string> &soundMap,
+    void setSoundMap(std::map<std::string, std::vector<SampleLayer>> &soundMap,
                      bool normalize = true);
+    bool hasSamples() const {
+      return this->sampleBank && !this->sampleBank->empty();
+    }
+    int pickSample(const std::string &note, int velocity);
     void setEffects(std::vector<Effect<float>> &effects) {
       this->effects = effects;
       initialize();
     }
-    void setLegato(bool mode, float speedMs = 500) {
-      this->legatoMode = mode;
-      this->legatoSpeed = speedMs;
-    }
-    void resetLegato() { this->legatoRank = std::nullopt; }
 
     std::vector<Effect<float>> effects;
 
   private:
     int index = 0;
     mutex_holder ranksMtx;
-    std::map<std::string, Sound::Rank<float>> ranks;
+    // One rank per note number (see notes::getNoteIndex()), in equal
+    // temperament. 'pitches' retunes them while rendering.
+    std::vector<Sound::Rank<float>> ranks;
+    const notes::Tuning *pitches;
     bool initialized = false;
-    std::map<std::string, std::vector<short>> samples;
-    std::optional<Sound::Rank<float>> legatoRank;
-    float legatoFreq = 0;
-    bool legatoMode = false;
-    float legatoSpeed = 500;
+    bool retuned = false;
+
+    struct Unbuilt {};
+    Oscillator(Unbuilt, int sampleRate, notes::TuningSystem tuning)
+        : sampleRate(sampleRate), tuning(tuning),
+          pitches(&notes::getTuning(tuning)) {}
+    void applyFrequencies();
+
+    // Velocity layers of one note, resolved at load time. layerForVelocity
+    // maps a MIDI velocity straight to a layer, and every layer owns a
+    // run of layerSlots entries (sampleBank indices) cycled round-robin.
+    struct SampleZone {
+      struct Layer {
+        int first = 0;
+        int count = 0;
+        int next = 0;
+      };
+      std::array<uint8_t, 128> layerForVelocity{};
+      std::vector<Layer> layers;
+    };
+    // Decoded wave file, interleaved when stereo
+    struct SampleBuffer {
+      std::vector<short> data;
+      int channels = 1;
+    };
+    // Shared by the copies of the oscillator, it never changes once loaded
+    std::shared_ptr<const std::vector<SampleBuffer>> sampleBank;
+    std::vector<int> layerSlots;
+    std::map<std::string, SampleZone> sampleZones;
   };
 
+  // Pipe phases a gliding voice keeps per oscillator
+  static constexpr std::size_t GLIDE_PIPES = 16;
+
   struct NotePress {
     ADSR adsr;
     std::string note;
+    int pitch = -1; // note number of 'note'
     long time;
     double frequency;
     float phase = 0;
     bool release = false;
     int index = 0;
     int rankIndex = 0;
+    int velocity = 127;
+    float velocityGain = 1.0f;
+    // The sample each oscillator plays, by oscillator, -1 for none
+    std::vector<int> sampleSlots;
+    // Set by the audio thread when the envelope has ended, the entry is
+    // removed later by the control thread (see reapFinishedNotes())
+    bool finished = false;
+    // Legato voices render the rank of rankPitch, at slew times its
+    // frequency, with GLIDE_PIPES phases per oscillator
+    int rankPitch = -1;
+    glide::Slew slew;
+    std::vector<float> phases;
+    // Audio frames to start and release the note at, 0 for right away
+    std::uint64_t startFrame = 0;
+    std::uint64_t releaseFrame = 0;
 
     void debugPrint() const {
-      term::print(
-          "Note: %s | Time: %ld | Freq: %.2f | Release: %s | Index: %d\n",
-          note.c_str(), time, frequency, release ? "true" : "false", index);
+      term::print("Note: %s | Time: %ld | Freq: %.2f | Velocity: %d | "
+                  "Release: %s | Index: %d\n",
+                  note.c_str(), time, frequency, velocity,
+                  release ? "true" : "false", index);
     }
   };
 
   std::vector<Oscillator> synth;
   float gain = 0.00001f;
 
+  // --- Hot swap ---
+  // Changes the oscillators without a break in the sound. 'edit' is called
+  // on a copy of the oscillators' settings (see Oscillator::unbuilt()) and
+  // may change them, or replace them all. The copy is then built on the
+  // swap thread, off the lock, and installed between two blocks, and the
+  // notes crossfade from the old oscillators to the new over SWAP_FADE_MS.
+  // Edits are applied in the order they are made, each to the oscillators
+  // the one before installed. Doesn't need the lock.
+  using SynthEdit = std::function<void(std::vector<Oscillator> &)>;
+  void swapSynth(SynthEdit edit);
+  static constexpr int SWAP_FADE_MS = 20;
+  // Changes the oscillators in place, for edits that need no rebuilding,
+  // like volume and tuning. Applied again to the oscillators of a swap
+  // being built, so that installing them doesn't undo it. Needs the lock.
+  void editSynth(const SynthEdit &edit);
+  // Waits until the swaps asked for so far are installed. Not with the
+  // lock held.
+  void waitForSwaps();
+
   void printSynthConfig() const;
   void printNotesPressed() const {
 
@@ -305,8 +483,9 @@ public:
 
   short amplitude = 32767;
   float duration = 0.1f;
-  ADSR adsr =
-      ADSR(amplitude, 1, 1, 3, 3, 0.8, static_cast<int>(SAMPLERATE *duration));
+  ADSR adsr = ADSR(
+      amplitude, 1, 1, 3, 3, 0.8,
+      static_cast<int>(Config::instance().getSampleRate() * duration));
   std::vector<Effect<float>> effects;
 
   nlohmann::json toJson() const {
@@ -335,7 +514,14 @@ public:
     if (!adsrOpt)
       return -1;
 
-    this->sampleRate = j["sampleRate"].get<int>();
+    // The stored sample rate is informational only, everything is rebuilt
+    // at the rate the audio device was opened with
+    const int savedSampleRate = j["sampleRate"].get<int>();
+    if (savedSampleRate != this->sampleRate) {
+      term::print(term::Style::Yellow,
+                  "Config saved at %d Hz, loading it at %d Hz\n",
+                  savedSampleRate, this->sampleRate);
+    }
 
     // ----- Build KeyboardStream -----
     this->adsr = *adsrOpt;
@@ -345,21 +531,34 @@ public:
     if (j.contains("effects") && j["effects"].is_array()) {
       for (const auto &e : j["effects"]) {
         auto effectOpt = Effect<float>::fromJson(e);
-        if (effectOpt)
+        if (effectOpt) {
+          effectOpt->sampleRate = this->sampleRate;
+          if (auto *echo = Effect<float>::getIf<EchoEffect<float>>(
+                  effectOpt->config)) {
+            echo->setSampleRate(static_cast<float>(this->sampleRate));
+          }
           this->effects.push_back(*effectOpt);
+        }
       }
     }
 
     // ----- Oscillators ("synth") -----
-    this->synth.clear();
-    if (j.contains("oscillators") && j["oscillators"].is_array()) {
-      for (const auto &o : j["oscillators"]) {
+    // Swapped in once built, the notes keep sounding meanwhile
+    const int rate = this->sampleRate;
+    const nlohmann::json oscillators =
+        j.value("oscillators", nlohmann::json::array());
+    if (!oscillators.is_array())
+      return -1;
+    this->swapSynth([oscillators, rate](std::vector<Oscillator> &bank) {
+      bank.clear();
+      for (const auto &o : oscillators) {
         auto oscOpt = Oscillator::fromJson(o);
         if (oscOpt) {
-          this->synth.push_back(*oscOpt);
+          oscOpt->sampleRate = rate;
+          bank.push_back(std::move(*oscOpt));
         }
       }
-    }
+    });
     return 0;
   }
   /*
@@ -421,19 +620,50 @@ public:
   }
 
   Looper &getLooper() { return this->looper; }
+  Transport &getTransport() { return this->transport; }
+  Sequencer &getSequencer() { return this->sequencer; }
+  Analyzer &getAnalyzer() { return this->analyzer; }
+  NetworkSink &getNetworkSink() { return this->networkSink; }
+
+  // The settings /api/config shows, gain, envelope, tuning and global
+  // effects. A copy is published after every change, so that they can be
+  // read without the lock, along with its serialized form.
+  struct ConfigSnapshot {
+    std::uint64_t version;
+    nlohmann::json config;
+    std::string body;
+  };
+  nlohmann::json configToJson() const;
+  // Called with the lock held, after changing any of the settings above
+  void publishConfig();
+  std::shared_ptr<const ConfigSnapshot> getConfigSnapshot() const {
+    return std::atomic_load(&this->configSnapshot);
+  }
 
-  int sampleRate = SAMPLERATE;
+  int sampleRate = Config::instance().getSampleRate();
   notes::TuningSystem tuning = notes::TuningSystem::EqualTemperament;
 
 private:
-  std::map<std::string, std::string> soundMap;
+  std::map<std::string, std::vector<SampleLayer>> soundMap;
   std::mutex mtx;
+  std::shared_ptr<const ConfigSnapshot> configSnapshot =
+      std::make_shared<const ConfigSnapshot>(
+          ConfigSnapshot{0, nullptr, "null"});
   void (*loaderFunc)(unsigned, unsigned) = nullptr;
   std::string soundMapFile;
 
   bool legatoMode = false;
-  int legatoRankIndex = 0;
   float legatoSpeed = 500;
+  glide::Mode glideMode = glide::Mode::Last;
+  glide::Curve glideCurve = glide::Curve::Linear;
+  // Keys held on the mono voice, and the last frequency played, which a
+  // new poly voice glides from
+  glide::NoteStack heldNotes;
+  double glideFrom = 0;
+  static constexpr const char *MONO_VOICE = "mono";
+  float pitchBend = 1.0f;
+  bool sustainPedal = false;
+  std::vector<std::string> sustainedNotes;
 
   std::unordered_map<std::string, Note> notes;
   std::unordered_map<std::string, NotePress> notesPressed;
@@ -442,7 +672,92 @@ private:
   Sound::Rank<float>::Preset rankPreset = Sound::Rank<float>::Preset::None;
   std::unordered_map<std::string, Sound::Rank<float>> ranks;
   YIN yin;
-  Looper looper;
+  // Stepped once per block, the looper and its metronome follow it
+  Transport transport{
+      Config::instance().getSampleRate(),
+      static_cast<double>(Config::instance().getMetronomeBPM())};
+  Looper looper{transport};
+
+  // The sequencer plays on voices of its own, set up in prepareSound(), so
+  // that starting a note from the audio thread doesn't touch notesPressed
+  Sequencer sequencer;
+  static constexpr int SEQUENCER_VOICES = 16;
+  std::vector<std::pair<const std::string, NotePress>> sequencerVoices;
+  int nextSequencerVoice = 0;
+
+  // Taps the output for the live scope and spectrum
+  Analyzer analyzer{Config::instance().getSampleRate()};
+  // Taps it again, interleaved, for listeners of /api/stream
+  NetworkSink networkSink{Config::instance().getSampleRate(),
+                          Config::instance().getChannels()};
+
+  // Stereo render bus, planar while rendering and interleaved on output
+  int channels = Config::instance().getChannels();
+  std::vector<float> busLeft;
+  std::vector<float> busRight;
+  std::vector<float> busMid;
+  StereoChorus<float> chorus;
+
+  // Voice rendering, split over the worker pool when more than one note
+  // sounds. Each voice renders into its own lane of voiceScratch and the
+  // lanes are summed in voice order, so the mix doesn't depend on timing.
+  std::unique_ptr<WorkerPool> pool;
+  std::vector<std::pair<const std::string, NotePress> *> voices;
+  std::vector<float> voiceScratch;
+  std::vector<char> voiceDone;
+  int blockFrames = 0;
+  // Audio frame of the first frame being rendered
+  std::uint64_t renderStart = 0;
+  // When the last block started, in audio frames and wall clock time
+  std::uint64_t blockStart = 0;
+  int blockLength = 0;
+  std::chrono::steady_clock::time_point blockTime;
+
+  // Hot swap (see swapSynth()). Once a new bank is installed, the old one
+  // sounds on in fadingSynth, fading out from frame fadeStart on, until the
+  // swap thread takes it back to free it.
+  std::vector<Oscillator> fadingSynth;
+  bool fadeQueued = false;
+  bool fading = false;
+  std::uint64_t fadeStart = 0;
+  int fadeLength = 1;
+  // Signalled by the audio thread when a fade ends, waited on with mtx
+  std::condition_variable fadeDone;
+  // Edits made with editSynth() while a swap is built, to be applied to it
+  // when it is installed
+  bool swapBuilding = false;
+  std::vector<SynthEdit> liveEdits;
+  std::thread swapThread;
+  std::mutex swapMtx;
+  std::condition_variable swapWake;
+  std::condition_variable swapDone;
+  std::deque<SynthEdit> swapEdits;
+  std::uint64_t swapsQueued = 0;
+  std::uint64_t swapsInstalled = 0;
+  bool swapRunning = false;
+  void swapLoop();
+  void installSynth(std::vector<Oscillator> &bank);
+  void generateFrame(std::vector<Oscillator> &bank, int pitch, int index,
+                     const std::vector<int> &sampleSlots, float &left,
+                     float &right);
+
+  // Sets up 'np' to sound 'note' from its start
+  void startNote(NotePress &np, const std::string &note, int velocity);
+  void bendVoice(NotePress &note);
+  void renderVoices(float *left, float *right, int frames,
+                    std::uint64_t start);
+  bool renderVoice(NotePress &note, float *left, float *right, int frames);
+  void applySequencerEvent(const Sequencer::Event &event);
+  void generateGlideFrame(NotePress &note, float ratio, float &left,
+                          float &right);
+  void registerMonoNote(NotePress &np);
+  void registerMonoRelease(const std::string &note);
+  // Slews 'voice' to play 'pitch'
+  void glideTo(NotePress &voice, int pitch);
+  // Erasing map nodes frees memory, so it is kept off the audio thread
+  void reapFinishedNotes();
+  const Effect<float>::ChorusConfig *configureChorus();
+  static void renderVoiceJob(void *context, int index);
 
   float volume = 1.0;
 
@@ -487,6 +802,17 @@ public:
   Sound::Rank<float>::Preset rankPreset = Sound::Rank<float>::Preset::None;
   std::string waveFile;
   std::string midiFile;
+  // ALSA MIDI port played from, "none" opens a port without connecting it
+  std::string midiInput;
+  // Frames per second of the live scope and spectrum
+  double scopeRate = 20.0;
+  // Audio output, "sdl" or one of AudioBackend::create()
+  std::string audioBackend = "sdl";
+  std::string audioFile = "output.wav";
+  // Sessions hosted in server mode, 0 plays a single synth (see session.hpp)
+  int sessions = 0;
+  std::string sessionOutput = "null";
+  std::string sessionDirectory = "sessions";
   std::optional<Effect<float>> effectFIR = std::nullopt;
   std::optional<Effect<float>> effectChorus = std::nullopt;
   std::optional<Effect<float>> effectIIR = std::nullopt;
@@ -495,6 +821,8 @@ public:
   std::optional<Effect<float>> effectPhaseDist = std::nullopt;
   std::optional<Effect<float>> effectGainDist = std::nullopt;
   std::optional<float> legatoSpeed = std::nullopt;
+  glide::Mode glideMode = glide::Mode::Last;
+  glide::Curve glideCurve = glide::Curve::Linear;
 
   bool metronomeActive = false;
   std::string metronomeHigh = "media/metronome/Perc_MetronomeQuartz_hi.wav";
@@ -504,8 +832,10 @@ public:
   int looperBars = 8;
 
   notes::TuningSystem tuning = notes::TuningSystem::EqualTemperament;
+  std::string scalaFile;
+  std::string keyboardMappingFile;
   bool effectReverb = false;
-  EchoEffect<float> effectEcho{1.0, 0.3, 0.0, SAMPLERATE};
+  EchoEffect<float> effectEcho{1.0, 0.3, 0.0};
   float volume = 1.0;
   float duration = 0.1f;
   int port = 8080;
@@ -522,7 +852,8 @@ public:
                 notes::tuning_to_string(this->tuning).c_str());
 
     term::print(term::Style::WhiteBold, "  Sample rate: ");
-    term::print(term::Style::Yellow, "%d\n", SAMPLERATE);
+    term::print(term::Style::Yellow, "%d\n",
+                Config::instance().getSampleRate());
 
     term::print(term::Style::WhiteBold, "  Notes-wave-map: ");
     term::print(term::Style::Yellow, "%s\n",
@@ -653,6 +984,13 @@ public:
       }
     }
 
+    if (legatoSpeed) {
+      term::print(term::Style::WhiteBold, "  Legato: ");
+      term::print(term::Style::Yellow, "%.0f ms, %s, %s\n", *legatoSpeed,
+                  glide::modeToString(glideMode).c_str(),
+                  glide::curveToString(glideCurve).c_str());
+    }
+
     term::print(term::Style::WhiteBold, "  Synthetic reverb: ");
     term::print(term::Style::Yellow, "%s\n", effectReverb ? "On" : "Off");
 
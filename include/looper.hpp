@@ -1,18 +1,50 @@
 #pragma once
 #include "config.hpp"
+#include "ringbuffer.hpp"
+#include "transport.hpp"
+#include "waveread.hpp"
 #include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 // -----------------------------------------------------------------------------
 // Looper: 4-track audio looper with metronome and adjustable BPM (4/4 time)
-// Each loop has a fixed length in bars (default: 8 bars).
+// Each loop is a number of bars long (default: 8 bars) at the current BPM.
+// The tempo and the position within the loop come from a Transport, which
+// whoever calls process() steps once per block, and the metronome clicks on
+// the beats it reports.
+//
+// process() runs on the audio thread and never locks or allocates. Control
+// calls may come from any thread: flags are atomics, and a track gets a new
+// buffer (on a length change, a clear or an undo) by building it here and
+// publishing a pointer to it, which the audio thread picks up on its next
+// block.
+//
+// A change of tempo or of the number of bars keeps the loops and their
+// history. A loop is stretched to the new tempo, which changes its pitch as
+// a tape would, and repeated or cut to the new number of bars (see fit()).
+// Loops are sized for tempos of MIN_BPM and up and at most MAX_BARS bars, and
+// stopping the transport with a tempo of 0 leaves them as they are.
+//
+// Tracks are made of fixed size segments that track buffers and the undo
+// history share. Before writing to a shared segment the audio thread swaps
+// in a copy, taken from a pool of spare segments, so a snapshot for undo
+// only copies pointers. A background thread keeps the pool filled, frees
+// what nothing refers to anymore and writes exports to disk.
 // -----------------------------------------------------------------------------
 class Looper {
 public:
-  Looper();
+  explicit Looper(Transport &transport);
+  ~Looper();
+
+  Looper(const Looper &) = delete;
+  Looper &operator=(const Looper &) = delete;
 
   // --- Recording control ---
   void setRecording(bool enabled);
@@ -23,9 +55,32 @@ public:
 
   void clearTrack(int index);
 
+  // --- Overdub history ---
+  // Every recording pass and clear of a track can be undone, the last
+  // HISTORY_DEPTH of them
+  bool undo(int track);
+  bool redo(int track);
+  int getUndoDepth(int track);
+  int getRedoDepth(int track);
+
+  // --- Export ---
+  // Streams the looper output to <prefix>-mix.wav and every track to
+  // <prefix>-track<N>.wav, until stopExport()
+  bool startExport(const std::string &prefix);
+  void stopExport();
+  bool isExporting() const { return exporting_; }
+  // Blocks dropped because the writer fell behind
+  long getExportOverruns() const { return exportOverruns_; }
+
   // --- Loop length control ---
+  static constexpr double MIN_BPM = 20.0;
+  static constexpr int MAX_BARS = 32;
+
   void setNumBars(int bars);
   int getNumBars() const;
+  // Length of a loop at the current BPM, clamped to [MIN_BPM, MAX_TEMPO],
+  // and number of bars
+  std::size_t getLoopLength() const;
 
   // --- Metronome control ---
   void setBPM(float bpm);
@@ -37,41 +92,133 @@ public:
   void setMetronomeVolume(float v) { metronomeVolume_ = v; }
 
   // --- Audio processing ---
-  // Called from the audio callback to fill the output buffer
-  float update(float input);
+  // Called from the audio callback, between the transport's beginBlock() and
+  // endBlock(). Records 'buffer' into the active track when recording, and
+  // adds the loops and the metronome to it.
+  void process(float *buffer, int frames);
+
+  void toggleRecording();
 
-  void toggleRecording() { this->recording_ = !this->recording_; }
+  static constexpr int HISTORY_DEPTH = 16;
 
 private:
+  static constexpr std::size_t SEGMENT_SHIFT = 12;
+  static constexpr std::size_t SEGMENT_SIZE = std::size_t(1) << SEGMENT_SHIFT;
+  // Spare segments kept ready for the audio thread
+  static constexpr std::size_t SPARE_SEGMENTS = 32;
+  // process() works in chunks of at most this many frames
+  static constexpr int CHUNK = 256;
+
+  struct Segment {
+    // Track buffers and snapshots holding this segment
+    std::atomic<int> refs{1};
+    float samples[SEGMENT_SIZE];
+  };
+
+  struct TrackBuffer {
+    std::size_t length = 0;
+    int bars = 1;
+    std::vector<std::atomic<Segment *>> segments;
+    std::uint64_t generation = 0;
+  };
+
+  // A track as it was before a recording pass, one reference per segment
+  struct Snapshot {
+    std::size_t length = 0;
+    int bars = 1;
+    std::vector<Segment *> segments;
+  };
+
   struct Track {
-    std::vector<float> data;
-    int recordingStartIdx = 0;
-    bool noInputYet = true;
+    // Newest buffer, and the generation the audio thread is playing
+    std::atomic<TrackBuffer *> next{nullptr};
+    std::atomic<std::uint64_t> inUse{0};
+
+    // Guarded by controlMtx_: every buffer not freed yet, and the history
+    std::vector<std::unique_ptr<TrackBuffer>> buffers;
+    std::vector<Snapshot> undo;
+    std::vector<Snapshot> redo;
+
+    // Audio thread only
+    TrackBuffer *current = nullptr;
+    std::size_t pos = 0;
   };
 
   std::vector<Track> tracks_;
-  int activeTrack_;
-  bool recording_ = false;
+  std::atomic<int> activeTrack_;
+  std::atomic<bool> recording_{false};
+  // Bumped by process() as a block starts and as it ends, odd inside one
+  std::atomic<std::uint64_t> blockCount_{0};
 
   // --- Loop timing ---
-  int numBars_;                           // length of loop in bars (default: 8)
-  static constexpr int BEATS_PER_BAR = 4; // 4/4 time
-  std::size_t loopLengthSamples_;         // computed total length in samples
+  Transport &transport_;
+  std::atomic<int> numBars_; // length of loop in bars (default: 8)
+  // The tempo the loops are sized for, the last one that wasn't a stop
+  std::atomic<double> loopTempo_;
 
   // --- Metronome ---
-  float bpm_;
-  bool metronomeEnabled_;
-  double metronomePhase_;
-  double metronomeIncrement_;
+  // The click sounding, audio thread only
+  struct Click {
+    int pos = 0;
+    int length = 0;
+    bool downbeat = false;
+    float phase = 0.0f;
+  };
+  std::atomic<bool> metronomeEnabled_;
   float metronomeVolume_;
   std::vector<float> metronomeSamplesHigh_;
   std::vector<float> metronomeSamplesLow_;
   bool metronomeUseSampler_ = false;
+  Click click_;
+
+  // --- Segments ---
+  // Stands in for silence, never written to and never freed
+  Segment silence_;
+  SpscRing<Segment *> spares_;   // to the audio thread
+  SpscRing<Segment *> released_; // segments it swapped out of a buffer
+  std::vector<float> playScratch_; // one CHUNK per track
+
+  // --- Export ---
+  std::atomic<bool> exporting_{false};
+  std::atomic<long> exportOverruns_{0};
+  // Interleaved frames of the mix and every track
+  std::unique_ptr<SpscRing<float>> exportRing_;
+  std::vector<float> exportScratch_;
+  std::vector<std::unique_ptr<WaveWriter>> exportFiles_;
+  std::mutex exportMtx_; // the export files and the reading end of the ring
+
+  // Serializes the control calls, never taken by process()
+  std::mutex controlMtx_;
+  std::uint64_t generation_ = 0;
+
+  std::thread worker_;
+  std::mutex workerMtx_;
+  std::condition_variable workerCv_;
+  bool stopWorker_ = false;
 
-  std::mutex mtx_; // protect track modifications
-  int idx_ = 0;
   // --- Helpers ---
-  void updateMetronomeIncrement();
-  void updateLoopLength();
-  float generateMetronomeSample();
+  // These expect controlMtx_ to be held
+  void publish(Track &track, std::size_t length,
+               const std::vector<Segment *> *segments = nullptr);
+  void resizeTracks();
+  void restore(Track &track, Snapshot &snapshot);
+  std::vector<Segment *> fit(const Snapshot &snapshot, std::size_t length);
+  void reclaim(Track &track);
+  Snapshot capture(const Track &track);
+  void beginOverdub(int track);
+  bool stopRecording(int track);
+  void dropHistory(std::vector<Snapshot> &history);
+  void retain(Segment *segment);
+  void release(Segment *segment);
+  void housekeeping();
+
+  void workerLoop();
+  void drainExport(bool discard);
+
+  void adopt(Track &track);
+  void syncTrack(Track &track);
+  void processChunk(float *buffer, int frames, int recordTrack);
+  Segment *writable(TrackBuffer &buffer, std::size_t index);
+  void startClick(bool downbeat);
+  void renderClick(float *buffer, int from, int to);
 };
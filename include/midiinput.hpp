@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// MidiInput: live MIDI from the ALSA sequencer.
+//
+// open() creates a sequencer port other clients can connect to, connects it
+// to a source if one is given, and starts a thread that blocks on the
+// sequencer and hands every event to the handler, stamped with the time it
+// arrived. Hardware ports, snd-virmidi and snd-seq-dummy all look the same,
+// so `aconnect` or a virtual keyboard can drive it without any hardware.
+//
+// Only available when built with ALSA (BUILD_WITH_ALSA), otherwise open()
+// fails.
+// -----------------------------------------------------------------------------
+class MidiInput {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Event {
+    enum class Type { NoteOn, NoteOff, PitchBend, Control };
+    Type type;
+    int channel;
+    // Note and velocity, controller and value, or the bend in [-8192, 8191]
+    int data1;
+    int data2;
+    Clock::time_point time;
+  };
+
+  using Handler = std::function<void(const Event &)>;
+
+  explicit MidiInput(Handler handler);
+  ~MidiInput();
+
+  MidiInput(const MidiInput &) = delete;
+  MidiInput &operator=(const MidiInput &) = delete;
+
+  // 'source' is a "client:port" address or a client name, empty to wait
+  // for a connection from outside
+  bool open(const std::string &source);
+  void close();
+  bool isOpen() const { return running_; }
+
+  // Readable ports of the other clients, as "client:port name"
+  static std::vector<std::string> listSources();
+  static bool available();
+
+  // Appends the events of raw MIDI bytes to 'events'. Every message needs
+  // its status byte, messages other than the ones above are skipped.
+  static void parse(const unsigned char *bytes, std::size_t count,
+                    Clock::time_point time, std::vector<Event> &events);
+
+private:
+  Handler handler_;
+  void *seq_ = nullptr; // snd_seq_t
+  int port_ = -1;
+  std::atomic<bool> running_{false};
+  std::thread reader_;
+
+  void readLoop();
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include "ringbuffer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// NetworkSink: the synth's output for remote listeners.
+//
+// The audio thread writes every block it plays to a lock-free ring, after
+// fillBuffer() has interleaved it, and never waits. A thread of the sink's
+// own drains the ring, encodes it as 16 bit PCM and appends it to a history
+// of the last HISTORY_MS milliseconds. Listeners read from the history at
+// their own pace, on their own threads. One that falls further behind than
+// the history skips ahead, so a slow network only costs that listener
+// audio, never the synth or the other listeners.
+//
+// As with the analyzer, nothing is written to the ring while no one
+// listens, and the encoder thread only runs while someone does. The sink
+// waits for its listeners to leave before it is destroyed.
+// -----------------------------------------------------------------------------
+class NetworkSink {
+public:
+  static constexpr int HISTORY_MS = 2000;
+  static constexpr int ENCODE_MS = 10;
+
+  NetworkSink(int sampleRate, int channels);
+  ~NetworkSink();
+
+  NetworkSink(const NetworkSink &) = delete;
+  NetworkSink &operator=(const NetworkSink &) = delete;
+
+  int getSampleRate() const { return sampleRate_; }
+  int getChannels() const { return channels_; }
+  // Blocks the audio thread dropped because the encoder fell behind
+  std::uint64_t getDroppedBlocks() const { return dropped_; }
+
+  // --- Audio thread ---
+  void write(const float *interleaved, int frames);
+
+  // --- Listeners ---
+  // Starts listening, returns the position to read from: the audio from
+  // now on
+  std::uint64_t join();
+  void leave();
+  // Waits up to 'timeout' for audio after 'position' and puts it in 'out',
+  // as 16 bit little endian PCM, moving 'position' past it. False when the
+  // sink is shutting down.
+  bool read(std::uint64_t &position, std::vector<char> &out,
+            std::chrono::milliseconds timeout);
+
+  // A WAVE header for an endless stream of the sink's PCM
+  std::string waveHeader() const;
+
+private:
+  const int sampleRate_;
+  const int channels_;
+  SpscRing<float> ring_;
+  std::atomic<std::uint64_t> dropped_{0};
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread thread_;
+  bool running_ = false;
+  bool closing_ = false;
+  int listeners_ = 0;
+  std::atomic<bool> active_{false};
+  // The encoded audio, a ring of bytes, and how many bytes were ever
+  // appended to it
+  std::vector<char> history_;
+  std::uint64_t written_ = 0;
+
+  // Encoder thread
+  std::vector<float> incoming_;
+  std::vector<char> encoded_;
+
+  void run();
+};
@@ -24,6 +24,7 @@ public:
   int sampleRate = 0;
   int length = 0;
   float volume = 1.0;
+  float pan = 0.0f; // -1 (left) .. 1 (right)
 };
 
 #endif
@@ -0,0 +1,78 @@
+#pragma once
+#include "json.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// NoteCache: rendered note buffers on disk, for the OpenAL keyboard to start
+// without rendering its notes again.
+//
+// The notes of a keyboard are addressed by their content: a JSON description
+// of everything they are rendered from, the waveform or preset, ADSR,
+// effects, tuning and so on. Each description has a file of its own, named
+// by a hash of it:
+//
+//   "KSNC"   magic
+//   uint32   format version
+//   uint32   description length, then the description
+//   uint32   number of notes, then for every note
+//     uint32 format, the ALenum of the buffer
+//     uint32 sample rate
+//     uint64 offset of the samples from the start of the file
+//     uint64 length of the samples in bytes
+//   the samples of every note, each aligned to ALIGNMENT bytes
+//
+// All in the machine's byte order, the cache isn't meant to be moved. A file
+// is mapped into memory when it is loaded, and the samples are handed out
+// from the mapping as they are, without being read or copied. The
+// description is compared in full, so a hash collision is only a miss.
+//
+// The MAX_FILES most recently used files are kept, older ones are removed.
+// -----------------------------------------------------------------------------
+class NoteCache {
+public:
+  static constexpr std::size_t MAX_FILES = 16;
+  static constexpr std::size_t ALIGNMENT = 16;
+
+  struct Note {
+    std::uint32_t format;
+    std::uint32_t sampleRate;
+    const void *data;
+    std::size_t bytes;
+  };
+
+  // A cache file mapped into memory, its notes valid while it lives
+  class Mapping {
+  public:
+    ~Mapping();
+    Mapping(const Mapping &) = delete;
+    Mapping &operator=(const Mapping &) = delete;
+
+    const std::vector<Note> &getNotes() const { return notes_; }
+
+  private:
+    friend class NoteCache;
+    Mapping() = default;
+
+    void *address_ = nullptr;
+    std::size_t size_ = 0;
+    std::vector<Note> notes_;
+  };
+
+  explicit NoteCache(const std::filesystem::path &directory);
+
+  // The notes rendered from 'description', null when they aren't cached
+  std::unique_ptr<Mapping> load(const nlohmann::json &description);
+  // Stores the notes rendered from 'description'
+  bool save(const nlohmann::json &description, const std::vector<Note> &notes);
+
+private:
+  std::filesystem::path directory_;
+
+  std::filesystem::path fileFor(const std::string &description) const;
+  void evict();
+};
@@ -1,15 +1,18 @@
 #ifndef KEYBOARD_NOTES_HPP
 #define KEYBOARD_NOTES_HPP
 
+#include <array>
 #include <json.hpp>
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #pragma once
 namespace notes {
 
-enum class TuningSystem { EqualTemperament, WerckmeisterIII };
+// Scala is whatever scale was loaded with setScalaTuning()
+enum class TuningSystem { EqualTemperament, WerckmeisterIII, Scala };
 
 // --- JSON serialization for TuningSystem ---
 inline void to_json(nlohmann::json &j, const TuningSystem &t) {
@@ -20,6 +23,9 @@ inline void to_json(nlohmann::json &j, const TuningSystem &t) {
   case TuningSystem::WerckmeisterIII:
     j = "WerckmeisterIII";
     break;
+  case TuningSystem::Scala:
+    j = "Scala";
+    break;
   }
 }
 
@@ -29,6 +35,8 @@ inline void from_json(const nlohmann::json &j, TuningSystem &t) {
     t = TuningSystem::EqualTemperament;
   } else if (s == "WerckmeisterIII") {
     t = TuningSystem::WerckmeisterIII;
+  } else if (s == "Scala") {
+    t = TuningSystem::Scala;
   }
 }
 
@@ -39,15 +47,169 @@ inline std::string tuning_to_string(TuningSystem ts) {
     return "EqualTemperament";
   case TuningSystem::WerckmeisterIII:
     return "WerckmeisterIII";
+  case TuningSystem::Scala:
+    return "Scala";
   }
   return "Invalid TuningSystem";
 }
 
+// --- Pitch tables ---
+// Notes are numbered as in MIDI (C4 = 60, A4 = 69). The playable range is
+// C0 to C10, the tables are indexed directly by note number.
+constexpr int LOWEST_NOTE = 12;  // C0
+constexpr int HIGHEST_NOTE = 132; // C10
+constexpr int NOTE_TABLE_SIZE = HIGHEST_NOTE + 1;
+
+using FrequencyTable = std::array<double, NOTE_TABLE_SIZE>;
+
+namespace detail {
+constexpr FrequencyTable makeEqualTemperament() {
+  // 2^(1/12)
+  constexpr double semitone = 1.0594630943592952646;
+  FrequencyTable table{};
+  table[69] = 440.0;
+  for (int n = 70; n < NOTE_TABLE_SIZE; n++)
+    table[n] = table[n - 1] * semitone;
+  for (int n = 68; n >= 0; n--)
+    table[n] = table[n + 1] / semitone;
+  return table;
+}
+
+constexpr FrequencyTable makeWerckmeisterIII() {
+  // Fourth octave, C4 at 261.6 Hz and A4 at 442 Hz
+  constexpr double octave[12] = {261.60, 278.58, 294.80, 309.60,
+                                 328.00, 351.20, 371.80, 390.40,
+                                 415.80, 442.00, 464.36, 492.80};
+  FrequencyTable table{};
+  for (int n = 0; n < NOTE_TABLE_SIZE; n++) {
+    double f = octave[n % 12];
+    for (int o = n / 12; o < 5; o++)
+      f *= 0.5;
+    for (int o = 5; o < n / 12; o++)
+      f *= 2.0;
+    table[n] = f;
+  }
+  return table;
+}
+} // namespace detail
+
+inline constexpr FrequencyTable frequenciesEqual =
+    detail::makeEqualTemperament();
+inline constexpr FrequencyTable frequenciesWerckmeisterIII =
+    detail::makeWerckmeisterIII();
+// Filled in by setScalaTuning(), 0 for notes the scale leaves unmapped
+extern FrequencyTable frequenciesScala;
+
+constexpr const FrequencyTable &getFrequencyTable(TuningSystem ts) {
+  switch (ts) {
+  case TuningSystem::WerckmeisterIII:
+    return frequenciesWerckmeisterIII;
+  case TuningSystem::Scala:
+    return frequenciesScala;
+  case TuningSystem::EqualTemperament:
+    break;
+  }
+  return frequenciesEqual;
+}
+
+// Parses a note name such as "C4", "F#3" or "Bb9" into its note number,
+// -1 if the name is not a note in the playable range
+constexpr int getNoteIndex(std::string_view name) {
+  if (name.size() < 2)
+    return -1;
+
+  int semitone = 0;
+  switch (name[0]) {
+  case 'C':
+    semitone = 0;
+    break;
+  case 'D':
+    semitone = 2;
+    break;
+  case 'E':
+    semitone = 4;
+    break;
+  case 'F':
+    semitone = 5;
+    break;
+  case 'G':
+    semitone = 7;
+    break;
+  case 'A':
+    semitone = 9;
+    break;
+  case 'B':
+    semitone = 11;
+    break;
+  default:
+    return -1;
+  }
+
+  std::size_t pos = 1;
+  if (name[pos] == '#') {
+    // No E# or B#
+    if (semitone == 4 || semitone == 11)
+      return -1;
+    semitone++;
+    pos++;
+  } else if (name[pos] == 'b') {
+    // No Cb or Fb
+    if (semitone == 0 || semitone == 5)
+      return -1;
+    semitone--;
+    pos++;
+  }
+
+  if (pos == name.size() || name.size() - pos > 2)
+    return -1;
+  int octave = 0;
+  for (; pos < name.size(); pos++) {
+    if (name[pos] < '0' || name[pos] > '9')
+      return -1;
+    octave = octave * 10 + (name[pos] - '0');
+  }
+
+  int index = 12 * (octave + 1) + semitone;
+  if (index < LOWEST_NOTE || index > HIGHEST_NOTE)
+    return -1;
+  return index;
+}
+
+// Frequency of a note number, -1 outside the playable range
+constexpr double getFrequency(int index, TuningSystem ts) {
+  if (index < LOWEST_NOTE || index > HIGHEST_NOTE)
+    return -1;
+  return getFrequencyTable(ts)[index];
+}
+
+// Name of a note number, spelled with sharps. Note numbers outside the
+// playable range are clamped to it.
+const std::string &getNoteName(int index);
+
 double getFrequency(const std::string &note, TuningSystem ts);
+
+// A tuning as the oscillators use it. Ranks are rendered at equal
+// temperament and scaled per note by 'ratios', so changing the tuning of a
+// running synth is a matter of pointing it to another Tuning.
+struct Tuning {
+  TuningSystem system;
+  const FrequencyTable *frequencies;
+  std::array<float, NOTE_TABLE_SIZE> ratios;
+};
+
+const Tuning &getTuning(TuningSystem ts);
+// Installs the table behind TuningSystem::Scala. Not synchronized with
+// rendering, meant to be called at startup.
+void setScalaTuning(const FrequencyTable &frequencies,
+                    const std::string &description);
+bool hasScalaTuning();
+const std::string &getScalaDescription();
+
+// All note names, sharps and flats, in alphabetical order
 std::vector<std::string> getNotes(TuningSystem ts);
 int getNumberOfNotes(TuningSystem ts);
+int getClosestNoteIndex(float frequency, TuningSystem ts);
 std::string getClosestNote(float frequency, TuningSystem ts);
-std::map<std::string, double> &lookupFrequencies(notes::TuningSystem ts);
 } // namespace notes
 
 #endif
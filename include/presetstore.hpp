@@ -0,0 +1,82 @@
+#pragma once
+#include "json.hpp"
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// PresetStore: named synth configurations on disk, one file per preset.
+//
+// The names and dates of all presets are kept in memory, read once when the
+// store is opened, so listing them doesn't touch the disk. A preset is read
+// the first time it is loaded and kept after that.
+//
+// A preset file holds the record as JSON followed by binary blobs. Long
+// arrays of numbers, like FIR impulse responses, are stored as blobs of
+// float32 or int16 rather than as JSON text, and the JSON refers to them by
+// index:
+//
+//   "KSPR"   magic
+//   uint32   format version
+//   uint32   JSON length, then the JSON
+//   uint32   number of blobs, then for every blob
+//     uint8  type, 1 for float32 and 2 for int16
+//     uint32 number of values, then the values
+//
+// All little endian. A blob is referred to as {"$blob": index}.
+//
+// The store locks itself, and knows nothing of the synth: callers copy the
+// configuration under the KeyboardStream lock and do the disk I/O without it.
+// -----------------------------------------------------------------------------
+class PresetStore {
+public:
+  struct Entry {
+    std::string name;
+    std::string datetime;
+  };
+
+  // Opens the store in 'directory', creating it if needed. Presets in the
+  // single JSON file of earlier versions, if given and the store is new,
+  // are moved over.
+  explicit PresetStore(const std::filesystem::path &directory,
+                       const std::filesystem::path &legacyFile = {});
+
+  PresetStore(const PresetStore &) = delete;
+  PresetStore &operator=(const PresetStore &) = delete;
+
+  // Saves or replaces the preset 'name', false if it couldn't be written
+  bool save(const std::string &name, const std::string &datetime,
+            const nlohmann::json &configuration);
+  // The configuration of preset 'name'
+  std::optional<nlohmann::json> load(const std::string &name);
+  // Sorted by name
+  std::vector<Entry> list() const;
+
+  // Arrays of at least this many numbers are stored as blobs
+  static constexpr std::size_t MIN_BLOB_SIZE = 64;
+
+private:
+  struct Record {
+    Entry entry;
+    std::filesystem::path file;
+    // Loaded on first use
+    std::shared_ptr<const nlohmann::json> configuration;
+  };
+
+  const std::filesystem::path directory_;
+  mutable std::mutex mutex_;
+  std::map<std::string, Record> records_;
+
+  std::filesystem::path fileFor(const std::string &name) const;
+  void importLegacy(const std::filesystem::path &legacyFile);
+
+  static bool write(const std::filesystem::path &file,
+                    const nlohmann::json &record);
+  // The whole record, or with 'headerOnly' just its name and date
+  static std::optional<nlohmann::json> read(const std::filesystem::path &file,
+                                            bool headerOnly);
+};
@@ -0,0 +1,74 @@
+#ifndef KEYBOARD_RESAMPLER_HPP
+#define KEYBOARD_RESAMPLER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Resampler: polyphase windowed-sinc (Kaiser) sample rate converter.
+//
+// The conversion ratio is reduced to dstRate/srcRate = L/M and one filter
+// phase is precomputed per output position modulo L, so producing a sample
+// is a single dot product over contiguous memory. Filter banks are shared
+// between all resamplers with the same ratio.
+//
+// Used in two ways:
+//  - offline, through Resampler::convert(), when loading samples, impulse
+//    responses and metronome clicks recorded at another rate
+//  - streaming, through process(), which keeps its filter history between
+//    calls so it can run block by block
+// -----------------------------------------------------------------------------
+class Resampler {
+public:
+  Resampler(int srcRate, int dstRate);
+
+  // --- Streaming ---
+  // Consumes all of 'in' and appends the produced samples to 'out'
+  void process(const float *in, std::size_t len, std::vector<float> &out);
+  // Pushes the filter tail through, call once at end of stream
+  void flush(std::vector<float> &out);
+  void reset();
+
+  int getSrcRate() const { return srcRate_; }
+  int getDstRate() const { return dstRate_; }
+  // Filter delay, in input samples
+  int getLatency() const;
+
+  // --- Offline ---
+  static std::vector<float> convert(const std::vector<float> &in, int srcRate,
+                                    int dstRate);
+  // Interleaved 16 bit samples with any number of channels
+  static std::vector<short> convert(const std::vector<short> &in,
+                                    int channels, int srcRate, int dstRate);
+  // As above, but the result is kept in memory keyed by 'key' (typically the
+  // file name, whose modification time is part of the key), the channels and
+  // the rates, so that reloading the same asset does not convert it again
+  static std::vector<short> convertCached(const std::string &key,
+                                          const std::vector<short> &in,
+                                          int channels, int srcRate,
+                                          int dstRate);
+
+  struct FilterBank {
+    int up;        // L
+    int down;      // M
+    int phases;    // rows in 'coefficients'
+    int halfTaps;  // taps on each side of the center
+    int taps;      // row length, padded to a multiple of 8
+    std::vector<float> coefficients;
+  };
+
+private:
+  int srcRate_;
+  int dstRate_;
+  std::shared_ptr<const FilterBank> bank_;
+
+  std::vector<float> history_;
+  std::size_t base_ = 0; // index in history_ of the next output position
+  long long acc_ = 0;    // fractional position, numerator over 'up'
+
+  static std::shared_ptr<const FilterBank> getFilterBank(int up, int down);
+};
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Single producer, single consumer ring buffer.
+//
+// One thread pushes and one other thread pops, neither locks and nothing is
+// allocated after construction, so either side may be the audio thread. The
+// capacity is rounded up to a power of two.
+// -----------------------------------------------------------------------------
+template <typename T> class SpscRing {
+public:
+  explicit SpscRing(std::size_t capacity) {
+    std::size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    items_.resize(size);
+    mask_ = size - 1;
+  }
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  std::size_t capacity() const { return items_.size(); }
+
+  // Producer side
+  std::size_t writeAvailable() const {
+    return items_.size() - (head_.load(std::memory_order_relaxed) -
+                            tail_.load(std::memory_order_acquire));
+  }
+
+  bool push(const T &item) { return push(&item, 1) == 1; }
+
+  // Pushes as many of 'count' items as fit, returns how many
+  std::size_t push(const T *items, std::size_t count) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    const std::size_t tail = tail_.load(std::memory_order_acquire);
+    count = std::min(count, items_.size() - (head - tail));
+    for (std::size_t i = 0; i < count; i++)
+      items_[(head + i) & mask_] = items[i];
+    head_.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer side
+  std::size_t readAvailable() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_relaxed);
+  }
+
+  bool pop(T &item) { return pop(&item, 1) == 1; }
+
+  // Pops up to 'count' items, returns how many
+  std::size_t pop(T *items, std::size_t count) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    const std::size_t head = head_.load(std::memory_order_acquire);
+    count = std::min(count, head - tail);
+    for (std::size_t i = 0; i < count; i++)
+      items[i] = items_[(tail + i) & mask_];
+    tail_.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+private:
+  std::vector<T> items_;
+  std::size_t mask_ = 0;
+  // Free running, the difference is the fill level
+  alignas(64) std::atomic<std::size_t> head_{0};
+  alignas(64) std::atomic<std::size_t> tail_{0};
+};
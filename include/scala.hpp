@@ -0,0 +1,57 @@
+#ifndef KEYBOARD_SCALA_HPP
+#define KEYBOARD_SCALA_HPP
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "notes.hpp"
+
+// -----------------------------------------------------------------------------
+// Scala tuning files (https://www.huygens-fokker.org/scala/scl_format.html)
+//
+// A .scl file lists the pitches of one period of a scale, in cents or as
+// ratios. An optional .kbm file says which keys play which scale degree and
+// which key sounds at a reference frequency. Without one, key 60 plays the
+// first degree at 261.6256 Hz and every key is the next degree.
+// -----------------------------------------------------------------------------
+namespace scala {
+
+struct Scale {
+  std::string description;
+  // Degrees 1 .. N in cents, the last one is the period
+  std::vector<double> cents;
+
+  static std::optional<Scale> fromFile(const std::string &file,
+                                       std::string &error);
+};
+
+struct KeyboardMapping {
+  int firstNote = 0;
+  int lastNote = notes::HIGHEST_NOTE;
+  int middleNote = 60; // plays degree 0
+  int referenceNote = 60;
+  double referenceFrequency = 261.6255653;
+  // Degree reached after one run through 'mapping'
+  int octaveDegree = 0;
+  // Degree per key, repeating from middleNote, -1 for unmapped keys. An
+  // empty mapping plays one degree per key.
+  std::vector<int> mapping;
+
+  static std::optional<KeyboardMapping> fromFile(const std::string &file,
+                                                 std::string &error);
+};
+
+// Frequency of every note number, 0 for keys that are not mapped
+std::optional<notes::FrequencyTable>
+computeFrequencies(const Scale &scale, const KeyboardMapping &mapping,
+                   std::string &error);
+
+// Reads the scale (and the mapping, unless kbmFile is empty) and installs
+// it as notes::TuningSystem::Scala
+bool load(const std::string &sclFile, const std::string &kbmFile,
+          std::string &error);
+
+} // namespace scala
+
+#endif
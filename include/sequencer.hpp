@@ -0,0 +1,114 @@
+#pragma once
+#include "transport.hpp"
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Sequencer: step sequencer and arpeggiator playing in time with a Transport.
+//
+// beginBlock() runs on the audio thread right after the transport's, and
+// turns the steps starting in the block into note events at the frame they
+// fall on. KeyboardStream splits the block at those frames, so a note starts
+// on its exact sample whatever the block size. Nothing is allocated there.
+//
+// In steps mode a fixed pattern plays, one step every getStepLength() beats.
+// In arp mode the keys held down are taken over from the keyboard and played
+// one per step, in the order of the pattern. The settings are changed with
+// the KeyboardStream lock held, like the rest of the synth.
+// -----------------------------------------------------------------------------
+class Sequencer {
+public:
+  enum class Mode { Off, Steps, Arp };
+  enum class Pattern { Up, Down, UpDown, Random, Played };
+
+  static constexpr int MAX_STEPS = 64;
+  static constexpr int MAX_HELD = 16;
+  static constexpr int MAX_EVENTS = 32;
+
+  // A step of the pattern, a pitch of -1 is a rest
+  struct Step {
+    int pitch = -1;
+    int velocity = 100;
+  };
+
+  struct Event {
+    int offset; // frame within the block
+    int pitch;  // -1 on a note off releases every sequencer note
+    int velocity;
+    bool on;
+  };
+
+  Sequencer() = default;
+
+  // --- Settings ---
+  void setMode(Mode mode);
+  Mode getMode() const { return mode_; }
+  // At most MAX_STEPS are kept
+  void setSteps(const std::vector<Step> &steps);
+  const std::vector<Step> &getSteps() const { return steps_; }
+  // In beats, 0.25 plays sixteenths
+  void setStepLength(double beats);
+  double getStepLength() const { return stepLength_; }
+  // How much of a step a note sounds, (0, 1]
+  void setGate(double gate);
+  double getGate() const { return gate_; }
+  void setPattern(Pattern pattern);
+  Pattern getPattern() const { return pattern_; }
+  // Octaves the arpeggio spans, 1 to 4
+  void setOctaves(int octaves);
+  int getOctaves() const { return octaves_; }
+
+  // --- Arp input ---
+  // Keys played go to the arpeggiator rather than to a voice
+  bool capturesInput() const { return mode_ == Mode::Arp; }
+  void hold(int pitch, int velocity);
+  void release(int pitch);
+  int numHeld() const { return numHeld_; }
+
+  // --- Audio thread ---
+  void beginBlock(const Transport &transport);
+  // The events of the current block, in order
+  int numEvents() const { return numEvents_; }
+  const Event &event(int i) const { return events_[i]; }
+
+  static std::optional<Mode> modeFromString(const std::string &s);
+  static std::string modeToString(Mode mode);
+  static std::optional<Pattern> patternFromString(const std::string &s);
+  static std::string patternToString(Pattern pattern);
+
+private:
+  // A note sounding, released at 'beat'
+  struct PendingOff {
+    double beat;
+    int pitch;
+  };
+
+  Mode mode_ = Mode::Off;
+  std::vector<Step> steps_;
+  double stepLength_ = 0.25;
+  double gate_ = 0.5;
+  Pattern pattern_ = Pattern::Up;
+  int octaves_ = 1;
+
+  // Held keys in the order played
+  std::array<int, MAX_HELD> held_{};
+  std::array<int, MAX_HELD> heldVelocity_{};
+  int numHeld_ = 0;
+
+  // Audio thread, and reset by the settings above
+  bool flush_ = false;
+  bool resync_ = true;
+  long nextStep_ = 0;
+  long arpCounter_ = 0;
+  std::uint32_t random_ = 0x9e3779b9u;
+  std::array<PendingOff, MAX_EVENTS> pending_{};
+  int numPending_ = 0;
+  std::array<Event, MAX_EVENTS> events_{};
+  int numEvents_ = 0;
+
+  bool nextNote(int &pitch, int &velocity);
+  void push(const Event &event);
+};
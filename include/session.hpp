@@ -0,0 +1,109 @@
+#pragma once
+#include "keyboardstream.hpp"
+#include "waveread.hpp"
+#include "workerpool.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Session: one synth hosted by a SessionServer, a KeyboardStream with its own
+// voices, effects and looper, and the output it renders into.
+//
+// A session has no audio device. Its blocks are rendered by the server and
+// go to a WAV file, or nowhere. The CPU time spent rendering them is counted
+// per session.
+// -----------------------------------------------------------------------------
+class Session {
+public:
+  enum class Output { Null, Wave };
+
+  struct Stats {
+    std::uint64_t blocks;
+    // CPU time spent rendering, and its share of the audio rendered
+    double cpuSeconds;
+    double load;
+  };
+
+  Session(int id, Output output, const std::string &file);
+  ~Session();
+
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+  int getId() const { return id_; }
+  Output getOutput() const { return output_; }
+  const std::string &getFile() const { return file_; }
+  KeyboardStream &getStream() { return *stream_; }
+  Stats getStats() const;
+
+  static const char *outputStr(Output output);
+  static std::optional<Output> outputFromString(const std::string &name);
+
+  // --- Render threads ---
+  // Renders a block of 'frames' frames into the output
+  void renderBlock(int frames);
+
+private:
+  const int id_;
+  const Output output_;
+  const std::string file_;
+  std::unique_ptr<KeyboardStream> stream_;
+  WaveWriter wave_;
+  std::vector<float> buffer_;
+  int channels_;
+
+  std::atomic<std::uint64_t> blocks_{0};
+  std::atomic<std::uint64_t> frames_{0};
+  std::atomic<std::uint64_t> cpuNanos_{0};
+};
+
+// -----------------------------------------------------------------------------
+// SessionServer: many independent synths in one process, to host many users
+// on one machine.
+//
+// The sessions are created when the server is, each set up by the given
+// function as the single synth of main_stream would be. With no device to
+// pace them the server keeps time itself: every block period it renders a
+// block of every session, the sessions spread over one shared worker pool,
+// so that they use all cores without every session having threads of its
+// own. Blocks that come too late to keep up are counted, not made up for.
+// -----------------------------------------------------------------------------
+class SessionServer {
+public:
+  using Setup = std::function<void(KeyboardStream &)>;
+
+  // 'count' sessions, WAV output goes to 'directory'/session-<id>.wav.
+  // 'workers' threads render besides the server's own, -1 for one per core.
+  SessionServer(int count, Session::Output output,
+                const std::string &directory, int workers, Setup setup);
+  ~SessionServer();
+
+  SessionServer(const SessionServer &) = delete;
+  SessionServer &operator=(const SessionServer &) = delete;
+
+  void start();
+  void stop();
+
+  int getNumSessions() const { return static_cast<int>(sessions_.size()); }
+  // Null for an id that doesn't exist
+  Session *getSession(int id);
+  std::uint64_t getLateBlocks() const { return late_; }
+  int getNumWorkers() const { return pool_.getNumWorkers(); }
+
+private:
+  std::vector<std::unique_ptr<Session>> sessions_;
+  WorkerPool pool_;
+  int blockFrames_;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+  std::atomic<std::uint64_t> late_{0};
+
+  void run();
+  static void renderJob(void *context, int index);
+};
@@ -4,20 +4,14 @@
 #include "adsr.hpp"
 #include "effect.hpp"
 #include "note.hpp"
+#include <algorithm>
+#include <cmath>
 #include <json.hpp>
 #include <vector>
 
 namespace Sound {
 enum WaveForm { Sine, Triangular, Square, Saw, WhiteNoise, WaveFile };
 
-typedef struct LegatoConfig {
-  std::vector<float> targetFrequencies;
-  std::vector<float> currentFrequencies;
-  std::vector<float> deltas;
-  float targetFrequency;
-  float speedMs = 500;
-} LegatoConfig;
-
 float sinus(float f);
 float square(float f);
 float square(float f, float factor);
@@ -47,14 +41,19 @@ public:
   Rank(ADSR &adsr) { this->adsr = adsr; }
   void addPipe(Pipe &pipe) {
     this->pipes.push_back(pipe);
-    this->phases.resize(this->pipes.size(), 0);
+    float left, right;
+    panGains(pipe.first.pan, left, right);
+    this->panLeft.push_back(left);
+    this->panRight.push_back(right);
   }
   void addEffect(Effect<T> &effect) { this->effects.push_back(effect); }
 
   ADSR adsr;
   std::vector<Pipe> pipes;
   std::vector<Effect<T>> effects;
-  std::vector<float> phases;
+  // Per pipe channel gains, from Note::pan
+  std::vector<float> panLeft;
+  std::vector<float> panRight;
   enum Preset {
     SuperSaw,
     FatTriangle,
@@ -161,6 +160,34 @@ public:
 
   T generateRankSample();
   T generateRankSampleIndex(int index);
+  void generateRankFrame(T &left, T &right);
+  // Doesn't touch the generator position, so that several voices playing
+  // the same rank can render concurrently. 'ratio' scales the pitch, which
+  // is how the tuning is applied.
+  void generateRankFrameIndex(int index, T &left, T &right,
+                              float ratio = 1.0f);
+  // Same, for a voice whose pitch moves (see glide.hpp). The voice keeps
+  // one phase per pipe in 'phases', at most 'count' of them, and each
+  // advances by the pipe frequency times 'ratio'.
+  void generateRankFrameGlide(int index, float ratio, float *phases,
+                              std::size_t count, T &left, T &right);
+  // The pipe phases generateRankFrameIndex() is at for 'index' and 'ratio',
+  // for a voice that goes on with generateRankFrameGlide() from there
+  void glidePhases(int index, float ratio, float *phases, std::size_t count);
+
+  // Constant power pan law, normalized so that center is unity on both sides
+  static void panGains(float pan, float &left, float &right) {
+    float angle = (std::clamp(pan, -1.0f, 1.0f) + 1.0f) * 0.25f * M_PI;
+    left = std::cos(angle) * M_SQRT2;
+    right = std::sin(angle) * M_SQRT2;
+  }
+
+  // Pan position of pipe i out of n, spread evenly over [-width, width]
+  static float spreadPan(int i, int n, float width) {
+    if (n <= 1)
+      return 0.0f;
+    return width * (2.0f * i / (n - 1) - 1.0f);
+  }
 
   static Sound::Rank<T>::Preset fromString(const std::string &str_) {
     std::string str = str_;
@@ -289,6 +316,7 @@ public:
           frequency * powf(2.0f, detune_cents[i] * detune / 1200.0f);
       Note note(detuned_freq, length, sampleRate);
       note.volume = 1.0 / num_oscillators;
+      note.pan = spreadPan(i, num_oscillators, 0.8f);
       Pipe pipe(note, Sound::WaveForm::Saw);
       rank.addPipe(pipe);
     }
@@ -397,6 +425,7 @@ public:
           frequency * powf(2.0f, detune_cents[i] * detune / 1200.0f);
       Note note(detuned_freq, length, sampleRate);
       note.volume = 0.8f / num_oscillators;
+      note.pan = spreadPan(i, num_oscillators, 0.8f);
       Pipe pipe(note, Sound::WaveForm::Saw);
       rank.addPipe(pipe);
     }
@@ -444,6 +473,7 @@ public:
       float detunedFreq = frequency * powf(2.0f, detune_cents[i] / 1200.0f);
       Note note(detunedFreq, length, sampleRate);
       note.volume = 0.7f / numOscillators;
+      note.pan = spreadPan(i, numOscillators, 0.6f);
       Pipe pipe(note, (i % 2 == 0) ? Sound::WaveForm::Triangular
                                    : Sound::WaveForm::Sine);
       rank.addPipe(pipe);
@@ -716,56 +746,15 @@ public:
 
   template <typename Q> int sign(Q val) { return (Q(0) < val) - (val < Q(0)); }
 
-  bool setLegato(float frequency, float speedMs, int sampleRate) {
-    if (!preset.has_value()) {
-      return false;
-    }
-
-    Rank<T> r = fromPreset(*preset, frequency, 0, sampleRate);
-    std::vector<float> frequencies;
-    LegatoConfig lega;
-    lega.targetFrequency = frequency;
-    lega.speedMs = speedMs;
-
-    for (auto &p : r.pipes) {
-      Note n = p.first;
-      frequencies.push_back(n.frequency);
-    }
-
-    lega.targetFrequencies = frequencies;
-    lega.deltas.resize(lega.targetFrequencies.size(), 0);
-
-    if (legato_.has_value()) {
-      legato_->targetFrequencies = frequencies;
-      legato_->speedMs = speedMs;
-
-      if (legato_->currentFrequencies.size() == 0) {
-        legato_->currentFrequencies = frequencies;
-      }
-
-      legato_->deltas.resize(legato_->currentFrequencies.size(), 0);
-
-      for (int q = 0; q < legato_->currentFrequencies.size(); q++) {
-        float diff =
-            legato_->targetFrequencies[q] - legato_->currentFrequencies[q];
-        int sampleRate = Config::instance().getSampleRate();
-        float samplesToTarget = sampleRate * (legato_->speedMs * 0.001);
-        legato_->deltas[q] = diff / samplesToTarget;
-      }
-    } else {
-      lega.currentFrequencies = lega.targetFrequencies;
-      legato_ = lega;
-    }
-    return true;
-  }
-
-  void deactivateLegato() { legato_ = std::nullopt; }
-
   std::optional<Preset> preset;
 
 private:
-  std::optional<LegatoConfig> legato_;
   unsigned int generatorIndex_ = 0;
+
+  T generatePipeSample(std::size_t i, unsigned int index,
+                        float ratio = 1.0f);
+  // Envelope, effects and waveform of pipe 'i' at 'phase'
+  T shapePipeSample(std::size_t i, float t, float phase);
 };
 
 std::vector<short> generateWave(Rank<short> &rank);
@@ -773,6 +762,9 @@ std::vector<short> generateWave(Rank<short> &rank);
 template <typename T>
 T applyPostEffects(T sample, std::vector<Effect<T>> &effects);
 
+void applyPostEffectsStereo(float &left, float &right,
+                            std::vector<Effect<float>> &effects);
+
 } // namespace Sound
 
 #endif
@@ -0,0 +1,95 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// -----------------------------------------------------------------------------
+// Transport: the musical clock everything that plays in time follows.
+//
+// The position is a fractional beat, derived from the sample count since the
+// last tempo change rather than accumulated, so it doesn't drift at tempos
+// that aren't a whole number of samples per beat. Tempo changes take effect
+// at the next block boundary.
+//
+// The audio thread brackets every block with beginBlock() and endBlock(),
+// and within the block asks where beats fall instead of dividing per sample.
+// Every beat is reported in exactly one block, at the first sample at or
+// past it. The position and tempo can be read from any thread.
+// -----------------------------------------------------------------------------
+class Transport {
+public:
+  static constexpr double MAX_TEMPO = 999.0;
+
+  Transport(int sampleRate, double bpm, int beatsPerBar = 4);
+
+  Transport(const Transport &) = delete;
+  Transport &operator=(const Transport &) = delete;
+
+  // --- Tempo ---
+  // Clamped to [0, MAX_TEMPO], a tempo of 0 stops the clock
+  void setTempo(double bpm);
+  // The tempo asked for, which the audio thread may not have picked up yet
+  double getTempo() const;
+  double getSamplesPerBeat(double bpm) const;
+  int getSampleRate() const { return sampleRate_; }
+  int getBeatsPerBar() const { return beatsPerBar_; }
+
+  // --- Position, as of the start of the current block ---
+  double getBeat() const;
+  long getBar() const;
+  double getBeatInBar() const;
+  std::uint64_t getSampleTime() const;
+
+  // --- Audio thread ---
+  void beginBlock(int frames);
+  void endBlock();
+
+  // Within the current block
+  double blockBeat() const { return beat_; }
+  std::uint64_t blockSample() const { return sample_; }
+  double blockSamplesPerBeat() const { return samplesPerBeat_; }
+  int blockFrames() const { return frames_; }
+  double beatAt(int offset) const {
+    return beat_ + offset * beatsPerSample_;
+  }
+  // Frames from the start of the block to 'beat', can be past the block
+  double offsetOf(double beat) const {
+    return (beat - beat_) * samplesPerBeat_;
+  }
+
+  struct Beat {
+    int offset; // frame within the block
+    long index; // beats since the start
+    bool downbeat;
+  };
+  // The beats starting in the current block, in order
+  int numBeats() const { return numBeats_; }
+  const Beat &beat(int i) const { return beats_[i]; }
+
+private:
+  // More than a block can hold at MAX_TEMPO, any left over start the next
+  static constexpr int MAX_BEATS_PER_BLOCK = 16;
+
+  const int sampleRate_;
+  const int beatsPerBar_;
+  std::atomic<double> requestedTempo_;
+
+  // Audio thread only
+  double tempo_ = 0.0;
+  double beatsPerSample_ = 0.0;
+  double samplesPerBeat_ = 0.0;
+  // The beat and sample time of the last tempo change
+  double anchorBeat_ = 0.0;
+  std::uint64_t anchorSample_ = 0;
+  std::uint64_t sample_ = 0;
+  double beat_ = 0.0;
+  int frames_ = 0;
+  long nextBeat_ = 0;
+  long beatInBar_ = 0;
+  std::array<Beat, MAX_BEATS_PER_BLOCK> beats_{};
+  int numBeats_ = 0;
+
+  // Published for the other threads
+  std::atomic<double> publishedBeat_{0.0};
+  std::atomic<std::uint64_t> publishedSample_{0};
+};
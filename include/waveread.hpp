@@ -41,4 +41,26 @@ std::vector<short> convertToVector(const char *data, int numSamples);
 void splitChannels(const char *data, size_t dataSize, std::vector<short> &left,
                    std::vector<short> &right);
 
+/*
+ * Streams 16 bit PCM to a WAVE file. The sizes in the header are filled in
+ * by close(), so a file that isn't closed still holds the audio.
+ */
+class WaveWriter {
+public:
+  WaveWriter() {}
+  ~WaveWriter() { close(); }
+  WaveWriter(const WaveWriter &) = delete;
+  WaveWriter &operator=(const WaveWriter &) = delete;
+
+  bool open(const std::string &filename, int channels, int sampleRate);
+  bool isOpen() const { return file_ != nullptr; }
+  // Interleaved samples in [-1, 1], clipped
+  void write(const float *samples, size_t count);
+  void close();
+
+private:
+  FILE *file_ = nullptr;
+  uint32_t dataBytes_ = 0;
+};
+
 #endif
@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// WorkerPool: pre-spawned threads for splitting a block of work from the
+// audio callback.
+//
+// run() publishes a job of 'count' items and the calling thread works on it
+// together with the workers, every thread claiming the next unclaimed item
+// until none are left, and returns once every item is done. Nothing is
+// allocated per run. Idle workers spin for about as long as the gap between
+// two runs, so that from one block to the next they are ready without being
+// woken, and then park on a condition variable. run() only wakes as many
+// parked workers as the job has items for, and only takes the mutex to do
+// so.
+// -----------------------------------------------------------------------------
+class WorkerPool {
+public:
+  using Job = void (*)(void *context, int index);
+
+  // 'workers' threads besides the caller, 0 runs everything inline
+  explicit WorkerPool(int workers);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  // Calls job(context, i) for every i in [0, count), returns when all are done
+  void run(int count, Job job, void *context);
+
+  int getNumWorkers() const { return static_cast<int>(threads_.size()); }
+
+  // Workers to use when none are configured: one per core besides the caller
+  static int defaultWorkers();
+
+private:
+  void workerLoop();
+  bool claim(unsigned generation, int &index);
+  void drain(unsigned generation);
+
+  std::vector<std::thread> threads_;
+
+  std::mutex mtx_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+  // Workers parked on wake_
+  std::atomic<int> sleepers_{0};
+
+  // Current job: the generation in the high half, published by run(), and
+  // the next unclaimed item in the low half. An item is claimed only while
+  // its generation is current, so the parameters stay put until it is done.
+  std::atomic<std::uint64_t> state_{0};
+  unsigned generation_ = 0;
+  Job job_ = nullptr;
+  void *context_ = nullptr;
+  std::atomic<int> count_{0};
+  std::atomic<int> done_{0};
+
+  // How long idle workers spin, from the time between runs
+  std::atomic<std::int64_t> spinNanos_;
+  std::chrono::steady_clock::time_point lastRun_;
+};
@@ -5,15 +5,17 @@
 #include <cmath>
 #include <vector>
 
+#include "config.hpp"
+
 class YIN {
 public:
   /// Constructor
-  /// @param sampleRate - audio sample rate (Hz)
+  /// @param sampleRate - audio sample rate (Hz), Config's by default
   /// @param minFreq    - lowest detectable frequency (Hz)
   /// @param maxFreq    - highest detectable frequency (Hz)
   /// @param threshold  - threshold for CMND (typical ~0.1–0.2)
-  YIN(int sampleRate = 44100, float minFreq = 80.0f, float maxFreq = 8000.0f,
-      float threshold = 0.1f)
+  YIN(int sampleRate = Config::instance().getSampleRate(),
+      float minFreq = 80.0f, float maxFreq = 8000.0f, float threshold = 0.1f)
       : sampleRate(sampleRate), minFreq(minFreq), maxFreq(maxFreq),
         threshold(threshold) {
 
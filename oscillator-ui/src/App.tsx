@@ -3,6 +3,7 @@ import OscillatorControl from "./OscillatorControl";
 import CombinedWaveformDisplay from "./CombinedWaveformDisplay";
 import ConfigPanel from "./ConfigPanel";
 import Keyboard from "./Keyboard";
+import LiveScope from "./LiveScope";
 import Presets from "./Presets";
 import Recorder from "./Recorder";
 import type { Oscillator } from "./types";
@@ -104,6 +105,7 @@ function App() {
               </td>
               <td>
                 <h1>Oscillators</h1>
+                <LiveScope width={640} height={160} />
                 <CombinedWaveformDisplay width={640} height={200} />
                 <div className="oscillator-grid">
                   {oscillators.map((osc, i) => (
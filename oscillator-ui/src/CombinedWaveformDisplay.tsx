@@ -28,12 +28,17 @@ function CombinedWaveformDisplay({
   const [error, setError] = useState<string | null>(null);
 
   useEffect(() => {
+    // Revalidated by ETag, redrawn only when an oscillator changed
+    let etag: string | null = null;
     const fetchWaveform = async () => {
       try {
         const response = await fetch(`/api/waveform/combined?samples=512`);
         if (!response.ok) {
           throw new Error(`HTTP error! status: ${response.status}`);
         }
+        const tag = response.headers.get("ETag");
+        if (tag && tag === etag) return;
+        etag = tag;
         const data = await response.json();
         setWaveformData(data.waveform || []);
         setOscillators(data.oscillators || []);
@@ -37,7 +37,26 @@ const keyToNoteMap: Record<string, string> = {
   m: "B2",
 };
 
+// Notes go over the /ws/input websocket, one JSON line each, and fall back
+// to a POST per note while it isn't connected
+let socket: WebSocket | null = null;
+
+const openSocket = () => {
+  const scheme = window.location.protocol === "https:" ? "wss" : "ws";
+  socket = new WebSocket(`${scheme}://${window.location.host}/ws/input`);
+  return socket;
+};
+
+const send = (message: object) => {
+  if (socket && socket.readyState === WebSocket.OPEN) {
+    socket.send(JSON.stringify(message));
+    return true;
+  }
+  return false;
+};
+
 const pushNote = async (note: string) => {
+  if (send({ on: note })) return;
   await fetch("/api/input/push", {
     method: "POST",
     headers: { "Content-Type": "application/json" },
@@ -46,6 +65,7 @@ const pushNote = async (note: string) => {
 };
 
 const releaseNote = async (note: string) => {
+  if (send({ off: note })) return;
   await fetch("/api/input/release", {
     method: "POST",
     headers: { "Content-Type": "application/json" },
@@ -55,9 +75,12 @@ const releaseNote = async (note: string) => {
 
 const Keyboard = () => {
   useEffect(() => {
+    const ws = openSocket();
+
     const handleKeyDown = (e: KeyboardEvent) => {
       const note = keyToNoteMap[e.key];
-      if (note) pushNote(note);
+      // Held keys repeat, the note is already playing
+      if (note && !e.repeat) pushNote(note);
     };
 
     const handleKeyUp = (e: KeyboardEvent) => {
@@ -70,6 +93,8 @@ const Keyboard = () => {
     return () => {
       window.removeEventListener("keydown", handleKeyDown);
       window.removeEventListener("keyup", handleKeyUp);
+      ws.close();
+      if (socket === ws) socket = null;
     };
   }, []);
 
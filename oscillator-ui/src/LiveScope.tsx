@@ -0,0 +1,113 @@
+import { useEffect, useRef } from "react";
+import "./LiveScope.css";
+
+interface LiveScopeProps {
+  width?: number;
+  height?: number;
+}
+
+// Frames pushed by the server over /ws/scope, see Analyzer in the synth
+const HEADER_SIZE = 16;
+const SCOPE = 1;
+const SPECTRUM = 2;
+const FLOOR_DB = -100;
+
+const clear = (ctx: CanvasRenderingContext2D, width: number, height: number) => {
+  ctx.fillStyle = "#0a0a15";
+  ctx.fillRect(0, 0, width, height);
+  ctx.strokeStyle = "#16213e";
+  ctx.lineWidth = 2;
+  ctx.beginPath();
+  ctx.moveTo(0, height / 2);
+  ctx.lineTo(width, height / 2);
+  ctx.stroke();
+};
+
+const drawScope = (
+  ctx: CanvasRenderingContext2D,
+  width: number,
+  height: number,
+  samples: Float32Array,
+) => {
+  clear(ctx, width, height);
+  ctx.strokeStyle = "#ff6b6b";
+  ctx.lineWidth = 2;
+  ctx.beginPath();
+  samples.forEach((sample, i) => {
+    const x = (i / samples.length) * width;
+    const y = height / 2 - sample * (height / 2) * 0.95;
+    if (i === 0) ctx.moveTo(x, y);
+    else ctx.lineTo(x, y);
+  });
+  ctx.stroke();
+};
+
+// Levels in dB against a logarithmic frequency axis, 20 Hz and up
+const drawSpectrum = (
+  ctx: CanvasRenderingContext2D,
+  width: number,
+  height: number,
+  levels: Float32Array,
+  hzPerBin: number,
+) => {
+  ctx.fillStyle = "#0a0a15";
+  ctx.fillRect(0, 0, width, height);
+  const low = Math.log10(20);
+  const high = Math.log10(hzPerBin * (levels.length - 1));
+  ctx.strokeStyle = "#00d9ff";
+  ctx.lineWidth = 1.5;
+  ctx.beginPath();
+  let started = false;
+  for (let k = 1; k < levels.length; k++) {
+    const hz = k * hzPerBin;
+    if (hz < 20) continue;
+    const x = ((Math.log10(hz) - low) / (high - low)) * width;
+    const level = Math.max(levels[k], FLOOR_DB);
+    const y = (level / FLOOR_DB) * height;
+    if (!started) ctx.moveTo(x, y);
+    else ctx.lineTo(x, y);
+    started = true;
+  }
+  ctx.stroke();
+};
+
+function LiveScope({ width = 640, height = 160 }: LiveScopeProps) {
+  const scopeRef = useRef<HTMLCanvasElement>(null);
+  const spectrumRef = useRef<HTMLCanvasElement>(null);
+
+  useEffect(() => {
+    const scheme = window.location.protocol === "https:" ? "wss" : "ws";
+    const socket = new WebSocket(
+      `${scheme}://${window.location.host}/ws/scope`,
+    );
+    socket.binaryType = "arraybuffer";
+
+    socket.onmessage = (event: MessageEvent<ArrayBuffer>) => {
+      const view = new DataView(event.data);
+      const kind = view.getUint8(0);
+      const count = view.getUint32(4, true);
+      const step = view.getFloat32(12, true);
+      const values = new Float32Array(event.data, HEADER_SIZE, count);
+
+      const canvas =
+        kind === SCOPE ? scopeRef.current : spectrumRef.current;
+      const ctx = canvas?.getContext("2d");
+      if (!ctx) return;
+      if (kind === SCOPE) drawScope(ctx, width, height, values);
+      else if (kind === SPECTRUM)
+        drawSpectrum(ctx, width, height, values, step);
+    };
+
+    return () => socket.close();
+  }, [width, height]);
+
+  return (
+    <div className="live-scope-container">
+      <h2>Output</h2>
+      <canvas ref={scopeRef} width={width} height={height} />
+      <canvas ref={spectrumRef} width={width} height={height} />
+    </div>
+  );
+}
+
+export default LiveScope;
@@ -20,19 +20,26 @@ function WaveformDisplay({
   const [error, setError] = useState<string | null>(null);
 
   useEffect(() => {
+    // The server revalidates the preview by its ETag, it is only sent and
+    // redrawn when the oscillator changed
+    let etag: string | null = null;
     const fetchWaveform = async () => {
       try {
         const response = await fetch(
-          `/api/waveform?id=${oscillatorId}&samples=512`
+          `/api/waveform?id=${oscillatorId}&samples=512&format=f32`
         );
         if (!response.ok) {
           throw new Error(`HTTP error! status: ${response.status}`);
         }
-        const data = await response.json();
-        setWaveformData(data.waveform || []);
-        setFrequency(data.frequency || 440);
-        setOctave(data.octave || 0);
-        setDetune(data.detune || 0);
+        const tag = response.headers.get("ETag");
+        if (tag && tag === etag) return;
+        etag = tag;
+        const info = JSON.parse(response.headers.get("X-Waveform-Info") || "{}");
+        const samples = new Float32Array(await response.arrayBuffer());
+        setWaveformData(Array.from(samples));
+        setFrequency(info.frequency || 440);
+        setOctave(info.octave || 0);
+        setDetune(info.detune || 0);
         setError(null);
       } catch (err) {
         console.error("Failed to fetch waveform:", err);
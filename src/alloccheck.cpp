@@ -0,0 +1,111 @@
+#include "alloccheck.hpp"
+
+#ifdef KEYBOARD_ALLOC_CHECK
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define ALLOC_CHECK_BACKTRACE 1
+#endif
+
+namespace {
+// Reports printed before going quiet, the count keeps going
+constexpr long MAX_REPORTS = 16;
+
+thread_local bool onAudioThread = false;
+thread_local bool reporting = false;
+std::atomic<long> violations{0};
+
+bool abortOnViolation() {
+  static const bool abort = [] {
+    const char *mode = std::getenv("KEYBOARD_ALLOC_CHECK");
+    return mode != nullptr && std::strcmp(mode, "abort") == 0;
+  }();
+  return abort;
+}
+
+void check(std::size_t size) {
+  if (!onAudioThread || reporting)
+    return;
+  // Anything allocated while reporting is not the audio code's doing
+  reporting = true;
+
+  long count = violations.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (count <= MAX_REPORTS || abortOnViolation()) {
+    std::fprintf(stderr,
+                 "alloccheck: allocation of %zu bytes on the audio thread\n",
+                 size);
+#ifdef ALLOC_CHECK_BACKTRACE
+    void *frames[64];
+    int depth = backtrace(frames, 64);
+    backtrace_symbols_fd(frames, depth, 2);
+#endif
+    if (abortOnViolation())
+      std::abort();
+    if (count == MAX_REPORTS)
+      std::fprintf(stderr, "alloccheck: not reporting any further\n");
+  }
+
+  reporting = false;
+}
+
+void *allocate(std::size_t size) {
+  check(size);
+  if (size == 0)
+    size = 1;
+  while (true) {
+    if (void *p = std::malloc(size))
+      return p;
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+} // namespace
+
+namespace alloccheck {
+AudioThreadScope::AudioThreadScope() : previous_(onAudioThread) {
+  onAudioThread = true;
+}
+
+AudioThreadScope::~AudioThreadScope() { onAudioThread = previous_; }
+
+long getViolations() { return violations.load(std::memory_order_relaxed); }
+} // namespace alloccheck
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+#endif
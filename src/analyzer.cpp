@@ -0,0 +1,152 @@
+#include "analyzer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace {
+constexpr int HEADER_SIZE = 16;
+
+Analyzer::Message makeMessage(Analyzer::Kind kind, std::uint32_t count,
+                              std::uint32_t sampleRate, float step) {
+  Analyzer::Message message(HEADER_SIZE + count * sizeof(float), 0);
+  message[0] = kind;
+  std::memcpy(&message[4], &count, sizeof(count));
+  std::memcpy(&message[8], &sampleRate, sizeof(sampleRate));
+  std::memcpy(&message[12], &step, sizeof(step));
+  return message;
+}
+} // namespace
+
+Analyzer::Analyzer(int sampleRate)
+    : sampleRate_(sampleRate),
+      // Room for a second of audio, more than the slowest rate drains
+      ring_(static_cast<std::size_t>(std::max(sampleRate, 2 * FFT_SIZE))),
+      history_(2 * FFT_SIZE, 0.0f), window_(FFT_SIZE), fft_(FFT_SIZE) {
+  incoming_.resize(ring_.capacity());
+  // Hann, scaled so a full scale sine reads 0 dB
+  double sum = 0.0;
+  for (int i = 0; i < FFT_SIZE; i++) {
+    window_[i] = static_cast<float>(
+        0.5 - 0.5 * std::cos(2.0 * M_PI * i / (FFT_SIZE - 1)));
+    sum += window_[i];
+  }
+  for (float &w : window_)
+    w = static_cast<float>(w * 2.0 / sum);
+
+  scope_ = makeMessage(Scope, SCOPE_POINTS, sampleRate,
+                       static_cast<float>(FFT_SIZE / SCOPE_POINTS));
+  spectrum_ = makeMessage(Spectrum, FFT_SIZE / 2 + 1, sampleRate,
+                         static_cast<float>(sampleRate) / FFT_SIZE);
+}
+
+Analyzer::~Analyzer() { stop(); }
+
+void Analyzer::start(double rate, Sink sink) {
+  stop();
+  rate_ = std::clamp(rate, 1.0, MAX_RATE);
+  sink_ = std::move(sink);
+  running_ = true;
+  thread_ = std::thread(&Analyzer::run, this);
+}
+
+void Analyzer::stop() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    running_ = false;
+  }
+  wake_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+// --- Audio thread ---
+void Analyzer::write(const float *left, const float *right, int frames) {
+  if (!active_.load(std::memory_order_relaxed))
+    return;
+  float chunk[WRITE_CHUNK];
+  for (int done = 0; done < frames;) {
+    const int n = std::min(frames - done, WRITE_CHUNK);
+    for (int i = 0; i < n; i++)
+      chunk[i] =
+          right ? 0.5f * (left[done + i] + right[done + i]) : left[done + i];
+    // Dropped when the analysis falls behind, the display skips ahead
+    if (ring_.push(chunk, n) < static_cast<std::size_t>(n))
+      return;
+    done += n;
+  }
+}
+
+// --- Analysis thread ---
+void Analyzer::run() {
+  const auto period = std::chrono::duration<double>(1.0 / rate_);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    wake_.wait_for(lock, period, [this] { return !running_; });
+    if (!running_)
+      break;
+    lock.unlock();
+    drain();
+    if (active_)
+      analyze();
+    lock.lock();
+  }
+}
+
+// Moves what the audio thread wrote since last time to the end of history_
+void Analyzer::drain() {
+  const std::size_t n = ring_.pop(incoming_.data(), incoming_.size());
+  const std::size_t size = history_.size();
+  if (n >= size) {
+    std::copy(incoming_.begin() + (n - size), incoming_.begin() + n,
+              history_.begin());
+    return;
+  }
+  std::copy(history_.begin() + n, history_.end(), history_.begin());
+  std::copy(incoming_.begin(), incoming_.begin() + n,
+            history_.end() - static_cast<std::ptrdiff_t>(n));
+}
+
+void Analyzer::analyze() {
+  // Scope: FFT_SIZE samples from the latest rising zero crossing that leaves
+  // room for them, so that a steady tone stands still
+  int start = FFT_SIZE;
+  for (int i = FFT_SIZE; i > 0; i--) {
+    if (history_[i - 1] < 0.0f && history_[i] >= 0.0f) {
+      start = i;
+      break;
+    }
+  }
+  // Every point is the peak of the samples it covers
+  constexpr int perPoint = FFT_SIZE / SCOPE_POINTS;
+  float points[SCOPE_POINTS];
+  for (int p = 0; p < SCOPE_POINTS; p++) {
+    float peak = 0.0f;
+    for (int i = 0; i < perPoint; i++) {
+      const float sample = history_[start + p * perPoint + i];
+      if (std::fabs(sample) > std::fabs(peak))
+        peak = sample;
+    }
+    points[p] = peak;
+  }
+  std::memcpy(&scope_[HEADER_SIZE], points, sizeof(points));
+
+  // Spectrum of the latest FFT_SIZE samples
+  double *input = fft_.input();
+  const float *latest = history_.data() + FFT_SIZE;
+  for (int i = 0; i < FFT_SIZE; i++)
+    input[i] = latest[i] * window_[i];
+  fft_.execute();
+  float levels[FFT_SIZE / 2 + 1];
+  for (int k = 0; k <= FFT_SIZE / 2; k++) {
+    const double magnitude = std::abs(fft_.bin(k));
+    levels[k] = magnitude > 0.0
+                    ? std::max(static_cast<float>(20.0 * std::log10(magnitude)),
+                               FLOOR_DB)
+                    : FLOOR_DB;
+  }
+  std::memcpy(&spectrum_[HEADER_SIZE], levels, sizeof(levels));
+
+  sink_(scope_);
+  sink_(spectrum_);
+}
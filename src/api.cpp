@@ -1,6 +1,11 @@
 #include "api.hpp"
 #include "keyboardstream.hpp"
+#include "presetstore.hpp"
+#include "session.hpp"
 #include "term.hpp"
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
 #include <json.hpp>
 
 using json = nlohmann::json;
@@ -31,16 +36,22 @@ static void send_json(struct mg_connection *conn, const json &data,
             status, body.size(), body.c_str());
 }
 
+// Presets live in synths/presets, the presets of the single JSON file used
+// before are moved there the first time
+static PresetStore &preset_store() {
+  static PresetStore store("synths/presets", "synths/keyboard_presets.json");
+  return store;
+}
+
+// The audio lock is only held to copy the configuration out or to apply
+// it, the preset files are read and written without it
 int presets_api_handler(struct mg_connection *conn, void *cbdata) {
   const struct mg_request_info *req = mg_get_request_info(conn);
   KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
-  const std::filesystem::path presetPath = "synths/keyboard_presets.json";
-  kbs->lock();
 
   /* Only POST is allowed ---------------------------------------------------*/
   if (std::string{req->request_method} != "POST") {
     mg_printf(conn, "HTTP/1.1 405 Method Not Allowed\r\n\r\n");
-    kbs->unlock();
     return 405;
   }
 
@@ -48,7 +59,6 @@ int presets_api_handler(struct mg_connection *conn, void *cbdata) {
   char buf[2048];
   int n = mg_read(conn, buf, sizeof(buf) - 1);
   buf[n] = '\0';
-  bool updated = false;
 
   json body;
   try {
@@ -56,17 +66,16 @@ int presets_api_handler(struct mg_connection *conn, void *cbdata) {
   } catch (...) {
     mg_printf(conn,
               "HTTP/1.1 400 Bad Request\r\n\r\n{\"error\":\"Invalid JSON\"}");
-    kbs->unlock();
     return 400;
   }
   if (!body.contains("method") || !body["method"].is_string()) {
     mg_printf(conn,
               "HTTP/1.1 400 Bad Request\r\n\r\n{\"error\":\"'method' field "
               "required\"}");
-    kbs->unlock();
     return 400;
   }
   const std::string method = body["method"];
+  PresetStore &store = preset_store();
 
   if (method == "save") {
     /* Validate
@@ -75,52 +84,28 @@ int presets_api_handler(struct mg_connection *conn, void *cbdata) {
       mg_printf(conn,
                 "HTTP/1.1 400 Bad Request\r\n\r\n{\"error\":\"'name' field "
                 "required\"}");
-      kbs->unlock();
       return 400;
     }
     const std::string presetName = body["name"];
-    /* Compose the preset record ---------------------------------------------*/
-    json preset = {{"name", presetName},
-                   {"datetime", utc_iso8601()},
-                   {"configuration", kbs->toJson()}};
-    /* File paths
-     * -------------------------------------------------------------*/
-    std::filesystem::create_directories(
-        presetPath.parent_path()); // make sure ./synths exists
-
-    /* Load / create wrapper object { "presets": [] }
-     * -------------------------*/
-    json fileObj;
-    if (std::ifstream in{presetPath}; in.good()) {
-      try {
-        in >> fileObj;
-      } catch (...) { /* corrupted file – start fresh */
-      }
-    }
-    if (!fileObj.contains("presets") || !fileObj["presets"].is_array())
-      fileObj["presets"] = json::array();
 
-    /* Update or insert
-     * -------------------------------------------------------*/
-    for (auto &p : fileObj["presets"]) {
-      if (p.contains("name") && p["name"] == presetName) {
-        p = preset; // overwrite whole record
-        updated = true;
-        break;
-      }
-    }
-    if (!updated)
-      fileObj["presets"].push_back(preset);
-
-    /* Write back atomically
-     * --------------------------------------------------*/
-    {
-      const auto tmp = presetPath.string() + ".tmp";
-      std::ofstream out{tmp, std::ios::trunc};
-      out << fileObj.dump(2);
-      out.close();
-      std::filesystem::rename(tmp, presetPath); // replace original
+    kbs->lock();
+    json configuration = kbs->toJson();
+    kbs->unlock();
+
+    bool updated = false;
+    for (const PresetStore::Entry &entry : store.list())
+      updated = updated || entry.name == presetName;
+    if (!store.save(presetName, utc_iso8601(), configuration)) {
+      mg_printf(conn,
+                "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
+                "{\"status\":\"failed\",\"message\":\"Unable to save\"}");
+      return 200;
     }
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
+              "{\"status\":\"ok\",\"updated\":%s}",
+              updated ? "true" : "false");
+    return 200;
   } else if (method == "load") {
     /* Validate
      * ---------------------------------------------------------------*/
@@ -128,104 +113,55 @@ int presets_api_handler(struct mg_connection *conn, void *cbdata) {
       mg_printf(conn,
                 "HTTP/1.1 400 Bad Request\r\n\r\n{\"error\":\"'preset' field "
                 "required in request body\"}");
-      kbs->unlock();
       return 400;
     }
     const std::string presetName = body["preset"];
-    /* Compose the preset record ---------------------------------------------*/
-    json preset = {{"name", presetName},
-                   {"datetime", utc_iso8601()},
-                   {"configuration", kbs->toJson()}};
-    /* Load / create wrapper object { "presets": [] }
-     * -------------------------*/
-    json fileObj;
-    if (std::ifstream in{presetPath}; in.good()) {
-      try {
-        in >> fileObj;
-      } catch (...) {
-        mg_printf(
-            conn,
-            "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
-            "{\"status\":\"failed\",\"message\":\"invalid presets file\"}");
-        kbs->unlock();
-        return 200;
-      }
-    }
-    if (!fileObj.contains("presets") || !fileObj["presets"].is_array())
-      fileObj["presets"] = json::array();
-
-    /* Update or insert
-     * -------------------------------------------------------*/
-    for (auto &p : fileObj["presets"]) {
-      if (p.contains("name") && p["name"] == presetName &&
-          p.contains("configuration")) {
-        if (!kbs->loadJson(p["configuration"])) {
-          mg_printf(conn,
-                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
-                    "{\"status\":\"ok\",\"message\":\"Preset loaded\"}");
-          kbs->unlock();
-          return 200;
-        } else {
-          mg_printf(conn,
-                    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
-                    "{\"status\":\"failed\",\"message\":\"Invalid preset\"}");
-          kbs->unlock();
-          return 200;
-        }
-      }
+
+    std::optional<json> configuration = store.load(presetName);
+    if (!configuration) {
+      mg_printf(conn,
+                "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
+                "{\"status\":\"failed\",\"message\":\"Preset not found\"}");
+      return 200;
     }
 
-    mg_printf(conn, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
-                    "{\"status\":\"failed\",\"message\":\"Preset not found\"}");
+    kbs->lock();
+    const bool loaded = !kbs->loadJson(*configuration);
+    if (loaded)
+      kbs->publishConfig();
     kbs->unlock();
-    return 200;
-  } else if (method == "list") {
+    // Answered once the oscillators are built and playing
+    if (loaded)
+      kbs->waitForSwaps();
 
-    /* Load / create wrapper object { "presets": [] }
-     * -------------------------*/
-    json fileObj;
-    if (std::ifstream in{presetPath}; in.good()) {
-      try {
-        in >> fileObj;
-      } catch (...) {
-        mg_printf(
-            conn,
-            "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
-            "{\"status\":\"failed\",\"message\":\"invalid presets file\"}");
-        kbs->unlock();
-        return 200;
-      }
+    if (loaded) {
+      mg_printf(conn,
+                "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
+                "{\"status\":\"ok\",\"message\":\"Preset loaded\"}");
+    } else {
+      mg_printf(conn,
+                "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
+                "{\"status\":\"failed\",\"message\":\"Invalid preset\"}");
     }
-    if (!fileObj.contains("presets") || !fileObj["presets"].is_array())
-      fileObj["presets"] = json::array();
-
-    /* Update or insert
-     * -------------------------------------------------------*/
+    return 200;
+  } else if (method == "list") {
+    json names = json::array();
+    for (const PresetStore::Entry &entry : store.list())
+      names.push_back({{"name", entry.name}, {"datetime", entry.datetime}});
     json response;
-    std::vector<json> names;
-    for (auto &p : fileObj["presets"]) {
-      if (p.contains("name")) {
-        json entry;
-        entry["name"] = p["name"];
-        names.push_back(entry);
-      }
-    }
     response["status"] = "ok";
     response["presets"] = names;
     mg_printf(conn,
               "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
               "%s",
               response.dump().c_str());
-    kbs->unlock();
     return 200;
   }
-  /* Done -------------------------------------------------------------------*/
+
   mg_printf(conn,
-            "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n"
-            "{\"status\":\"ok\",\"updated\":%s}",
-            updated ? "true" : "false");
-  kbs->unlock();
-  return 200;
+            "HTTP/1.1 400 Bad Request\r\n\r\n{\"error\":\"Unknown "
+            "method\"}");
+  return 400;
 }
 
 int input_push_handler(struct mg_connection *conn, void *cbdata) {
@@ -243,8 +179,16 @@ int input_push_handler(struct mg_connection *conn, void *cbdata) {
       return 400;
     }
 
+    // Optional MIDI style velocity [1, 127]
+    int velocity = 127;
+    if (body.contains("velocity") && body["velocity"].is_number_integer()) {
+      velocity = std::clamp(body["velocity"].get<int>(), 1, 127);
+    }
+
     std::string note = body["key"];
-    kbs->registerNote(note);
+    kbs->lock();
+    kbs->registerNote(note, velocity);
+    kbs->unlock();
 
     mg_printf(conn, "HTTP/1.1 200 OK\r\n\r\n");
     return 200;
@@ -271,7 +215,9 @@ int input_release_handler(struct mg_connection *conn, void *cbdata) {
     }
 
     std::string note = body["key"];
+    kbs->lock();
     kbs->registerNoteRelease(note);
+    kbs->unlock();
 
     mg_printf(conn, "HTTP/1.1 200 OK\r\n\r\n");
     return 200;
@@ -282,86 +228,182 @@ int input_release_handler(struct mg_connection *conn, void *cbdata) {
   }
 }
 
+// --- Input websocket ---
+// /ws/input plays notes without a request per key. A binary frame holds raw
+// MIDI messages (note on/off, control change, pitch bend), a text frame
+// holds JSON lines:
+//   {"on": "C4", "velocity": 100}   or "on": 60
+//   {"off": "C4"}
+//   {"cc": 64, "value": 127}
+//   {"bend": 4096}                  in [-8192, 8191]
+// Every message is stamped with the time its frame arrived and applied like
+// live MIDI, a frame at a time under the lock.
+
+// Note number of a JSON line's "on" or "off", -1 when it isn't a note
+static int ws_note(const json &value) {
+  if (value.is_number_integer())
+    return value.get<int>();
+  if (value.is_string())
+    return notes::getNoteIndex(value.get<std::string>());
+  return -1;
+}
+
+static void ws_parse_line(const std::string &line,
+                          MidiInput::Clock::time_point time,
+                          std::vector<MidiInput::Event> &events) {
+  json body = json::parse(line, nullptr, false);
+  if (!body.is_object())
+    return;
+
+  MidiInput::Event event{};
+  event.time = time;
+  if (body.contains("on")) {
+    event.type = MidiInput::Event::Type::NoteOn;
+    event.data1 = ws_note(body["on"]);
+    event.data2 = 127;
+    if (body.contains("velocity") && body["velocity"].is_number_integer())
+      event.data2 = std::clamp(body["velocity"].get<int>(), 1, 127);
+  } else if (body.contains("off")) {
+    event.type = MidiInput::Event::Type::NoteOff;
+    event.data1 = ws_note(body["off"]);
+  } else if (body.contains("cc") && body["cc"].is_number_integer()) {
+    event.type = MidiInput::Event::Type::Control;
+    event.data1 = body["cc"].get<int>();
+    event.data2 = 0;
+    if (body.contains("value") && body["value"].is_number_integer())
+      event.data2 = std::clamp(body["value"].get<int>(), 0, 127);
+  } else if (body.contains("bend") && body["bend"].is_number()) {
+    event.type = MidiInput::Event::Type::PitchBend;
+    event.data1 = std::clamp(body["bend"].get<int>(), -8192, 8191);
+  } else {
+    return;
+  }
+  events.push_back(event);
+}
+
+int input_ws_connect_handler(const struct mg_connection *, void *) {
+  return 0; // accept
+}
+
+int input_ws_data_handler(struct mg_connection *conn, int bits, char *data,
+                          size_t len, void *cbdata) {
+  KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
+  const int opcode = bits & 0x0f;
+  if (opcode == MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE)
+    return 0;
+
+  const auto now = MidiInput::Clock::now();
+  std::vector<MidiInput::Event> events;
+  if (opcode == MG_WEBSOCKET_OPCODE_BINARY) {
+    MidiInput::parse(reinterpret_cast<const unsigned char *>(data), len, now,
+                     events);
+  } else if (opcode == MG_WEBSOCKET_OPCODE_TEXT) {
+    std::size_t start = 0;
+    while (start < len) {
+      const void *end = std::memchr(data + start, '\n', len - start);
+      const std::size_t stop =
+          end ? static_cast<const char *>(end) - data : len;
+      if (stop > start)
+        ws_parse_line(std::string(data + start, stop - start), now, events);
+      start = stop + 1;
+    }
+  }
+
+  if (!events.empty()) {
+    term::refresh_if_needed();
+    kbs->lock();
+    for (const MidiInput::Event &event : events)
+      kbs->applyMidiEvent(event);
+    kbs->unlock();
+  }
+  return 1; // keep the connection open
+}
+
+// --- Scope websocket ---
+// /ws/scope streams the analyzer's scope and spectrum frames (see
+// Analyzer) to every client connected. The analyzer only runs while there
+// are any, and never takes the audio lock. Frames are written outside the
+// lock on the clients, and a client that closes waits for the writes in
+// progress, since its connection is gone once it has closed.
+static std::mutex scope_clients_mutex;
+static std::condition_variable scope_writes_done;
+static std::vector<struct mg_connection *> scope_clients;
+static int scope_writes = 0;
+
+int scope_ws_connect_handler(const struct mg_connection *, void *) {
+  return 0; // accept
+}
+
+void scope_ws_ready_handler(struct mg_connection *conn, void *cbdata) {
+  KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
+  std::lock_guard<std::mutex> guard(scope_clients_mutex);
+  scope_clients.push_back(conn);
+  kbs->getAnalyzer().setActive(true);
+}
+
+int scope_ws_data_handler(struct mg_connection *, int bits, char *, size_t,
+                          void *) {
+  // Nothing is read from the clients
+  return (bits & 0x0f) != MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE;
+}
+
+void scope_ws_close_handler(const struct mg_connection *conn, void *cbdata) {
+  KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
+  std::unique_lock<std::mutex> lock(scope_clients_mutex);
+  scope_clients.erase(
+      std::remove(scope_clients.begin(), scope_clients.end(), conn),
+      scope_clients.end());
+  if (scope_clients.empty())
+    kbs->getAnalyzer().setActive(false);
+  scope_writes_done.wait(lock, [] { return scope_writes == 0; });
+}
+
+void scope_ws_broadcast(const std::vector<unsigned char> &message) {
+  std::vector<struct mg_connection *> clients;
+  {
+    std::lock_guard<std::mutex> guard(scope_clients_mutex);
+    clients = scope_clients;
+    scope_writes++;
+  }
+  for (struct mg_connection *conn : clients) {
+    mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_BINARY,
+                       reinterpret_cast<const char *>(message.data()),
+                       message.size());
+  }
+  {
+    std::lock_guard<std::mutex> guard(scope_clients_mutex);
+    scope_writes--;
+  }
+  scope_writes_done.notify_all();
+}
+
 int config_api_handler(struct mg_connection *conn, void *cbdata) {
   const struct mg_request_info *req_info = mg_get_request_info(conn);
   KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
-  kbs->lock();
 
   if (std::string(req_info->request_method) == "GET") {
-    // Send current config
-    std::optional<std::reference_wrapper<EchoEffect<float>>> echoConf =
-        std::nullopt;
-    std::optional<std::reference_wrapper<Effect<float>::VibratoConfig>>
-        vibConf = std::nullopt;
-    std::optional<std::reference_wrapper<Effect<float>::TremoloConfig>>
-        tremConf = std::nullopt;
-    std::optional<std::reference_wrapper<Piper<float>>> reverbMixConf =
-        std::nullopt;
-    std::optional<
-        std::reference_wrapper<Effect<float>::PhaseDistortionSinConfig>>
-        phaseDistSinConf = std::nullopt;
-    std::optional<std::reference_wrapper<Effect<float>::GainDistHardClipConfig>>
-        gainDistConf = std::nullopt;
-    for (int e = 0; e < kbs->effects.size(); e++) {
-      if (auto echo = std::get_if<EchoEffect<float>>(&kbs->effects[e].config)) {
-        echoConf = std::ref(*echo);
-      }
-      if (auto echo = std::get_if<Effect<float>::VibratoConfig>(
-              &kbs->effects[e].config)) {
-        vibConf = std::ref(*echo);
-      }
-      if (auto echo = std::get_if<Effect<float>::TremoloConfig>(
-              &kbs->effects[e].config)) {
-        tremConf = std::ref(*echo);
-      }
-      if (auto reverbMix = std::get_if<Piper<float>>(&kbs->effects[e].config)) {
-        reverbMixConf = std::ref(*reverbMix);
-      }
-      if (auto phaseDist = std::get_if<Effect<float>::PhaseDistortionSinConfig>(
-              &kbs->effects[e].config)) {
-        phaseDistSinConf = std::ref(*phaseDist);
-      }
-      if (auto gainDist = std::get_if<Effect<float>::GainDistHardClipConfig>(
-              &kbs->effects[e].config)) {
-        gainDistConf = std::ref(*gainDist);
-      }
-    }
-    json response;
-    if (echoConf && vibConf && tremConf && reverbMixConf && phaseDistSinConf &&
-        gainDistConf) {
-      response = {{"gain", kbs->gain},
-                  {"adsr",
-                   {{"attack", kbs->adsr.qadsr[0]},
-                    {"decay", kbs->adsr.qadsr[1]},
-                    {"sustain", kbs->adsr.qadsr[2]},
-                    {"release", kbs->adsr.qadsr[3]}}},
-                  {"tuning", notes::tuning_to_string(kbs->tuning)},
-                  {"echo",
-                   {{"rate", echoConf->get().getRate()},
-                    {"feedback", echoConf->get().getFeedback()},
-                    {"mix", echoConf->get().getMix()},
-                    {"sampleRate", echoConf->get().getSampleRate()}}},
-                  {"phaseDist", {{"depth", phaseDistSinConf->get().depth}}},
-                  {"gainDist", {{"gain", gainDistConf->get().gain}}},
-                  {"tremolo",
-                   {{"depth", tremConf->get().depth},
-                    {"frequency", tremConf->get().frequency}}},
-                  {"reverb",
-                   {{"dry", reverbMixConf->get().mix[1]},
-                    {"wet", reverbMixConf->get().mix[0]}}},
-                  {"vibrato",
-                   {{"depth", vibConf->get().depth},
-                    {"frequency", vibConf->get().frequency}}},
-                  {"highpass", kbs->effects[0].iirs[0].presentable},
-                  {"lowpass", kbs->effects[0].iirs[1].presentable}};
+    // Read from the published snapshot, without the lock
+    auto snapshot = kbs->getConfigSnapshot();
+    // From the content rather than the version, which starts over with
+    // every process and session
+    char hash[32];
+    std::snprintf(hash, sizeof(hash), "%016zx",
+                  std::hash<std::string>{}(snapshot->body));
+    const std::string etag = "\"" + std::string(hash) + "\"";
+    const char *match = mg_get_header(conn, "If-None-Match");
+    if (match && etag == match) {
+      mg_printf(conn,
+                "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n"
+                "Cache-Control: no-cache\r\n\r\n",
+                etag.c_str());
+      return 304;
     }
-
-    std::string body = response.dump();
     mg_printf(conn,
               "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
-              "Content-Length: %zu\r\n\r\n%s",
-              body.size(), body.c_str());
-    kbs->unlock();
+              "ETag: %s\r\nCache-Control: no-cache\r\n"
+              "Content-Length: %zu\r\n\r\n",
+              etag.c_str(), snapshot->body.size());
+    mg_write(conn, snapshot->body.data(), snapshot->body.size());
     return 200;
 
   } else if (std::string(req_info->request_method) == "POST") {
@@ -369,6 +411,7 @@ int config_api_handler(struct mg_connection *conn, void *cbdata) {
     int len = mg_read(conn, buffer, sizeof(buffer) - 1);
     buffer[len] = '\0';
 
+    kbs->lock();
     try {
       json body = json::parse(buffer);
 
@@ -376,6 +419,15 @@ int config_api_handler(struct mg_connection *conn, void *cbdata) {
         kbs->gain = body["gain"];
       }
 
+      // Retuning alone doesn't rebuild the oscillators
+      const bool tuningOnly = body.size() == 1 && body.contains("tuning");
+      if (body.contains("tuning") && body["tuning"].is_string()) {
+        notes::TuningSystem tuning = kbs->tuning;
+        notes::from_json(body["tuning"], tuning);
+        if (tuning != notes::TuningSystem::Scala || notes::hasScalaTuning())
+          kbs->setTuning(tuning);
+      }
+
       std::optional<std::reference_wrapper<EchoEffect<float>>> echoConf =
           std::nullopt;
       std::optional<std::reference_wrapper<Effect<float>::VibratoConfig>>
@@ -483,13 +535,13 @@ int config_api_handler(struct mg_connection *conn, void *cbdata) {
 
       if (body.contains("highpass") && body["highpass"].is_number()) {
         float cutoff = body["highpass"];
-        IIR<float> hp = IIRFilters::highPass<float>(SAMPLERATE, cutoff);
+        IIR<float> hp = IIRFilters::highPass<float>(kbs->sampleRate, cutoff);
         kbs->effects[0].iirs[0] = hp;
       }
 
       if (body.contains("lowpass") && body["lowpass"].is_number()) {
         float cutoff = body["lowpass"];
-        IIR<float> lp = IIRFilters::lowPass<float>(SAMPLERATE, cutoff);
+        IIR<float> lp = IIRFilters::lowPass<float>(kbs->sampleRate, cutoff);
         kbs->effects[0].iirs[1] = lp;
       }
 
@@ -506,7 +558,9 @@ int config_api_handler(struct mg_connection *conn, void *cbdata) {
         printf("Nope, no reverb\n");
       }
 
-      kbs->copyEffectsToSynths();
+      if (!tuningOnly)
+        kbs->copyEffectsToSynths();
+      kbs->publishConfig();
 
       mg_printf(conn, "HTTP/1.1 200 OK\r\n\r\n");
       kbs->unlock();
@@ -520,10 +574,125 @@ int config_api_handler(struct mg_connection *conn, void *cbdata) {
   }
 
   mg_printf(conn, "HTTP/1.1 405 Method Not Allowed\r\n\r\n");
-  kbs->unlock();
   return 405;
 }
 
+// --- Waveform previews ---
+// A preview only depends on the settings of the oscillators it is drawn
+// from, so it is computed once for them and kept, keyed by those settings
+// (oscillators have no effects of their own yet). A hash of the key is the
+// ETag: a client that has the preview gets a 304 and nothing is computed.
+// The cache is emptied when an oscillator is changed.
+//
+// Previews are JSON by default. With format=f32 or format=i16 the samples
+// come as a little endian array of that type instead, and the rest of the
+// JSON in an X-Waveform-Info header. i16 samples are scaled to the peak,
+// given as "scale" in the info.
+struct WaveformPreview {
+  std::vector<float> samples;
+  json info; // all but the samples
+  std::string jsonBody;
+};
+
+static std::mutex waveform_cache_mutex;
+static std::unordered_map<std::string, std::shared_ptr<const WaveformPreview>>
+    waveform_cache;
+static constexpr std::size_t WAVEFORM_CACHE_SIZE = 256;
+
+static void waveform_cache_clear() {
+  std::lock_guard<std::mutex> guard(waveform_cache_mutex);
+  waveform_cache.clear();
+}
+
+// The preview for 'key', computed by 'compute' when it isn't cached
+static std::shared_ptr<const WaveformPreview> waveform_preview(
+    const std::string &key,
+    const std::function<void(std::vector<float> &, json &)> &compute) {
+  {
+    std::lock_guard<std::mutex> guard(waveform_cache_mutex);
+    auto it = waveform_cache.find(key);
+    if (it != waveform_cache.end())
+      return it->second;
+  }
+
+  auto preview = std::make_shared<WaveformPreview>();
+  compute(preview->samples, preview->info);
+  json body = preview->info;
+  body["waveform"] = preview->samples;
+  preview->jsonBody = body.dump();
+
+  std::lock_guard<std::mutex> guard(waveform_cache_mutex);
+  if (waveform_cache.size() >= WAVEFORM_CACHE_SIZE)
+    waveform_cache.clear();
+  waveform_cache.emplace(key, preview);
+  return preview;
+}
+
+// Sends the preview for 'key', or a 304 before anything is computed when
+// the client has it
+static void send_waveform(
+    struct mg_connection *conn, const char *query, const std::string &key,
+    const std::function<void(std::vector<float> &, json &)> &compute) {
+  char format[8] = {0};
+  if (query)
+    mg_get_var(query, strlen(query), "format", format, sizeof(format));
+  const std::string type = format;
+  const bool f32 = type == "f32";
+  const bool i16 = type == "i16";
+  char hash[32];
+  std::snprintf(hash, sizeof(hash), "%016zx", std::hash<std::string>{}(key));
+  const std::string etag = "\"" + std::string(hash) +
+                           (f32 ? "-f32" : i16 ? "-i16" : "") + "\"";
+
+  const char *match = mg_get_header(conn, "If-None-Match");
+  if (match && etag == match) {
+    mg_printf(conn,
+              "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n"
+              "Cache-Control: no-cache\r\n\r\n",
+              etag.c_str());
+    return;
+  }
+
+  const std::shared_ptr<const WaveformPreview> cached =
+      waveform_preview(key, compute);
+  const WaveformPreview &preview = *cached;
+
+  if (!f32 && !i16) {
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+              "ETag: %s\r\nCache-Control: no-cache\r\n"
+              "Content-Length: %zu\r\n\r\n",
+              etag.c_str(), preview.jsonBody.size());
+    mg_write(conn, preview.jsonBody.data(), preview.jsonBody.size());
+    return;
+  }
+
+  json info = preview.info;
+  std::vector<std::int16_t> shorts;
+  const void *data = preview.samples.data();
+  std::size_t size = preview.samples.size() * sizeof(float);
+  if (i16) {
+    float peak = 0.0f;
+    for (float sample : preview.samples)
+      peak = std::max(peak, std::fabs(sample));
+    const float scale = peak > 0.0f ? 32767.0f / peak : 0.0f;
+    shorts.reserve(preview.samples.size());
+    for (float sample : preview.samples)
+      shorts.push_back(static_cast<std::int16_t>(std::lround(sample * scale)));
+    info["scale"] = peak;
+    data = shorts.data();
+    size = shorts.size() * sizeof(std::int16_t);
+  }
+
+  const std::string infoHeader = info.dump();
+  mg_printf(conn,
+            "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+            "ETag: %s\r\nCache-Control: no-cache\r\n"
+            "X-Waveform-Info: %s\r\nContent-Length: %zu\r\n\r\n",
+            etag.c_str(), infoHeader.c_str(), size);
+  mg_write(conn, data, size);
+}
+
 // API handler for /api/oscillators
 int oscillator_api_handler(struct mg_connection *conn, void *cbdata) {
   const struct mg_request_info *req_info = mg_get_request_info(conn);
@@ -568,18 +737,41 @@ int oscillator_api_handler(struct mg_connection *conn, void *cbdata) {
         return 404;
       }
 
-      if (body.contains("volume"))
-        kbs->synth[id].volume = body["volume"];
-      if (body.contains("sound")) {
-        kbs->synth[id].sound = Sound::Rank<float>::fromString(body["sound"]);
-        kbs->synth[id].initialize();
+      if (body.contains("volume")) {
+        const float volume = body["volume"];
+        kbs->editSynth(
+            [id, volume](std::vector<KeyboardStream::Oscillator> &bank) {
+              if (id < static_cast<int>(bank.size()))
+                bank[id].volume = volume;
+            });
       }
-      if (body.contains("octave"))
-        kbs->synth[id].octave = body["octave"];
-      if (body.contains("detune"))
-        kbs->synth[id].detune = body["detune"];
-
-      kbs->synth[id].updateFrequencies();
+      // Anything that changes the ranks is built off the lock and
+      // crossfaded to (see KeyboardStream::swapSynth())
+      if (body.contains("sound") || body.contains("octave") ||
+          body.contains("detune")) {
+        std::optional<Sound::Rank<float>::Preset> sound;
+        std::optional<int> octave, detune;
+        if (body.contains("sound"))
+          sound = Sound::Rank<float>::fromString(body["sound"]);
+        if (body.contains("octave"))
+          octave = body["octave"].get<int>();
+        if (body.contains("detune"))
+          detune = body["detune"].get<int>();
+        kbs->swapSynth(
+            [id, sound, octave, detune](
+                std::vector<KeyboardStream::Oscillator> &bank) {
+              if (id >= static_cast<int>(bank.size()))
+                return;
+              if (sound)
+                bank[id].sound = *sound;
+              if (octave)
+                bank[id].octave = *octave;
+              if (detune)
+                bank[id].detune = *detune;
+              bank[id].updateFrequencies();
+            });
+      }
+      waveform_cache_clear();
 
       mg_printf(conn, "HTTP/1.1 200 OK\r\n\r\n");
       kbs->unlock();
@@ -600,7 +792,8 @@ int oscillator_api_handler(struct mg_connection *conn, void *cbdata) {
 // --- Recorder API Handler ---
 // Supports:
 //   GET  -> return current looper state
-//   POST -> modify recorder (record, stop, set, clear)
+//   POST -> modify recorder (record, stop, set, clear, undo, redo, export,
+//           export-stop)
 int recorder_handler(struct mg_connection *conn, void *cbdata) {
   KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
   if (!kbs) {
@@ -621,8 +814,12 @@ int recorder_handler(struct mg_connection *conn, void *cbdata) {
     json resp;
     resp["track"] = looper.getActiveTrack();
     resp["bpm"] = looper.getBPM();
+    resp["bars"] = looper.getNumBars();
     resp["metronome"] = looper.isMetronomeEnabled() ? "on" : "off";
     resp["recording"] = looper.isRecording();
+    resp["undo"] = looper.getUndoDepth(looper.getActiveTrack());
+    resp["redo"] = looper.getRedoDepth(looper.getActiveTrack());
+    resp["exporting"] = looper.isExporting();
     send_json(conn, resp);
     return 200;
   }
@@ -672,6 +869,13 @@ int recorder_handler(struct mg_connection *conn, void *cbdata) {
 
       int track = body["track"];
       float bpm = body["bpm"];
+      // 0 stops the transport
+      if (bpm != 0.0f &&
+          !(bpm >= Looper::MIN_BPM && bpm <= Transport::MAX_TEMPO)) {
+        mg_printf(conn,
+                  "HTTP/1.1 400 Bad Request\r\n\r\n'bpm' out of range");
+        return 400;
+      }
 
       looper.setActiveTrack(track);
       looper.setBPM(bpm);
@@ -696,6 +900,51 @@ int recorder_handler(struct mg_connection *conn, void *cbdata) {
       send_json(conn, {{"status", "ok"}, {"message", "Track cleared"}});
       return 200;
 
+    } else if (action == "undo" || action == "redo") {
+      if (!body.contains("track") || !body["track"].is_number_integer()) {
+        mg_printf(conn,
+                  "HTTP/1.1 400 Bad Request\r\n\r\nMissing or invalid 'track'");
+        return 400;
+      }
+      int track = body["track"];
+      bool done = action == "undo" ? looper.undo(track) : looper.redo(track);
+      if (!done) {
+        send_json(conn,
+                  {{"status", "error"}, {"message", "Nothing to " + action}},
+                  409);
+        return 409;
+      }
+      send_json(conn, {{"status", "ok"},
+                       {"message", action == "undo" ? "Undone" : "Redone"}});
+      return 200;
+
+    } else if (action == "export") {
+      // A plain name, the files go to recordings/<name>-*.wav
+      std::string name = body.value("name", "");
+      bool valid = !name.empty() && name.size() <= 64;
+      for (char c : name)
+        valid = valid && (std::isalnum(static_cast<unsigned char>(c)) ||
+                          c == '-' || c == '_');
+      if (!valid) {
+        mg_printf(conn,
+                  "HTTP/1.1 400 Bad Request\r\n\r\nMissing or invalid 'name'");
+        return 400;
+      }
+      std::filesystem::create_directories("recordings");
+      if (!looper.startExport("recordings/" + name)) {
+        send_json(conn,
+                  {{"status", "error"}, {"message", "Unable to start export"}},
+                  409);
+        return 409;
+      }
+      send_json(conn, {{"status", "ok"}, {"message", "Export started"}});
+      return 200;
+
+    } else if (action == "export-stop") {
+      looper.stopExport();
+      send_json(conn, {{"status", "ok"}, {"message", "Export stopped"}});
+      return 200;
+
     } else {
       mg_printf(conn, "HTTP/1.1 400 Bad Request\r\n\r\nUnknown action");
       return 400;
@@ -711,9 +960,164 @@ int recorder_handler(struct mg_connection *conn, void *cbdata) {
   }
 }
 
+// --- Sequencer API Handler ---
+// Supports:
+//   GET  -> return the sequencer settings
+//   POST -> change any of mode (off, steps, arp), steps, stepLength (in
+//           beats), gate, pattern (up, down, updown, random, played) and
+//           octaves. A step is a note name, an object with "note" and
+//           "velocity", or null for a rest.
+int sequencer_handler(struct mg_connection *conn, void *cbdata) {
+  KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
+  if (!kbs) {
+    mg_printf(
+        conn,
+        "HTTP/1.1 500 Internal Server Error\r\n\r\nMissing KeyboardStream");
+    return 500;
+  }
+
+  Sequencer &sequencer = kbs->getSequencer();
+
+  const struct mg_request_info *req_info = mg_get_request_info(conn);
+
+  if (strcmp(req_info->request_method, "GET") == 0) {
+    json resp;
+    kbs->lock();
+    json steps = json::array();
+    for (const Sequencer::Step &step : sequencer.getSteps()) {
+      if (step.pitch < 0)
+        steps.push_back(nullptr);
+      else
+        steps.push_back({{"note", notes::getNoteName(step.pitch)},
+                         {"velocity", step.velocity}});
+    }
+    resp["mode"] = Sequencer::modeToString(sequencer.getMode());
+    resp["steps"] = steps;
+    resp["stepLength"] = sequencer.getStepLength();
+    resp["gate"] = sequencer.getGate();
+    resp["pattern"] = Sequencer::patternToString(sequencer.getPattern());
+    resp["octaves"] = sequencer.getOctaves();
+    resp["held"] = sequencer.numHeld();
+    kbs->unlock();
+    resp["bpm"] = kbs->getTransport().getTempo();
+    resp["beat"] = kbs->getTransport().getBeat();
+    send_json(conn, resp);
+    return 200;
+  }
+
+  if (strcmp(req_info->request_method, "POST") != 0) {
+    mg_printf(conn, "HTTP/1.1 405 Method Not Allowed\r\n\r\n");
+    return 405;
+  }
+
+  char buffer[4096];
+  int len = mg_read(conn, buffer, sizeof(buffer) - 1);
+  if (len <= 0) {
+    mg_printf(conn, "HTTP/1.1 400 Bad Request\r\n\r\nEmpty body");
+    return 400;
+  }
+  buffer[len] = '\0';
+
+  try {
+    json body = json::parse(buffer);
+
+    // Everything is checked before anything changes
+    std::optional<Sequencer::Mode> mode;
+    if (body.contains("mode")) {
+      if (body["mode"].is_string())
+        mode = Sequencer::modeFromString(body["mode"]);
+      if (!mode) {
+        mg_printf(conn, "HTTP/1.1 400 Bad Request\r\n\r\nInvalid 'mode'");
+        return 400;
+      }
+    }
+
+    std::optional<Sequencer::Pattern> pattern;
+    if (body.contains("pattern")) {
+      if (body["pattern"].is_string())
+        pattern = Sequencer::patternFromString(body["pattern"]);
+      if (!pattern) {
+        mg_printf(conn,
+                  "HTTP/1.1 400 Bad Request\r\n\r\nInvalid 'pattern'");
+        return 400;
+      }
+    }
+
+    std::optional<std::vector<Sequencer::Step>> steps;
+    if (body.contains("steps")) {
+      const json &list = body["steps"];
+      bool valid = list.is_array() && list.size() <= Sequencer::MAX_STEPS;
+      steps.emplace();
+      for (std::size_t i = 0; valid && i < list.size(); i++) {
+        const json &entry = list[i];
+        Sequencer::Step step;
+        std::string note;
+        if (entry.is_string()) {
+          note = entry;
+        } else if (entry.is_object() && entry.contains("note") &&
+                   entry["note"].is_string()) {
+          note = entry["note"];
+          if (entry.contains("velocity")) {
+            valid = entry["velocity"].is_number_integer();
+            if (valid)
+              step.velocity = std::clamp(entry["velocity"].get<int>(), 1, 127);
+          }
+        } else if (!entry.is_null()) {
+          valid = false;
+        }
+        if (!note.empty() && note != "-") {
+          step.pitch = notes::getNoteIndex(note);
+          valid = valid && step.pitch >= 0;
+        }
+        steps->push_back(step);
+      }
+      if (!valid) {
+        mg_printf(conn, "HTTP/1.1 400 Bad Request\r\n\r\nInvalid 'steps'");
+        return 400;
+      }
+    }
+
+    for (const char *key : {"stepLength", "gate"}) {
+      if (body.contains(key) &&
+          (!body[key].is_number() || !(body[key].get<double>() > 0.0))) {
+        mg_printf(conn, "HTTP/1.1 400 Bad Request\r\n\r\nInvalid '%s'",
+                  key);
+        return 400;
+      }
+    }
+    if (body.contains("octaves") && !body["octaves"].is_number_integer()) {
+      mg_printf(conn, "HTTP/1.1 400 Bad Request\r\n\r\nInvalid 'octaves'");
+      return 400;
+    }
+
+    kbs->lock();
+    if (steps)
+      sequencer.setSteps(*steps);
+    if (body.contains("stepLength"))
+      sequencer.setStepLength(body["stepLength"].get<double>());
+    if (body.contains("gate"))
+      sequencer.setGate(body["gate"].get<double>());
+    if (pattern)
+      sequencer.setPattern(*pattern);
+    if (body.contains("octaves"))
+      sequencer.setOctaves(body["octaves"].get<int>());
+    if (mode)
+      sequencer.setMode(*mode);
+    kbs->unlock();
+
+    send_json(conn, {{"status", "ok"}, {"message", "Sequencer updated"}});
+    return 200;
+
+  } catch (const std::exception &e) {
+    mg_printf(conn, "HTTP/1.1 400 Bad Request\r\n\r\nInvalid JSON: %s",
+              e.what());
+    return 400;
+  }
+}
+
 // --- Waveform API Handler ---
-// GET /api/waveform?id=0&samples=512
-// Returns a single cycle of the oscillator waveform as JSON array
+// GET /api/waveform?id=0&samples=512[&format=f32|i16]
+// Returns a single cycle of the oscillator waveform
 int waveform_api_handler(struct mg_connection *conn, void *cbdata) {
   const struct mg_request_info *req_info = mg_get_request_info(conn);
   KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
@@ -747,6 +1151,8 @@ int waveform_api_handler(struct mg_connection *conn, void *cbdata) {
     num_samples = 512;
   }
 
+  // Only the settings are read under the lock, the preview is drawn from a
+  // copy of them
   kbs->lock();
 
   if (id < 0 || id >= (int)kbs->synth.size()) {
@@ -755,51 +1161,54 @@ int waveform_api_handler(struct mg_connection *conn, void *cbdata) {
     return 404;
   }
 
-  auto &osc = kbs->synth[id];
+  const Sound::Rank<float>::Preset sound = kbs->synth[id].sound;
+  const int octave = kbs->synth[id].octave;
+  const int detune = kbs->synth[id].detune;
+  const int sample_rate = kbs->synth[id].sampleRate;
 
-  // Calculate the actual frequency for this oscillator considering octave and
-  // detune
-  const float base_freq = 440.0f;
-  const float octave_multiplier = pow(2.0f, osc.octave);
-  const float detune_multiplier = pow(2.0f, osc.detune / 1200.0f);
-  const float actual_freq = base_freq * octave_multiplier * detune_multiplier;
-
-  const int sample_rate = osc.sampleRate;
-  const float samples_per_cycle = sample_rate / actual_freq;
+  kbs->unlock();
 
-  json waveform_data = json::array();
+  const std::string key = "osc:" + Sound::Rank<float>::presetStr(sound) +
+                          ":" + std::to_string(octave) + ":" +
+                          std::to_string(detune) + ":" +
+                          std::to_string(sample_rate) + ":" +
+                          std::to_string(num_samples) + ":" +
+                          std::to_string(id);
 
-  // Create a temporary rank for visualization (no ADSR envelope)
-  Sound::Rank<float> temp_rank = Sound::Rank<float>::fromPreset(
-      osc.sound, actual_freq, (int)samples_per_cycle, sample_rate);
+  auto compute = [&](std::vector<float> &waveform, json &info) {
+    // Calculate the actual frequency for this oscillator considering octave
+    // and detune
+    const float base_freq = 440.0f;
+    const float octave_multiplier = pow(2.0f, octave);
+    const float detune_multiplier = pow(2.0f, detune / 1200.0f);
+    const float actual_freq = base_freq * octave_multiplier * detune_multiplier;
 
-  // Generate samples for one complete cycle
-  for (int i = 0; i < num_samples; i++) {
-    float t = (float)i / num_samples * samples_per_cycle;
-    float sample = temp_rank.generateRankSampleIndex((int)t);
-    waveform_data.push_back(sample);
-  }
+    const float samples_per_cycle = sample_rate / actual_freq;
 
-  json response = {{"id", id},
-                   {"samples", num_samples},
-                   {"waveform", waveform_data},
-                   {"octave", osc.octave},
-                   {"detune", osc.detune},
-                   {"frequency", actual_freq}};
+    // Create a temporary rank for visualization (no ADSR envelope)
+    Sound::Rank<float> temp_rank = Sound::Rank<float>::fromPreset(
+        sound, actual_freq, (int)samples_per_cycle, sample_rate);
 
-  kbs->unlock();
+    // Generate samples for one complete cycle
+    waveform.reserve(num_samples);
+    for (int i = 0; i < num_samples; i++) {
+      float t = (float)i / num_samples * samples_per_cycle;
+      waveform.push_back(temp_rank.generateRankSampleIndex((int)t));
+    }
 
-  std::string body = response.dump();
-  mg_printf(conn,
-            "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
-            "Content-Length: %zu\r\n\r\n%s",
-            body.size(), body.c_str());
+    info = {{"id", id},
+            {"samples", num_samples},
+            {"octave", octave},
+            {"detune", detune},
+            {"frequency", actual_freq}};
+  };
 
+  send_waveform(conn, query, key, compute);
   return 200;
 }
 
 // --- Combined Waveform API Handler ---
-// GET /api/waveform/combined?samples=512
+// GET /api/waveform/combined?samples=512[&format=f32|i16]
 // Returns a single cycle of all oscillators combined (weighted by volume)
 int waveform_combined_api_handler(struct mg_connection *conn, void *cbdata) {
   const struct mg_request_info *req_info = mg_get_request_info(conn);
@@ -824,110 +1233,242 @@ int waveform_combined_api_handler(struct mg_connection *conn, void *cbdata) {
     num_samples = 512;
   }
 
+  struct OscillatorSettings {
+    Sound::Rank<float>::Preset sound;
+    float volume;
+    int octave;
+    int detune;
+    int sampleRate;
+  };
+  std::vector<OscillatorSettings> oscillators;
+  std::string key = "combined:" + std::to_string(num_samples);
+
   kbs->lock();
+  for (const auto &osc : kbs->synth) {
+    oscillators.push_back(
+        {osc.sound, osc.volume, osc.octave, osc.detune, osc.sampleRate});
+  }
+  kbs->unlock();
 
-  // Find the lowest octave to determine the base frequency
-  int min_octave = 0;
-  bool has_active_osc = false;
-  for (size_t osc_idx = 0; osc_idx < kbs->synth.size(); osc_idx++) {
-    auto &osc = kbs->synth[osc_idx];
-    if (osc.volume > 0.0f) {
-      if (!has_active_osc || osc.octave < min_octave) {
-        min_octave = osc.octave;
-        has_active_osc = true;
+  for (const OscillatorSettings &osc : oscillators) {
+    key += ":" + Sound::Rank<float>::presetStr(osc.sound) + "," +
+           std::to_string(osc.volume) + "," + std::to_string(osc.octave) +
+           "," + std::to_string(osc.detune) + "," +
+           std::to_string(osc.sampleRate);
+  }
+
+  auto compute = [&](std::vector<float> &combined_waveform, json &info) {
+    // Find the lowest octave to determine the base frequency
+    int min_octave = 0;
+    bool has_active_osc = false;
+    for (const OscillatorSettings &osc : oscillators) {
+      if (osc.volume > 0.0f) {
+        if (!has_active_osc || osc.octave < min_octave) {
+          min_octave = osc.octave;
+          has_active_osc = true;
+        }
       }
     }
-  }
 
-  // Reference frequency adjusted for the lowest octave
-  // Base frequency is 440 Hz (A4), each octave doubles/halves the frequency
-  const float base_freq = 440.0f;
-  const float reference_freq = base_freq * pow(2.0f, min_octave);
+    // Reference frequency adjusted for the lowest octave
+    // Base frequency is 440 Hz (A4), each octave doubles/halves the frequency
+    const float base_freq = 440.0f;
+    const float reference_freq = base_freq * pow(2.0f, min_octave);
+
+    json oscillator_info = json::array();
 
-  json waveform_data = json::array();
-  json oscillator_info = json::array();
+    // Initialize combined waveform array
+    combined_waveform.assign(num_samples, 0.0f);
 
-  // Initialize combined waveform array
-  std::vector<float> combined_waveform(num_samples, 0.0f);
+    // Generate waveform for each oscillator and sum them
+    for (size_t osc_idx = 0; osc_idx < oscillators.size(); osc_idx++) {
+      const OscillatorSettings &osc = oscillators[osc_idx];
 
-  // Generate waveform for each oscillator and sum them
-  for (size_t osc_idx = 0; osc_idx < kbs->synth.size(); osc_idx++) {
-    auto &osc = kbs->synth[osc_idx];
+      // Skip oscillators with zero volume
+      if (osc.volume == 0.0f) {
+        oscillator_info.push_back({{"id", osc_idx},
+                                   {"volume", 0.0f},
+                                   {"octave", osc.octave},
+                                   {"detune", osc.detune},
+                                   {"active", false}});
+        continue;
+      }
+
+      const int sample_rate = osc.sampleRate;
+
+      // Calculate the actual frequency for this oscillator considering octave
+      // and detune Octave: each octave up doubles the frequency Detune:
+      // cents, where 100 cents = 1 semitone, 1200 cents = 1 octave
+      const float octave_multiplier = pow(2.0f, osc.octave);
+      const float detune_multiplier = pow(2.0f, osc.detune / 1200.0f);
+      const float osc_freq = base_freq * octave_multiplier * detune_multiplier;
+
+      // Calculate how many cycles this oscillator will complete in one cycle
+      // of the reference
+      const float freq_ratio = osc_freq / reference_freq;
+
+      // Create a temporary rank for visualization at this oscillator's
+      // frequency
+      Sound::Rank<float> temp_rank = Sound::Rank<float>::fromPreset(
+          osc.sound, osc_freq, sample_rate, sample_rate);
+
+      // Generate samples and add to combined waveform
+      // We need to show how this oscillator's waveform looks over one
+      // reference cycle
+      for (int i = 0; i < num_samples; i++) {
+        // Calculate the phase (0 to freq_ratio) for this sample
+        // If freq_ratio = 2, we go through 2 complete cycles
+        float normalized_phase = (float)i / (num_samples - 1); // 0 to 1
+        float phase_in_cycles = normalized_phase * freq_ratio;
+
+        // Convert phase to sample index in the oscillator's waveform
+        // One cycle = sample_rate / osc_freq samples
+        float samples_per_cycle = sample_rate / osc_freq;
+        float sample_index =
+            fmod(phase_in_cycles * samples_per_cycle, samples_per_cycle);
+
+        float sample = temp_rank.generateRankSampleIndex((int)sample_index);
+        combined_waveform[i] += sample * osc.volume;
+      }
 
-    // Skip oscillators with zero volume
-    if (osc.volume == 0.0f) {
-      oscillator_info.push_back({{"id", osc_idx},
-                                 {"volume", 0.0f},
-                                 {"octave", osc.octave},
-                                 {"detune", osc.detune},
-                                 {"active", false}});
-      continue;
+      oscillator_info.push_back(
+          {{"id", osc_idx},
+           {"volume", osc.volume},
+           {"octave", osc.octave},
+           {"detune", osc.detune},
+           {"sound", Sound::Rank<float>::presetStr(osc.sound)},
+           {"active", true},
+           {"frequency", osc_freq}});
     }
 
-    const int sample_rate = osc.sampleRate;
+    info = {{"samples", num_samples},
+            {"oscillators", oscillator_info},
+            {"reference_frequency", reference_freq},
+            {"base_octave", min_octave}};
+  };
 
-    // Calculate the actual frequency for this oscillator considering octave and
-    // detune Octave: each octave up doubles the frequency Detune: cents, where
-    // 100 cents = 1 semitone, 1200 cents = 1 octave
-    const float octave_multiplier = pow(2.0f, osc.octave);
-    const float detune_multiplier = pow(2.0f, osc.detune / 1200.0f);
-    const float osc_freq = base_freq * octave_multiplier * detune_multiplier;
+  send_waveform(conn, query, key, compute);
+  return 200;
+}
 
-    // Calculate how many cycles this oscillator will complete in one cycle of
-    // the reference
-    const float freq_ratio = osc_freq / reference_freq;
+// --- Stream Handler ---
+// GET /api/stream[?format=wav|raw]
+// Streams what the synth plays, as 16 bit little endian PCM at the synth's
+// sample rate and channels, for as long as the client reads it. "wav", the
+// default, starts with a WAVE header, "raw" is the bare samples. A client
+// that can't keep up loses audio, the synth never waits for it (see
+// NetworkSink). Each listener holds one of the server's threads.
+int stream_handler(struct mg_connection *conn, void *cbdata) {
+  const struct mg_request_info *req_info = mg_get_request_info(conn);
+  KeyboardStream *kbs = static_cast<KeyboardStream *>(cbdata);
 
-    // Create a temporary rank for visualization at this oscillator's frequency
-    Sound::Rank<float> temp_rank = Sound::Rank<float>::fromPreset(
-        osc.sound, osc_freq, sample_rate, sample_rate);
+  if (std::string(req_info->request_method) != "GET") {
+    mg_printf(conn, "HTTP/1.1 405 Method Not Allowed\r\n\r\n");
+    return 405;
+  }
 
-    // Generate samples and add to combined waveform
-    // We need to show how this oscillator's waveform looks over one reference
-    // cycle
-    for (int i = 0; i < num_samples; i++) {
-      // Calculate the phase (0 to freq_ratio) for this sample
-      // If freq_ratio = 2, we go through 2 complete cycles
-      float normalized_phase = (float)i / (num_samples - 1); // 0 to 1
-      float phase_in_cycles = normalized_phase * freq_ratio; // 0 to freq_ratio
-
-      // Convert phase to sample index in the oscillator's waveform
-      // One cycle = sample_rate / osc_freq samples
-      float samples_per_cycle = sample_rate / osc_freq;
-      float sample_index =
-          fmod(phase_in_cycles * samples_per_cycle, samples_per_cycle);
-
-      float sample = temp_rank.generateRankSampleIndex((int)sample_index);
-      combined_waveform[i] += sample * osc.volume;
-    }
+  char format[8] = {0};
+  const char *query = req_info->query_string;
+  if (query)
+    mg_get_var(query, strlen(query), "format", format, sizeof(format));
+  const std::string type = format[0] ? format : "wav";
+  if (type != "wav" && type != "raw") {
+    mg_printf(conn, "HTTP/1.1 400 Bad Request\r\n\r\n"
+                    "Format must be wav or raw");
+    return 400;
+  }
 
-    oscillator_info.push_back(
-        {{"id", osc_idx},
-         {"volume", osc.volume},
-         {"octave", osc.octave},
-         {"detune", osc.detune},
-         {"sound", Sound::Rank<float>::presetStr(osc.sound)},
-         {"active", true},
-         {"frequency", osc_freq}});
+  NetworkSink &sink = kbs->getNetworkSink();
+  mg_printf(conn,
+            "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+            "Cache-Control: no-cache\r\nX-Sample-Rate: %d\r\n"
+            "X-Channels: %d\r\nTransfer-Encoding: chunked\r\n\r\n",
+            type == "wav" ? "audio/wav" : "application/octet-stream",
+            sink.getSampleRate(), sink.getChannels());
+  if (type == "wav") {
+    const std::string header = sink.waveHeader();
+    if (mg_send_chunk(conn, header.data(), header.size()) <= 0)
+      return 200;
   }
 
-  // Convert combined waveform to JSON
-  for (float sample : combined_waveform) {
-    waveform_data.push_back(sample);
+  std::uint64_t position = sink.join();
+  std::vector<char> pcm;
+  while (sink.read(position, pcm, std::chrono::seconds(1))) {
+    if (!pcm.empty() && mg_send_chunk(conn, pcm.data(), pcm.size()) <= 0)
+      break;
   }
+  sink.leave();
+  mg_send_chunk(conn, "", 0);
+  return 200;
+}
 
-  json response = {{"samples", num_samples},
-                   {"waveform", waveform_data},
-                   {"oscillators", oscillator_info},
-                   {"reference_frequency", reference_freq},
-                   {"base_octave", min_octave}};
+// --- Sessions ---
+// GET /api/session lists the sessions of a session server, with the CPU
+// time each has used. /api/session/{id}/... reaches the API above for one
+// session, /api/session/{id}/config for its /api/config and so on.
+
+static json session_json(Session &session) {
+  const Session::Stats stats = session.getStats();
+  json j = {{"id", session.getId()},
+            {"output", Session::outputStr(session.getOutput())},
+            {"blocks", stats.blocks},
+            {"cpuSeconds", stats.cpuSeconds},
+            {"load", stats.load}};
+  if (session.getOutput() == Session::Output::Wave)
+    j["file"] = session.getFile();
+  return j;
+}
 
-  kbs->unlock();
+int session_api_handler(struct mg_connection *conn, void *cbdata) {
+  static const std::pair<const char *, mg_request_handler> routes[] = {
+      {"oscillators", oscillator_api_handler},
+      {"waveform", waveform_api_handler},
+      {"waveform/combined", waveform_combined_api_handler},
+      {"input/push", input_push_handler},
+      {"input/release", input_release_handler},
+      {"config", config_api_handler},
+      {"presets", presets_api_handler},
+      {"recorder", recorder_handler},
+      {"sequencer", sequencer_handler},
+      {"stream", stream_handler}};
 
-  std::string body = response.dump();
-  mg_printf(conn,
-            "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
-            "Content-Length: %zu\r\n\r\n%s",
-            body.size(), body.c_str());
+  const struct mg_request_info *req_info = mg_get_request_info(conn);
+  SessionServer *server = static_cast<SessionServer *>(cbdata);
+  const std::string prefix = "/api/session";
+  std::string path = req_info->local_uri + prefix.size();
+  if (!path.empty() && path[0] == '/')
+    path.erase(0, 1);
+
+  if (path.empty()) {
+    json sessions = json::array();
+    for (int id = 0; id < server->getNumSessions(); id++)
+      sessions.push_back(session_json(*server->getSession(id)));
+    send_json(conn, {{"sessions", sessions},
+                     {"workers", server->getNumWorkers()},
+                     {"lateBlocks", server->getLateBlocks()}});
+    return 200;
+  }
 
-  return 200;
+  const std::size_t slash = path.find('/');
+  const std::string idText = path.substr(0, slash);
+  const std::string route =
+      slash == std::string::npos ? "" : path.substr(slash + 1);
+  Session *session = nullptr;
+  if (!idText.empty() && std::all_of(idText.begin(), idText.end(), ::isdigit))
+    session = server->getSession(std::atoi(idText.c_str()));
+  if (!session) {
+    mg_printf(conn, "HTTP/1.1 404 Not Found\r\n\r\nNo such session");
+    return 404;
+  }
+
+  if (route.empty()) {
+    send_json(conn, session_json(*session));
+    return 200;
+  }
+  for (const auto &[name, handler] : routes) {
+    if (route == name)
+      return handler(conn, &session->getStream());
+  }
+  mg_printf(conn, "HTTP/1.1 404 Not Found\r\n\r\nUnknown session API");
+  return 404;
 }
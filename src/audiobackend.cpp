@@ -0,0 +1,131 @@
+#include "audiobackend.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <unistd.h>
+
+std::unique_ptr<AudioBackend> AudioBackend::create(const std::string &name,
+                                                   const std::string &file) {
+  if (name == "null")
+    return std::make_unique<NullAudioBackend>(true);
+  if (name == "null-fast")
+    return std::make_unique<NullAudioBackend>(false);
+  if (name == "wav")
+    return std::make_unique<WaveAudioBackend>(file);
+  if (name == "pipe")
+    return std::make_unique<PipeAudioBackend>();
+  return nullptr;
+}
+
+ThreadedAudioBackend::~ThreadedAudioBackend() { stop(); }
+
+bool ThreadedAudioBackend::open(int sampleRate, int channels, int frames,
+                                Render render) {
+  ThreadedAudioBackend::stop();
+  sampleRate_ = sampleRate;
+  channels_ = channels;
+  frames_ = frames;
+  render_ = std::move(render);
+  buffer_.assign(static_cast<std::size_t>(frames) * channels, 0.0f);
+  return true;
+}
+
+void ThreadedAudioBackend::start() {
+  ThreadedAudioBackend::stop();
+  framesRendered_ = 0;
+  running_ = true;
+  thread_ = std::thread(&ThreadedAudioBackend::run, this);
+}
+
+void ThreadedAudioBackend::stop() {
+  running_ = false;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+// --- Render thread ---
+void ThreadedAudioBackend::run() {
+  const std::chrono::duration<double> block(static_cast<double>(frames_) /
+                                            sampleRate_);
+  const auto period =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(block);
+  const int len = static_cast<int>(buffer_.size());
+  auto next = std::chrono::steady_clock::now();
+  while (running_) {
+    render_(buffer_.data(), len);
+    deliver(buffer_.data(), len);
+    framesRendered_ += frames_;
+    if (!realTime_)
+      continue;
+    // A device doesn't wait for a late block either, it plays on
+    next += period;
+    const auto now = std::chrono::steady_clock::now();
+    if (now > next)
+      next = now;
+    else
+      std::this_thread::sleep_until(next);
+  }
+}
+
+WaveAudioBackend::~WaveAudioBackend() { stop(); }
+
+bool WaveAudioBackend::open(int sampleRate, int channels, int frames,
+                            Render render) {
+  if (!writer_.open(file_, channels, sampleRate)) {
+    std::cerr << "Error: Unable to open " << file_ << " for writing"
+              << std::endl;
+    return false;
+  }
+  return ThreadedAudioBackend::open(sampleRate, channels, frames,
+                                    std::move(render));
+}
+
+void WaveAudioBackend::stop() {
+  ThreadedAudioBackend::stop();
+  // Closing fills in the sizes, so that the file plays
+  writer_.close();
+}
+
+void WaveAudioBackend::deliver(const float *buffer, int len) {
+  writer_.write(buffer, static_cast<std::size_t>(len));
+}
+
+PipeAudioBackend::~PipeAudioBackend() {
+  stop();
+  if (fd_ >= 0)
+    ::close(fd_);
+}
+
+bool PipeAudioBackend::open(int sampleRate, int channels, int frames,
+                            Render render) {
+  if (fd_ < 0) {
+    std::fflush(stdout);
+    fd_ = ::dup(STDOUT_FILENO);
+    if (fd_ < 0 || ::dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+      std::cerr << "Error: Unable to take over stdout" << std::endl;
+      return false;
+    }
+  }
+  pcm_.resize(static_cast<std::size_t>(frames) * channels);
+  return ThreadedAudioBackend::open(sampleRate, channels, frames,
+                                    std::move(render));
+}
+
+void PipeAudioBackend::deliver(const float *buffer, int len) {
+  for (int i = 0; i < len; i++) {
+    const float s = std::clamp(buffer[i], -1.0f, 1.0f);
+    pcm_[i] = static_cast<std::int16_t>(s * 32767.0f);
+  }
+  // Blocks while the reader is behind, which paces the render thread
+  // rather than the synth's control threads
+  const char *bytes = reinterpret_cast<const char *>(pcm_.data());
+  std::size_t left = static_cast<std::size_t>(len) * sizeof(std::int16_t);
+  while (left > 0) {
+    const ssize_t written = ::write(fd_, bytes, left);
+    if (written <= 0)
+      return;
+    bytes += written;
+    left -= static_cast<std::size_t>(written);
+  }
+}
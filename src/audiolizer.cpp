@@ -293,7 +293,7 @@ int main(int argc, char *argv[]) {
     buffer_right = buffer_right_clipped;
 
     // Fix so that the end/start is mixed
-    int fade_in_interval = (SAMPLERATE / 100) * 15;
+    int fade_in_interval = (Config::instance().getSampleRate() / 100) * 15;
     for (int i = 0; i < fade_in_interval; i++) {
       float factor =
           static_cast<float>(i) / static_cast<float>(fade_in_interval);
@@ -345,7 +345,7 @@ int main(int argc, char *argv[]) {
 
   SDL_AudioSpec desired, obtained;
   SDL_zero(desired);
-  desired.freq = SAMPLERATE;
+  desired.freq = Config::instance().getSampleRate();
   desired.format = AUDIO_S16SYS;
   desired.channels = 2;
   desired.samples = config.buffer_size;
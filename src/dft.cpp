@@ -2,7 +2,9 @@
 #include <complex>
 #include <fftw3.h>
 #include <iostream>
+#include <limits>
 #include <math.h>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -13,123 +15,126 @@ using Complex = std::complex<double>;
 // Add a static mutex for thread safety
 static std::mutex fftw_mutex;
 
-std::vector<Complex> FourierTransform::DFT(const std::vector<float> &data,
-                                           bool normalize) {
-  int N = data.size();
-
-  // Scope the lock to release it as soon as possible
-  fftw_complex *in, *out;
-  {
+namespace {
+// A complex transform of one size and direction, with arrays of its own.
+// Only planning takes the lock, executing a plan of its own is thread safe.
+struct ComplexPlan {
+  int size;
+  int sign;
+  fftw_complex *in;
+  fftw_complex *out;
+  fftw_plan plan;
+
+  ComplexPlan(int size_, int sign_) : size(size_), sign(sign_) {
     std::lock_guard<std::mutex> lock(fftw_mutex);
-    in =
-        reinterpret_cast<fftw_complex *>(fftw_malloc(sizeof(fftw_complex) * N));
-    out =
-        reinterpret_cast<fftw_complex *>(fftw_malloc(sizeof(fftw_complex) * N));
-  }
-
-  // Copy input data to fftw input (this part is thread-safe as it uses local
-  // memory)
-  for (int i = 0; i < N; ++i) {
-    in[i][0] = data[i];
-    in[i][1] = 0.0;
+    in = reinterpret_cast<fftw_complex *>(
+        fftw_malloc(sizeof(fftw_complex) * size));
+    out = reinterpret_cast<fftw_complex *>(
+        fftw_malloc(sizeof(fftw_complex) * size));
+    plan = fftw_plan_dft_1d(size, in, out, sign, FFTW_ESTIMATE);
   }
-
-  // Plan and execute FFT with mutex protection
-  std::vector<Complex> result(N);
-  {
+  ~ComplexPlan() {
     std::lock_guard<std::mutex> lock(fftw_mutex);
-    fftw_plan p = fftw_plan_dft_1d(N, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftw_execute(p);
-
-    // Copy results while still under lock
-    double scale = normalize ? N : 1.0;
-    for (int i = 0; i < N; ++i) {
-      result[i] = Complex(out[i][0] / scale, out[i][1] / scale);
-    }
-
-    // Cleanup FFTW resources
-    fftw_destroy_plan(p);
+    fftw_destroy_plan(plan);
     fftw_free(in);
     fftw_free(out);
   }
-
-  return result;
+  ComplexPlan(const ComplexPlan &) = delete;
+  ComplexPlan &operator=(const ComplexPlan &) = delete;
+};
+
+// The calling thread's plan for 'size' and 'sign'. Threads keep the few
+// they used last, so that rendering notes of the same length on many
+// threads plans each transform once per thread and never waits on another
+// thread's transform.
+constexpr std::size_t PLANS_PER_THREAD = 4;
+
+ComplexPlan &threadPlan(int size, int sign) {
+  thread_local std::vector<std::unique_ptr<ComplexPlan>> plans;
+  for (auto it = plans.begin(); it != plans.end(); ++it) {
+    if ((*it)->size == size && (*it)->sign == sign) {
+      // Most recently used last
+      std::rotate(it, it + 1, plans.end());
+      return *plans.back();
+    }
+  }
+  if (plans.size() == PLANS_PER_THREAD)
+    plans.erase(plans.begin());
+  plans.push_back(std::make_unique<ComplexPlan>(size, sign));
+  return *plans.back();
 }
 
-std::vector<Complex> FourierTransform::DFT(const std::vector<short> &data,
-                                           bool normalize) {
+template <typename T>
+std::vector<Complex> forward(const std::vector<T> &data, bool normalize) {
   int N = data.size();
+  if (N == 0)
+    return {};
+  ComplexPlan &p = threadPlan(N, FFTW_FORWARD);
 
-  fftw_complex *in, *out;
-  {
-    std::lock_guard<std::mutex> lock(fftw_mutex);
-    in =
-        reinterpret_cast<fftw_complex *>(fftw_malloc(sizeof(fftw_complex) * N));
-    out =
-        reinterpret_cast<fftw_complex *>(fftw_malloc(sizeof(fftw_complex) * N));
-  }
-
-  // Copy input data
   for (int i = 0; i < N; ++i) {
-    in[i][0] = data[i];
-    in[i][1] = 0.0;
+    p.in[i][0] = data[i];
+    p.in[i][1] = 0.0;
   }
+  fftw_execute(p.plan);
 
   std::vector<Complex> result(N);
-  {
-    std::lock_guard<std::mutex> lock(fftw_mutex);
-    fftw_plan p = fftw_plan_dft_1d(N, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
-    fftw_execute(p);
-
-    double scale = normalize ? N : 1.0;
-    for (int i = 0; i < N; ++i) {
-      result[i] = Complex(out[i][0] / scale, out[i][1] / scale);
-    }
-
-    fftw_destroy_plan(p);
-    fftw_free(in);
-    fftw_free(out);
+  double scale = normalize ? N : 1.0;
+  for (int i = 0; i < N; ++i) {
+    result[i] = Complex(p.out[i][0] / scale, p.out[i][1] / scale);
   }
-
   return result;
 }
+} // namespace
+
+std::vector<Complex> FourierTransform::DFT(const std::vector<float> &data,
+                                           bool normalize) {
+  return forward(data, normalize);
+}
+
+std::vector<Complex> FourierTransform::DFT(const std::vector<short> &data,
+                                           bool normalize) {
+  return forward(data, normalize);
+}
 
 std::vector<short> FourierTransform::IDFT(const std::vector<Complex> &X) {
   int N = X.size();
+  if (N == 0)
+    return {};
+  ComplexPlan &p = threadPlan(N, FFTW_BACKWARD);
 
-  fftw_complex *in, *out;
-  {
-    std::lock_guard<std::mutex> lock(fftw_mutex);
-    in =
-        reinterpret_cast<fftw_complex *>(fftw_malloc(sizeof(fftw_complex) * N));
-    out =
-        reinterpret_cast<fftw_complex *>(fftw_malloc(sizeof(fftw_complex) * N));
-  }
-
-  // Copy input data
   for (int i = 0; i < N; ++i) {
-    in[i][0] = X[i].real();
-    in[i][1] = X[i].imag();
+    p.in[i][0] = X[i].real();
+    p.in[i][1] = X[i].imag();
   }
+  fftw_execute(p.plan);
 
   std::vector<short> result(N);
-  {
-    std::lock_guard<std::mutex> lock(fftw_mutex);
-    fftw_plan p = fftw_plan_dft_1d(N, in, out, FFTW_BACKWARD, FFTW_ESTIMATE);
-    fftw_execute(p);
-
-    for (int i = 0; i < N; ++i) {
-      double val = out[i][0] / N;
-      result[i] =
-          std::clamp(std::round(val),
-                     static_cast<double>(std::numeric_limits<short>::min()),
-                     static_cast<double>(std::numeric_limits<short>::max()));
-    }
-
-    fftw_destroy_plan(p);
-    fftw_free(in);
-    fftw_free(out);
+  for (int i = 0; i < N; ++i) {
+    double val = p.out[i][0] / N;
+    result[i] =
+        std::clamp(std::round(val),
+                   static_cast<double>(std::numeric_limits<short>::min()),
+                   static_cast<double>(std::numeric_limits<short>::max()));
   }
-
   return result;
 }
+
+RealFFT::RealFFT(int size) : size_(size) {
+  std::lock_guard<std::mutex> lock(fftw_mutex);
+  in_ = reinterpret_cast<double *>(fftw_malloc(sizeof(double) * size));
+  auto *out = reinterpret_cast<fftw_complex *>(
+      fftw_malloc(sizeof(fftw_complex) * (size / 2 + 1)));
+  out_ = reinterpret_cast<double *>(out);
+  std::fill_n(in_, size, 0.0);
+  plan_ = fftw_plan_dft_r2c_1d(size, in_, out, FFTW_ESTIMATE);
+}
+
+RealFFT::~RealFFT() {
+  std::lock_guard<std::mutex> lock(fftw_mutex);
+  fftw_destroy_plan(static_cast<fftw_plan>(plan_));
+  fftw_free(in_);
+  fftw_free(out_);
+}
+
+// Executing a plan of its own is thread safe, only planning isn't
+void RealFFT::execute() { fftw_execute(static_cast<fftw_plan>(plan_)); }
@@ -170,6 +170,21 @@ template <> float EchoEffect<float>::process(float inputSample) {
   return outputSample;
 }
 
+template <>
+void EchoEffect<float>::processStereo(float &left, float &right) {
+  size_t readIndex = (writeIndex + 1) % delaySamples;
+  float delayedLeft = buffer[readIndex];
+  float delayedRight = bufferRight[readIndex];
+
+  buffer[writeIndex] = left + delayedLeft * feedback;
+  bufferRight[writeIndex] = right + delayedRight * feedback;
+
+  left = left + mix * delayedLeft;
+  right = right + mix * delayedRight;
+
+  writeIndex = (writeIndex + 1) % delaySamples;
+}
+
 template <> short EchoEffect<short>::process(short inputSample) {
   size_t readIndex = (writeIndex + 1) % delaySamples;
   float delayedSample = static_cast<float>(buffer[readIndex]);
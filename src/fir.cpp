@@ -1,4 +1,5 @@
 #include "fir.hpp"
+#include "resampler.hpp"
 
 std::vector<short> FIR::convolute(int max_size) {
   std::vector<short> result;
@@ -74,6 +75,12 @@ bool FIR::loadFromFile(std::string file) {
     } else {
       this->buffer = convertToVector(data, size);
     }
+    delete[] data;
+
+    if (sampleRate != this->sampleRate) {
+      this->buffer = Resampler::convertCached(file, this->buffer, 1,
+                                              sampleRate, this->sampleRate);
+    }
 
     this->impulseResponse.clear();
     this->impulseResponse.reserve(this->buffer.size());
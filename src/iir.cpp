@@ -42,27 +42,44 @@ template <> float IIR<float>::peek() {
   return 0;
 }
 
-template <> float IIR<float>::process(float in) {
-  if (this->bypass) {
-    return in;
-  }
-  if (this->memoryY.size() == 0) {
+static float processFloat(float in, const std::vector<double> &as,
+                          const std::vector<double> &bs,
+                          std::vector<float> &memoryX,
+                          std::vector<float> &memoryY) {
+  if (memoryY.size() == 0) {
     return 0;
   }
-  std::rotate(this->memoryY.rbegin(), this->memoryY.rbegin() + 1,
-              this->memoryY.rend());
-  std::rotate(this->memoryX.rbegin(), this->memoryX.rbegin() + 1,
-              this->memoryX.rend());
-  this->memoryX[0] = in;
+  std::rotate(memoryY.rbegin(), memoryY.rbegin() + 1, memoryY.rend());
+  std::rotate(memoryX.rbegin(), memoryX.rbegin() + 1, memoryX.rend());
+  memoryX[0] = in;
 
   double val = 0;
-  for (int i = 0; i < this->as.size(); i++) {
-    val += this->bs[i] * this->memoryX[i];
-    if (i != this->as.size() - 1) {
-      val -= this->as[i] * this->memoryY[i + 1];
+  for (int i = 0; i < as.size(); i++) {
+    val += bs[i] * memoryX[i];
+    if (i != as.size() - 1) {
+      val -= as[i] * memoryY[i + 1];
     }
   }
-  this->memoryY[0] = static_cast<float>(val);
+  memoryY[0] = static_cast<float>(val);
 
-  return this->memoryY[0];
+  return memoryY[0];
+}
+
+template <> float IIR<float>::process(float in) {
+  if (this->bypass) {
+    return in;
+  }
+  return processFloat(in, this->as, this->bs, this->memoryX, this->memoryY);
+}
+
+template <> float IIR<float>::processRight(float in) {
+  if (this->bypass) {
+    return in;
+  }
+  if (this->memoryYRight.size() != this->memoryY.size()) {
+    this->memoryXRight.assign(this->memoryX.size(), 0);
+    this->memoryYRight.assign(this->memoryY.size(), 0);
+  }
+  return processFloat(in, this->as, this->bs, this->memoryXRight,
+                      this->memoryYRight);
 }
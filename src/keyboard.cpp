@@ -2,6 +2,8 @@
 #include <cassert>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
 #include <thread>
 #include <vector>
@@ -86,150 +88,255 @@ void Keyboard::printInstructions() {
   term::refresh_if_needed();
 }
 
+void Keyboard::renderNotes(const std::vector<std::string> &keys,
+                           const std::vector<int> &order,
+                           const std::vector<Effect<short>> &effects,
+                           int nbrThreads, const RenderTask &render,
+                           const nlohmann::json &description) {
+  std::vector<RenderedNote> rendered(keys.size());
+  unsigned ticks = keys.size();
+  std::atomic<unsigned> tick{1};
+  std::atomic<std::size_t> next{0};
+
+  // Ensure nbrThreads is sensible
+  nbrThreads =
+      std::max(1, std::min(nbrThreads, static_cast<int>(order.size())));
+
+  // Every thread takes the next note as soon as it is done with one, so that
+  // notes that take longer, long samples or heavy effects, don't leave
+  // threads idle while another has a backlog. Each note has a slot of its
+  // own in 'rendered', the threads share nothing else.
+  auto work = [&]() {
+    std::vector<Effect<short>> effectsClone(effects);
+    for (std::size_t i = next++; i < order.size(); i = next++) {
+      render(order[i], effectsClone, rendered[order[i]]);
+      if (this->loaderFunc) {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->loaderFunc(ticks, tick++);
+      }
+    }
+  };
+
+  // This thread is one of them
+  std::vector<std::thread> threads;
+  for (int t = 1; t < nbrThreads; ++t) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Cached unless something went wrong, so that it is tried again
+  bool complete = true;
+  for (const auto &r : rendered) {
+    complete = complete && r.ready && r.warning.empty();
+  }
+  if (this->noteCache && complete) {
+    std::vector<NoteCache::Note> cached;
+    cached.reserve(rendered.size());
+    for (const auto &r : rendered) {
+      cached.push_back({static_cast<std::uint32_t>(r.format),
+                        static_cast<std::uint32_t>(r.sampleRate),
+                        r.samples.data(), static_cast<std::size_t>(r.bytes)});
+    }
+    this->noteCache->save(description, cached);
+  }
+
+  // OpenAL is only called from here, once every note is done
+  for (std::size_t bufferIndex = 0; bufferIndex < keys.size(); ++bufferIndex) {
+    RenderedNote &r = rendered[bufferIndex];
+    if (!r.warning.empty()) {
+      fputs(r.warning.c_str(), stderr);
+    }
+    if (r.ready) {
+      alBufferData(this->buffers[bufferIndex], r.format, r.samples.data(),
+                   r.bytes, r.sampleRate);
+    }
+    const auto &key = keys[bufferIndex];
+    this->keyToBufferIndex[key] = bufferIndex;
+    this->notes.insert(std::make_pair(key, std::move(r.note)));
+    std::vector<short>().swap(r.samples);
+  }
+}
+
+nlohmann::json
+Keyboard::describeNotes(int sampleRate, int length, const ADSR &adsr,
+                        const std::vector<Effect<short>> &effects) {
+  nlohmann::json description = {
+      {"sampleRate", sampleRate},
+      {"length", length},
+      {"adsr", adsr.toJson()},
+      {"effects", nlohmann::json::array()},
+      {"tuning", notes::tuning_to_string(this->tuning)},
+      {"volume", this->volume},
+      {"notes", this->buffers.size()}};
+  for (const auto &effect : effects) {
+    description["effects"].push_back(effect.toJson());
+  }
+  return description;
+}
+
+bool Keyboard::loadCachedNotes(const std::vector<std::string> &keys,
+                               int sampleRate, int length,
+                               const nlohmann::json &description) {
+  if (!this->noteCache) {
+    return false;
+  }
+  auto mapping = this->noteCache->load(description);
+  if (!mapping || mapping->getNotes().size() != keys.size()) {
+    return false;
+  }
+
+  // Straight from the mapped file to OpenAL
+  unsigned ticks = keys.size();
+  const auto &cached = mapping->getNotes();
+  for (std::size_t bufferIndex = 0; bufferIndex < keys.size(); ++bufferIndex) {
+    const auto &c = cached[bufferIndex];
+    alBufferData(this->buffers[bufferIndex], static_cast<ALenum>(c.format),
+                 c.data, static_cast<ALsizei>(c.bytes), c.sampleRate);
+    const auto &key = keys[bufferIndex];
+    this->keyToBufferIndex[key] = bufferIndex;
+    this->notes.insert(
+        std::make_pair(key, Note(key, length, sampleRate, this->tuning)));
+    if (this->loaderFunc) {
+      this->loaderFunc(ticks, bufferIndex + 1);
+    }
+  }
+  return true;
+}
+
 void Keyboard::prepareSound(int sampleRate, ADSR &adsr, Sound::WaveForm f,
                             std::vector<Effect<short>> &effects,
                             int nbrThreads) {
   int length = adsr.getLength();
   std::vector<std::string> notes = notes::getNotes(this->tuning);
   assert(notes.size() == this->buffers.size());
-  unsigned ticks = notes.size();
-  std::atomic<unsigned> tick{1};
-
-  // Ensure nbrThreads is sensible
-  nbrThreads =
-      std::max(1, std::min(nbrThreads, static_cast<int>(notes.size())));
 
-  // Shared data needs protection
-  std::mutex mtx;
+  // Mapped files are told apart by their size and modification time
+  nlohmann::json description =
+      describeNotes(sampleRate, length, adsr, effects);
+  description["waveform"] = Sound::typeOfWave(f);
+  description["soundMapFile"] = this->soundMapFile;
+  if (f == Sound::WaveForm::WaveFile) {
+    for (const auto &[key, file] : this->soundMap) {
+      std::error_code sizeError, timeError;
+      auto size = std::filesystem::file_size(file, sizeError);
+      auto time = std::filesystem::last_write_time(file, timeError);
+      description["soundMap"][key] = {
+          file, sizeError ? 0 : size,
+          timeError ? 0 : time.time_since_epoch().count()};
+    }
+  }
+  if (loadCachedNotes(notes, sampleRate, length, description)) {
+    return;
+  }
 
-  // Split notes into chunks
-  std::vector<std::thread> threads;
-  int notesPerThread = notes.size() / nbrThreads;
-  int remainder = notes.size() % nbrThreads;
+  // Longest samples first, so that none is left to the end to be rendered
+  // on one thread while the others are done
+  std::vector<int> order(notes.size());
+  std::vector<std::uintmax_t> cost(notes.size(), 0);
+  for (int i = 0; i < static_cast<int>(notes.size()); ++i) {
+    order[i] = i;
+    auto mapped = this->soundMap.find(notes[i]);
+    if (f == Sound::WaveForm::WaveFile && mapped != this->soundMap.end()) {
+      std::error_code error;
+      cost[i] = std::filesystem::file_size(mapped->second, error);
+      if (error)
+        cost[i] = 0;
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return cost[a] > cost[b]; });
 
-  // Lambda to process a range of notes
   notes::TuningSystem tuning = this->tuning;
-  auto processNotes = [&](int start, int end, int threadIndex) {
-    std::vector<Effect<short>> effectsClone(effects);
-    for (int bufferIndex = start; bufferIndex < end; ++bufferIndex) {
-      const auto &key = notes[bufferIndex];
-      Note n = Note(key, length, sampleRate, tuning);
-
-      if (f == Sound::WaveForm::WaveFile &&
-          this->soundMap.find(key) != this->soundMap.end()) {
-        int channels, wavSampleRate, bps, size;
-        char *data;
-        ALenum format = AL_FORMAT_MONO8;
-        if ((data = loadWAV(this->soundMap[key], channels, wavSampleRate, bps,
-                            size)) != NULL) {
-          if (channels == 1) {
-            format = (bps == 8) ? AL_FORMAT_MONO8 : AL_FORMAT_MONO16;
-          } else {
-            format = (bps == 8) ? AL_FORMAT_STEREO8 : AL_FORMAT_STEREO16;
+  auto render = [&](int bufferIndex, std::vector<Effect<short>> &effectsClone,
+                    RenderedNote &out) {
+    const auto &key = notes[bufferIndex];
+    Note n = Note(key, length, sampleRate, tuning);
+    auto mapped = this->soundMap.find(key);
+
+    if (f == Sound::WaveForm::WaveFile && mapped != this->soundMap.end()) {
+      int channels, wavSampleRate, bps, size;
+      char *data;
+      ALenum format = AL_FORMAT_MONO8;
+      if ((data = loadWAV(mapped->second, channels, wavSampleRate, bps,
+                          size)) != NULL) {
+        if (channels == 1) {
+          format = (bps == 8) ? AL_FORMAT_MONO8 : AL_FORMAT_MONO16;
+        } else {
+          format = (bps == 8) ? AL_FORMAT_STEREO8 : AL_FORMAT_STEREO16;
+        }
+
+        if (channels == 2) {
+          std::vector<short> buffer_left_in, buffer_right_in;
+          splitChannels(data, size, buffer_left_in, buffer_right_in);
+
+          std::vector<short> buffer_left_effect_out = buffer_left_in;
+          for (int i = 0; i < effectsClone.size(); i++) {
+            buffer_left_effect_out =
+                effectsClone[i].apply(buffer_left_effect_out);
+          }
+
+          std::vector<short> buffer_right_effect_out = buffer_right_in;
+          for (int i = 0; i < effectsClone.size(); i++) {
+            buffer_right_effect_out =
+                effectsClone[i].apply(buffer_right_effect_out);
           }
 
-          if (channels == 2) {
-            std::vector<short> buffer_left_in, buffer_right_in;
-            splitChannels(data, size, buffer_left_in, buffer_right_in);
-
-            std::vector<short> buffer_left_effect_out = buffer_left_in;
-            for (int i = 0; i < effectsClone.size(); i++) {
-              buffer_left_effect_out =
-                  effectsClone[i].apply(buffer_left_effect_out);
-            }
-
-            std::vector<short> buffer_right_effect_out = buffer_right_in;
-            for (int i = 0; i < effectsClone.size(); i++) {
-              buffer_right_effect_out =
-                  effectsClone[i].apply(buffer_right_effect_out);
-            }
-
-            std::vector<short> interleaved;
-            interleaved.reserve(buffer_left_effect_out.size() * 2);
-            for (size_t i = 0; i < buffer_left_effect_out.size(); ++i) {
-              interleaved.push_back(buffer_left_effect_out[i] * this->volume);
-              interleaved.push_back(buffer_right_effect_out[i] * this->volume);
-            }
-            {
-              std::lock_guard<std::mutex> lock(mtx);
-              alBufferData(this->buffers[bufferIndex], format,
-                           interleaved.data(), size, wavSampleRate);
-            }
-          } else {
-            std::vector<short> buffer_in = convertToVector(data, size);
-            std::vector<short> buffer_out = buffer_in;
-            for (int i = 0; i < effectsClone.size(); i++) {
-              buffer_out = effectsClone[i].apply(buffer_out);
-            }
-
-            {
-              std::lock_guard<std::mutex> lock(mtx);
-              alBufferData(this->buffers[bufferIndex], format,
-                           buffer_out.data(), size, wavSampleRate);
-            }
+          std::vector<short> interleaved;
+          interleaved.reserve(buffer_left_effect_out.size() * 2);
+          for (size_t i = 0; i < buffer_left_effect_out.size(); ++i) {
+            interleaved.push_back(buffer_left_effect_out[i] * this->volume);
+            interleaved.push_back(buffer_right_effect_out[i] * this->volume);
           }
-          delete[] data; // Assuming loadWAV allocates memory
+          out.samples = std::move(interleaved);
         } else {
-          std::lock_guard<std::mutex> lock(mtx);
-          fprintf(stderr, "Error loading file: %s\n",
-                  this->soundMap[key].c_str());
+          std::vector<short> buffer_in = convertToVector(data, size);
+          std::vector<short> buffer_out = buffer_in;
+          for (int i = 0; i < effectsClone.size(); i++) {
+            buffer_out = effectsClone[i].apply(buffer_out);
+          }
+          out.samples = std::move(buffer_out);
         }
+        out.format = format;
+        out.bytes = size;
+        out.sampleRate = wavSampleRate;
+        out.ready = true;
+        delete[] data; // Assuming loadWAV allocates memory
       } else {
-        Sound::WaveForm ff = f;
-        if (this->soundMapFile.size() > 0) {
-          std::lock_guard<std::mutex> lock(mtx);
-          printf(
-              "warning: Missing key '%s' in the mapping file '%s', filling in "
-              "with a sine wave\n",
-              key.c_str(), this->soundMapFile.c_str());
-          ff = Sound::WaveForm::Sine;
-        }
-        std::vector<short> buffer_in =
-            Sound::generateWave(ff, n, adsr, effects);
-        std::vector<short> buffer_out = buffer_in;
-        for (int i = 0; i < effectsClone.size(); i++) {
-          buffer_out = effectsClone[i].apply(buffer_in);
-          buffer_in = buffer_out;
-        }
-        for (auto &sample : buffer_out) {
-          sample *= this->volume;
-        }
-        n.setBuffer(buffer_out);
-
-        {
-          std::lock_guard<std::mutex> lock(mtx);
-          alBufferData(this->buffers[bufferIndex], AL_FORMAT_MONO16,
-                       n.buffer.data(), n.buffer.size() * sizeof(short),
-                       n.sampleRate);
-        }
+        out.warning = "Error loading file: " + mapped->second + "\n";
       }
-
-      // Safely update shared data
-      {
-        std::lock_guard<std::mutex> lock(mtx);
-        this->keyToBufferIndex[key] = bufferIndex;
-        this->notes.insert(std::make_pair(key, n));
-        if (this->loaderFunc) {
-          unsigned currentTick = tick.fetch_add(1);
-          this->loaderFunc(ticks, currentTick);
-        }
+    } else {
+      Sound::WaveForm ff = f;
+      if (this->soundMapFile.size() > 0) {
+        out.warning = "warning: Missing key '" + key +
+                      "' in the mapping file '" + this->soundMapFile +
+                      "', filling in with a sine wave\n";
+        ff = Sound::WaveForm::Sine;
       }
+      std::vector<short> buffer_in =
+          Sound::generateWave(ff, n, adsr, effectsClone);
+      std::vector<short> buffer_out = buffer_in;
+      for (int i = 0; i < effectsClone.size(); i++) {
+        buffer_out = effectsClone[i].apply(buffer_in);
+        buffer_in = buffer_out;
+      }
+      for (auto &sample : buffer_out) {
+        sample *= this->volume;
+      }
+      n.setBuffer(buffer_out);
+
+      out.samples = std::move(buffer_out);
+      out.format = AL_FORMAT_MONO16;
+      out.bytes = out.samples.size() * sizeof(short);
+      out.sampleRate = n.sampleRate;
+      out.ready = true;
     }
+    out.note = std::move(n);
   };
 
-  // Launch threads
-  int start = 0;
-  for (int t = 0; t < nbrThreads; ++t) {
-    int extra = (t < remainder) ? 1 : 0; // Distribute remainder
-    int end = start + notesPerThread + extra;
-    threads.emplace_back(processNotes, start, end, t);
-    start = end;
-  }
-
-  // Wait for all threads to finish
-  for (auto &thread : threads) {
-    thread.join();
-  }
+  renderNotes(notes, order, effects, nbrThreads, render, description);
 }
 
 void Keyboard::prepareSound(int sampleRate, ADSR &adsr,
@@ -238,84 +345,61 @@ void Keyboard::prepareSound(int sampleRate, ADSR &adsr,
                             int nbrThreads) {
   std::vector<std::string> notes = notes::getNotes(this->tuning);
   assert(notes.size() == this->buffers.size());
-  int bufferIndex = 0;
-  unsigned ticks = notes.size();
-  std::atomic<unsigned> tick{1};
 
-  // Ensure nbrThreads is sensible
-  nbrThreads =
-      std::max(1, std::min(nbrThreads, static_cast<int>(notes.size())));
-
-  // Shared data needs protection
-  std::mutex mtx;
+  nlohmann::json description =
+      describeNotes(sampleRate, adsr.length, adsr, effects);
+  description["preset"] = Sound::Rank<short>::presetStr(preset);
+  if (loadCachedNotes(notes, sampleRate, adsr.length, description)) {
+    return;
+  }
 
-  // Split notes into chunks
-  std::vector<std::thread> threads;
-  int notesPerThread = notes.size() / nbrThreads;
-  int remainder = notes.size() % nbrThreads;
+  // Every note costs the same
+  std::vector<int> order(notes.size());
+  for (int i = 0; i < static_cast<int>(notes.size()); ++i) {
+    order[i] = i;
+  }
 
-  // Lambda to process a range of notes
   notes::TuningSystem tuning = this->tuning;
-  auto processNotes = [&](int start, int end, int threadIndex) {
-    std::vector<Effect<short>> effectsClone(effects);
-    for (int bufferIndex = start; bufferIndex < end; ++bufferIndex) {
-      const auto &key = notes[bufferIndex];
-      // Bottom row (one octave lower than home row)
-      Note n = Note(key, adsr.length, sampleRate, tuning);
-
-      Sound::Rank<short> r = Sound::Rank<short>::fromPreset(
-          preset, n.frequency, adsr.length, sampleRate);
-      r.adsr = adsr;
-      for (int e = 0; e < effectsClone.size(); e++) {
-        r.addEffect(effectsClone[e]);
-      }
-
-      std::vector<short> buffer_in = Sound::generateWave(r);
-      std::vector<short> buffer_out;
+  auto render = [&](int bufferIndex, std::vector<Effect<short>> &effectsClone,
+                    RenderedNote &out) {
+    const auto &key = notes[bufferIndex];
+    // Bottom row (one octave lower than home row)
+    Note n = Note(key, adsr.length, sampleRate, tuning);
+
+    Sound::Rank<short> r = Sound::Rank<short>::fromPreset(
+        preset, n.frequency, adsr.length, sampleRate);
+    r.adsr = adsr;
+    for (int e = 0; e < effectsClone.size(); e++) {
+      r.addEffect(effectsClone[e]);
+    }
 
-      if (effects.size() == 0) {
-        buffer_out = buffer_in;
-      }
+    std::vector<short> buffer_in = Sound::generateWave(r);
+    std::vector<short> buffer_out;
 
-      for (int i = 0; i < effectsClone.size(); i++) {
-        buffer_out = effectsClone[i].apply(buffer_in);
-        if (effects.size() != i + 1) {
-          buffer_in = buffer_out;
-        }
-      }
-      for (size_t i = 0; i < buffer_out.size(); ++i) {
-        buffer_out[i] = buffer_out[i] * this->volume;
-      }
-      n.setBuffer(buffer_out);
+    if (effects.size() == 0) {
+      buffer_out = buffer_in;
+    }
 
-      // Safely update shared data
-      {
-        std::lock_guard<std::mutex> lock(mtx);
-        alBufferData(this->buffers[bufferIndex], AL_FORMAT_MONO16,
-                     n.buffer.data(), n.buffer.size() * sizeof(short),
-                     n.sampleRate);
-        this->keyToBufferIndex[key] = bufferIndex;
-        this->notes.insert(std::make_pair(key, n));
-        if (this->loaderFunc) {
-          unsigned currentTick = tick.fetch_add(1);
-          this->loaderFunc(ticks, currentTick);
-        }
+    for (int i = 0; i < effectsClone.size(); i++) {
+      buffer_out = effectsClone[i].apply(buffer_in);
+      if (effects.size() != i + 1) {
+        buffer_in = buffer_out;
       }
     }
+    for (size_t i = 0; i < buffer_out.size(); ++i) {
+      buffer_out[i] = buffer_out[i] * this->volume;
+    }
+    n.setBuffer(buffer_out);
+
+    out.samples = std::move(buffer_out);
+    out.format = AL_FORMAT_MONO16;
+    out.bytes = out.samples.size() * sizeof(short);
+    out.sampleRate = n.sampleRate;
+    out.ready = true;
+    out.note = std::move(n);
   };
-  // Launch threads
-  int start = 0;
-  for (int t = 0; t < nbrThreads; ++t) {
-    int extra = (t < remainder) ? 1 : 0; // Distribute remainder
-    int end = start + notesPerThread + extra;
-    threads.emplace_back(processNotes, start, end, t);
-    start = end;
-  }
 
-  // Wait for all threads to finish
-  for (auto &thread : threads) {
-    thread.join();
-  }
+  renderNotes(notes, order, effects, nbrThreads, render, description);
 }
 
 void Keyboard::registerNote(const std::string &note) { playNote(note); }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
@@ -7,11 +8,21 @@
 #include <thread>
 #include <vector>
 
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define KEYBOARD_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KEYBOARD_NEON 1
+#endif
+
+#include "alloccheck.hpp"
 #include "config.hpp"
 #include "effect.hpp"
 #include "fir.hpp"
 #include "keyboardstream.hpp"
 #include "notes.hpp"
+#include "resampler.hpp"
 #include "sound.hpp"
 #include "waveread.hpp"
 
@@ -93,82 +104,508 @@ void KeyboardStream::prepareSound(int sampleRate, ADSR &adsr,
   this->effects.insert(this->effects.end(), effects.begin(), effects.end());
 
   if (!this->soundMap.empty()) {
-    this->synth.emplace_back(SAMPLERATE, this->tuning);
+    this->synth.emplace_back(this->sampleRate, this->tuning);
     this->synth[0].setVolume(0.5);
     this->synth[0].setSoundMap(this->soundMap);
     this->synth[0].setEffects(this->effects);
   } else {
     this->setupStandardSynthConfig();
   }
+
+  int workers = Config::instance().getRenderWorkers();
+  if (workers < 0)
+    workers = WorkerPool::defaultWorkers();
+  if (workers > 0)
+    this->pool = std::make_unique<WorkerPool>(workers);
+  else
+    this->pool.reset();
+
+  // Room for the largest block and a generous number of voices, so that
+  // fillBuffer() doesn't have to allocate (see alloccheck.hpp)
+  const int frames =
+      std::max(static_cast<int>(Config::instance().getBufferSize()), 2048);
+  const int maxVoices = 128 + SEQUENCER_VOICES;
+  this->notesPressed.reserve(maxVoices);
+  this->voices.reserve(maxVoices);
+  if (this->sequencerVoices.empty()) {
+    this->sequencerVoices.reserve(SEQUENCER_VOICES);
+    for (int v = 0; v < SEQUENCER_VOICES; v++) {
+      this->sequencerVoices.emplace_back("sequencer" + std::to_string(v),
+                                         NotePress{});
+      this->sequencerVoices.back().second.finished = true;
+    }
+  }
+  // The sequencer starts its voices on the audio thread
+  for (auto &kv : this->sequencerVoices) {
+    kv.second.sampleSlots.reserve(this->synth.size());
+    kv.second.phases.reserve(this->synth.size() * GLIDE_PIPES);
+  }
+  this->busLeft.resize(frames);
+  this->busRight.resize(frames);
+  this->busMid.resize(frames);
+  if (this->pool) {
+    this->voiceScratch.resize(static_cast<std::size_t>(frames) * 2 *
+                              maxVoices);
+    this->voiceDone.resize(maxVoices);
+  }
+  this->fadeLength = std::max(sampleRate * SWAP_FADE_MS / 1000, 1);
+  this->configureChorus();
+  this->publishConfig();
+}
+
+void KeyboardStream::teardown() {
+  {
+    std::lock_guard<std::mutex> guard(this->swapMtx);
+    this->swapRunning = false;
+  }
+  this->swapWake.notify_all();
+  this->swapDone.notify_all();
+  if (this->swapThread.joinable())
+    this->swapThread.join();
+}
+
+void KeyboardStream::swapSynth(SynthEdit edit) {
+  std::lock_guard<std::mutex> guard(this->swapMtx);
+  this->swapEdits.push_back(std::move(edit));
+  this->swapsQueued++;
+  if (!this->swapRunning) {
+    if (this->swapThread.joinable())
+      this->swapThread.join();
+    this->swapRunning = true;
+    this->swapThread = std::thread(&KeyboardStream::swapLoop, this);
+  }
+  this->swapWake.notify_all();
+}
+
+void KeyboardStream::editSynth(const SynthEdit &edit) {
+  edit(this->synth);
+  if (this->swapBuilding)
+    this->liveEdits.push_back(edit);
+}
+
+void KeyboardStream::waitForSwaps() {
+  std::unique_lock<std::mutex> swapLock(this->swapMtx);
+  const std::uint64_t queued = this->swapsQueued;
+  this->swapDone.wait(swapLock, [&] {
+    return !this->swapRunning || this->swapsInstalled >= queued;
+  });
+}
+
+// --- Swap thread ---
+void KeyboardStream::swapLoop() {
+  std::unique_lock<std::mutex> swapLock(this->swapMtx);
+  while (true) {
+    this->swapWake.wait(swapLock, [this] {
+      return !this->swapRunning || !this->swapEdits.empty();
+    });
+    if (!this->swapRunning)
+      break;
+    SynthEdit edit = std::move(this->swapEdits.front());
+    this->swapEdits.pop_front();
+    swapLock.unlock();
+
+    // The settings are copied and edited under the lock, the ranks are
+    // built without it
+    std::vector<Oscillator> bank;
+    this->lock();
+    bank.reserve(this->synth.size());
+    for (const Oscillator &oscillator : this->synth)
+      bank.push_back(oscillator.unbuilt());
+    edit(bank);
+    this->liveEdits.clear();
+    this->swapBuilding = true;
+    this->unlock();
+    for (Oscillator &oscillator : bank)
+      oscillator.initialize();
+
+    this->installSynth(bank);
+    swapLock.lock();
+    this->swapsInstalled++;
+    this->swapDone.notify_all();
+  }
+}
+
+// Installs 'bank' and waits for the old oscillators to fade out, they are
+// left in 'bank' to be freed here rather than on the audio thread
+void KeyboardStream::installSynth(std::vector<Oscillator> &bank) {
+  std::unique_lock<std::mutex> lock(this->mtx);
+  // What was changed in place meanwhile, it would be undone otherwise
+  for (const SynthEdit &edit : this->liveEdits)
+    edit(bank);
+  this->liveEdits.clear();
+  this->swapBuilding = false;
+  std::swap(this->synth, bank);
+  std::swap(this->fadingSynth, bank);
+  this->fadeQueued = true;
+  // Gliding voices get pipe phases for any oscillators added, the others
+  // room for them
+  for (auto &kv : this->notesPressed) {
+    NotePress &np = kv.second;
+    if (np.rankPitch >= 0)
+      np.phases.resize(this->synth.size() * GLIDE_PIPES, 0.0f);
+    else
+      np.phases.reserve(this->synth.size() * GLIDE_PIPES);
+  }
+  for (auto &kv : this->sequencerVoices) {
+    kv.second.sampleSlots.reserve(this->synth.size());
+    kv.second.phases.reserve(this->synth.size() * GLIDE_PIPES);
+  }
+
+  // Without audio running there is nothing to fade, so it isn't waited for
+  // for long
+  this->fadeDone.wait_for(
+      lock, std::chrono::milliseconds(10 * SWAP_FADE_MS),
+      [this] { return !this->fadeQueued && !this->fading; });
+  this->fadeQueued = false;
+  this->fading = false;
+  std::swap(this->fadingSynth, bank);
+  lock.unlock();
+  bank.clear();
 }
 
 void KeyboardStream::setupStandardSynthConfig() {
   this->synth.reserve(4);
   for (int i = 0; i < 4; i++) {
-    this->synth.emplace_back(SAMPLERATE, this->tuning);
+    this->synth.emplace_back(this->sampleRate, this->tuning);
   }
   for (int i = 0; i < 4; i++) {
     this->synth[i].setVolume(i == 0 ? 0.5 : 0);
     this->synth[i].setEffects(this->effects);
-    this->synth[i].setLegato(this->legatoMode, this->legatoSpeed);
   }
 }
 
-void KeyboardStream::registerNote(const std::string &note) {
-  // Always create a fresh note entry
-  NotePress np;
+void KeyboardStream::startNote(NotePress &np, const std::string &note,
+                               int velocity) {
   np.time = KeyboardStream::currentTimeMillis();
   np.note = note;
+  np.pitch = notes::getNoteIndex(note);
   np.adsr = this->adsr;
-  np.frequency = notes::getFrequency(note, this->tuning);
+  np.frequency = notes::getFrequency(np.pitch, this->tuning);
+  np.phase = 0;
   np.index = 0;
+  np.rankIndex = 0;
   np.release = false;
+  np.finished = false;
+  np.velocity = velocity;
+  np.velocityGain = static_cast<float>(velocity) / 127.0f;
+  np.rankPitch = -1;
+  // Room to glide, for the pitch bend (see bendVoice())
+  np.phases.reserve(this->synth.size() * GLIDE_PIPES);
+
+  // Resolve the velocity layer and round-robin sample of every oscillator
+  // once, here, so that rendering the note is a plain index into each
+  // oscillator's sample bank
+  np.sampleSlots.assign(this->synth.size(), -1);
+  for (std::size_t o = 0; o < this->synth.size(); o++) {
+    if (this->synth[o].hasSamples())
+      np.sampleSlots[o] = this->synth[o].pickSample(note, velocity);
+  }
+}
 
-  if (this->legatoMode) {
-    std::string legatoNote = "C4";
-    auto it = this->notesPressed.find(legatoNote);
+void KeyboardStream::registerNote(const std::string &note, int velocity,
+                                  std::uint64_t at) {
+  velocity = std::clamp(velocity, 1, 127);
 
-    if (it == this->notesPressed.end()) {
-      this->resetLegato();
-      this->notesPressed[legatoNote] = np;
-    } else {
-      it->second.frequency = np.frequency;
-      if (it->second.note == note) {
-        it->second.index = 0; // this->adsr.get_decay_start_index();
-      }
-      it->second.note = note;
-    }
-  } else {
-    auto it = this->notesPressed.find(note);
+  if (this->sequencer.capturesInput()) {
+    this->sequencer.hold(notes::getNoteIndex(note), velocity);
+    return;
+  }
 
-    if (it != this->notesPressed.end()) {
-      // Note already exists – create a new entry with release = true
-      NotePress releasedNote;
-      releasedNote = it->second;
-      releasedNote.release = true;
-      releasedNote.phase = 0;
-      releasedNote.time = KeyboardStream::currentTimeMillis();
-      std::string newKey = note + "--" + std::to_string(releasedNote.time);
-      this->notesPressed[newKey] = releasedNote;
+  // Always create a fresh note entry
+  NotePress np;
+  this->startNote(np, note, velocity);
+  np.startFrame = at;
+
+  // Held by the key again, letting go of the pedal won't release it
+  this->sustainedNotes.erase(std::remove(this->sustainedNotes.begin(),
+                                         this->sustainedNotes.end(), note),
+                             this->sustainedNotes.end());
+
+  this->reapFinishedNotes();
+
+  if (this->legatoMode) {
+    np.rankPitch = np.pitch;
+    np.phases.assign(this->synth.size() * GLIDE_PIPES, 0.0f);
+    if (this->glideMode != glide::Mode::Poly) {
+      this->registerMonoNote(np);
+      return;
     }
+    // A poly voice starts at the pitch played last and slides to its own.
+    // It stays silent if glideTo() can't place the key.
+    np.slew.jump(0.0f);
+    if (this->glideFrom > 0 && np.pitch >= notes::LOWEST_NOTE)
+      np.slew.jump(static_cast<float>(this->glideFrom /
+                                      notes::frequenciesEqual[np.pitch]));
+    this->glideTo(np, np.pitch);
+  }
 
-    this->notesPressed[note] = np;
+  auto it = this->notesPressed.find(note);
+
+  if (it != this->notesPressed.end()) {
+    // Note already exists – create a new entry with release = true
+    // Moved, copies would lose the room reserved for bending it
+    NotePress releasedNote;
+    releasedNote = std::move(it->second);
+    releasedNote.release = at == 0;
+    releasedNote.releaseFrame = at;
+    releasedNote.phase = 0;
+    releasedNote.time = KeyboardStream::currentTimeMillis();
+    std::string newKey = note + "--" + std::to_string(releasedNote.time);
+    this->notesPressed[newKey] = std::move(releasedNote);
   }
+
+  this->notesPressed[note] = std::move(np);
 }
 
-void KeyboardStream::registerNoteRelease(const std::string &note) {
-  if (this->legatoMode) {
-    for (auto it = notesPressed.begin(); it != notesPressed.end(); it++) {
-      it->second.release = true;
+// The single voice of the mono glide modes. It sounds the held key that
+// the mode picks and retriggers only when no key was held before.
+void KeyboardStream::registerMonoNote(NotePress &np) {
+  if (np.pitch < 0)
+    return;
+  const bool legato = !this->heldNotes.empty();
+  this->heldNotes.push(np.pitch);
+  const int pitch = this->heldNotes.pick(this->glideMode);
+
+  auto it = this->notesPressed.find(MONO_VOICE);
+  if (it != this->notesPressed.end() && !legato) {
+    // Let the previous phrase ring out on a voice of its own
+    NotePress released = it->second;
+    released.release = true;
+    released.time = KeyboardStream::currentTimeMillis();
+    this->notesPressed[std::string(MONO_VOICE) + "--" +
+                       std::to_string(released.time)] = released;
+    this->notesPressed.erase(MONO_VOICE);
+    it = this->notesPressed.end();
+  }
+
+  if (it == this->notesPressed.end()) {
+    // No glide into the first note of a phrase
+    np.rankPitch = pitch;
+    np.slew.jump(0.0f);
+    this->glideTo(np, pitch);
+    this->notesPressed[MONO_VOICE] = np;
+    return;
+  }
+
+  NotePress &voice = it->second;
+  voice.velocity = np.velocity;
+  voice.velocityGain = np.velocityGain;
+  voice.sampleSlots.swap(np.sampleSlots);
+  this->glideTo(voice, pitch);
+}
+
+void KeyboardStream::registerMonoRelease(const std::string &note) {
+  this->heldNotes.remove(notes::getNoteIndex(note));
+  auto it = this->notesPressed.find(MONO_VOICE);
+  if (it == this->notesPressed.end())
+    return;
+
+  // Back to the key still held, if any
+  const int pitch = this->heldNotes.pick(this->glideMode);
+  if (pitch < 0)
+    it->second.release = true;
+  else
+    this->glideTo(it->second, pitch);
+}
+
+void KeyboardStream::glideTo(NotePress &voice, int pitch) {
+  const double rankFrequency = notes::getFrequency(
+      voice.rankPitch, notes::TuningSystem::EqualTemperament);
+  const double frequency = notes::getFrequency(pitch, this->tuning);
+  // Out of range, or a key the tuning leaves unmapped
+  if (rankFrequency <= 0 || frequency <= 0)
+    return;
+
+  const int samples =
+      static_cast<int>(this->legatoSpeed * 0.001f * this->sampleRate);
+  voice.slew.retarget(static_cast<float>(frequency / rankFrequency), samples,
+                      this->glideCurve);
+  voice.pitch = pitch;
+  voice.note = notes::getNoteName(pitch);
+  voice.frequency = frequency;
+  this->glideFrom = frequency;
+}
+
+// A voice rendered by rank index plays at a fixed pitch. Bending it turns it
+// into a gliding voice on its own rank, with the pipe phases where the index
+// left them so that the wave carries on unbroken. Audio thread, the phases
+// were reserved when the note started.
+void KeyboardStream::bendVoice(NotePress &note) {
+  const std::size_t count = this->synth.size() * GLIDE_PIPES;
+  const double rankFrequency = notes::getFrequency(
+      note.pitch, notes::TuningSystem::EqualTemperament);
+  if (note.phases.capacity() < count || rankFrequency <= 0 ||
+      note.frequency <= 0)
+    return;
+
+  // A glide frame advances the phases before it renders, so they start at
+  // the frame before
+  note.phases.assign(count, 0.0f);
+  for (std::size_t o = 0; o < this->synth.size(); o++)
+    this->synth[o].glidePhases(note.pitch, note.rankIndex - 1,
+                               &note.phases[o * GLIDE_PIPES], GLIDE_PIPES);
+  note.slew.jump(static_cast<float>(note.frequency / rankFrequency));
+  note.rankPitch = note.pitch;
+}
+
+void KeyboardStream::reapFinishedNotes() {
+  for (auto it = notesPressed.begin(); it != notesPressed.end();) {
+    if (it->second.finished) {
+      it = notesPressed.erase(it);
+    } else {
+      ++it;
     }
+  }
+}
+
+void KeyboardStream::registerNoteRelease(const std::string &note,
+                                         std::uint64_t at) {
+  // Keys pressed before the arpeggiator took over still sound, so the
+  // release goes to both
+  if (this->sequencer.capturesInput())
+    this->sequencer.release(notes::getNoteIndex(note));
+
+  if (this->sustainPedal) {
+    if (std::find(this->sustainedNotes.begin(), this->sustainedNotes.end(),
+                  note) == this->sustainedNotes.end())
+      this->sustainedNotes.push_back(note);
+    return;
+  }
+
+  this->reapFinishedNotes();
+  if (this->legatoMode && this->glideMode != glide::Mode::Poly) {
+    this->registerMonoRelease(note);
   } else {
     auto it = this->notesPressed.find(note);
     if (it != this->notesPressed.end()) {
-      it->second.release = true;
+      if (at == 0)
+        it->second.release = true;
+      else
+        it->second.releaseFrame = at;
     }
   }
 }
 
+std::uint64_t KeyboardStream::toAudioFrame(
+    std::chrono::steady_clock::time_point time) const {
+  // Nothing played yet, nothing to line up with
+  if (this->blockLength == 0)
+    return 0;
+  const std::uint64_t next = this->blockStart + this->blockLength;
+  const double elapsed =
+      std::chrono::duration<double>(time - this->blockTime).count();
+  if (elapsed <= 0.0)
+    return next;
+  // Within the next block, a late callback doesn't hold notes back further
+  const auto offset = static_cast<std::uint64_t>(elapsed * this->sampleRate);
+  return next + std::min<std::uint64_t>(offset, this->blockLength - 1);
+}
+
+void KeyboardStream::setSustain(bool down) {
+  this->sustainPedal = down;
+  if (down)
+    return;
+  std::vector<std::string> sustained;
+  sustained.swap(this->sustainedNotes);
+  for (const std::string &note : sustained)
+    this->registerNoteRelease(note);
+}
+
+void KeyboardStream::releaseAll() {
+  this->sustainedNotes.clear();
+  this->heldNotes.clear();
+  for (auto &kv : this->notesPressed)
+    kv.second.release = true;
+}
+
+void KeyboardStream::applyMidiEvent(const MidiInput::Event &event) {
+  using Type = MidiInput::Event::Type;
+  const bool note = event.type == Type::NoteOn || event.type == Type::NoteOff;
+  if (note &&
+      (event.data1 < notes::LOWEST_NOTE || event.data1 > notes::HIGHEST_NOTE))
+    return;
+
+  switch (event.type) {
+  case Type::NoteOn:
+    this->registerNote(notes::getNoteName(event.data1), event.data2,
+                       this->toAudioFrame(event.time));
+    break;
+  case Type::NoteOff:
+    this->registerNoteRelease(notes::getNoteName(event.data1),
+                              this->toAudioFrame(event.time));
+    break;
+  case Type::PitchBend:
+    this->setPitchBend(2.0f * static_cast<float>(event.data1) / 8192.0f);
+    break;
+  case Type::Control:
+    if (event.data1 == 64)
+      this->setSustain(event.data2 >= 64);
+    else if (event.data1 == 120 || event.data1 == 123)
+      this->releaseAll();
+    break;
+  }
+}
+
+nlohmann::json KeyboardStream::configToJson() const {
+  const EchoEffect<float> *echo = nullptr;
+  const Effect<float>::VibratoConfig *vibrato = nullptr;
+  const Effect<float>::TremoloConfig *tremolo = nullptr;
+  const Piper<float> *reverb = nullptr;
+  const Effect<float>::PhaseDistortionSinConfig *phaseDist = nullptr;
+  const Effect<float>::GainDistHardClipConfig *gainDist = nullptr;
+  for (const Effect<float> &effect : this->effects) {
+    if (auto *e = std::get_if<EchoEffect<float>>(&effect.config))
+      echo = e;
+    if (auto *e = std::get_if<Effect<float>::VibratoConfig>(&effect.config))
+      vibrato = e;
+    if (auto *e = std::get_if<Effect<float>::TremoloConfig>(&effect.config))
+      tremolo = e;
+    if (auto *e = std::get_if<Piper<float>>(&effect.config))
+      reverb = e;
+    if (auto *e = std::get_if<Effect<float>::PhaseDistortionSinConfig>(
+            &effect.config))
+      phaseDist = e;
+    if (auto *e = std::get_if<Effect<float>::GainDistHardClipConfig>(
+            &effect.config))
+      gainDist = e;
+  }
+  // Null until all the effects the panel shows are set up
+  if (!echo || !vibrato || !tremolo || !reverb || !phaseDist || !gainDist)
+    return nullptr;
+
+  return {{"gain", this->gain},
+          {"adsr",
+           {{"attack", this->adsr.qadsr[0]},
+            {"decay", this->adsr.qadsr[1]},
+            {"sustain", this->adsr.qadsr[2]},
+            {"release", this->adsr.qadsr[3]}}},
+          {"tuning", notes::tuning_to_string(this->tuning)},
+          {"echo",
+           {{"rate", echo->getRate()},
+            {"feedback", echo->getFeedback()},
+            {"mix", echo->getMix()},
+            {"sampleRate", echo->getSampleRate()}}},
+          {"phaseDist", {{"depth", phaseDist->depth}}},
+          {"gainDist", {{"gain", gainDist->gain}}},
+          {"tremolo",
+           {{"depth", tremolo->depth}, {"frequency", tremolo->frequency}}},
+          {"reverb", {{"dry", reverb->mix[1]}, {"wet", reverb->mix[0]}}},
+          {"vibrato",
+           {{"depth", vibrato->depth}, {"frequency", vibrato->frequency}}},
+          {"highpass", this->effects[0].iirs[0].presentable},
+          {"lowpass", this->effects[0].iirs[1].presentable}};
+}
+
+void KeyboardStream::publishConfig() {
+  auto current = std::atomic_load(&this->configSnapshot);
+  auto snapshot = std::make_shared<ConfigSnapshot>();
+  snapshot->version = current->version + 1;
+  snapshot->config = this->configToJson();
+  snapshot->body = snapshot->config.dump();
+  std::atomic_store(&this->configSnapshot,
+                    std::shared_ptr<const ConfigSnapshot>(std::move(snapshot)));
+}
+
 void KeyboardStream::registerButtonPress(int pressed) {
   if (this->keyPressToNote.find(pressed) != this->keyPressToNote.end()) {
     std::string note = this->keyPressToNote[pressed];
@@ -186,73 +623,342 @@ void KeyboardStream::registerButtonRelease(int pressed) {
   }
 }
 
-void KeyboardStream::fillBuffer(float *buffer, const int len) {
-  float deltaT = 1.0f / this->sampleRate;
+// Writes planar left/right into an interleaved buffer of 'channels' channels.
+// Channels past the second are left silent.
+static void interleave(const float *left, const float *right, float *out,
+                       int frames, int channels) {
+  if (channels == 1) {
+    std::copy(left, left + frames, out);
+    return;
+  }
+  int f = 0;
+  if (channels == 2) {
+#if defined(KEYBOARD_SSE)
+    for (; f + 4 <= frames; f += 4) {
+      __m128 l = _mm_loadu_ps(left + f);
+      __m128 r = _mm_loadu_ps(right + f);
+      _mm_storeu_ps(out + 2 * f, _mm_unpacklo_ps(l, r));
+      _mm_storeu_ps(out + 2 * f + 4, _mm_unpackhi_ps(l, r));
+    }
+#elif defined(KEYBOARD_NEON)
+    for (; f + 4 <= frames; f += 4) {
+      float32x4x2_t lr = {vld1q_f32(left + f), vld1q_f32(right + f)};
+      vst2q_f32(out + 2 * f, lr);
+    }
+#endif
+  }
+  for (; f < frames; f++) {
+    float *frame = out + static_cast<std::size_t>(f) * channels;
+    frame[0] = left[f];
+    frame[1] = right[f];
+    for (int c = 2; c < channels; c++)
+      frame[c] = 0.0f;
+  }
+}
 
-  // auto start = std::chrono::high_resolution_clock::now();
+void KeyboardStream::renderVoiceJob(void *context, int index) {
+  alloccheck::AudioThreadScope audioThread;
+  auto *self = static_cast<KeyboardStream *>(context);
+  const int frames = self->blockFrames;
+  float *left = &self->voiceScratch[static_cast<std::size_t>(frames) * 2 *
+                                    index];
+  float *right = left + frames;
+  std::fill_n(left, frames * 2, 0.0f);
+
+  auto &voice = *self->voices[index];
+  self->voiceDone[index] = self->renderVoice(voice.second, left, right, frames);
+}
 
-  // if (notesPressed.size() == 0)
-  //   return;
+// Adds one note's output for the block to left/right, returns true once the
+// note has finished its envelope
+bool KeyboardStream::renderVoice(NotePress &note, float *left, float *right,
+                                 int frames) {
+  const float deltaT = 1.0f / this->sampleRate;
+  const std::uint64_t start = this->renderStart;
+
+  // Notes played at a given frame wait for it, and are let go at theirs
+  int first = 0;
+  if (note.startFrame > start) {
+    if (note.startFrame - start >= static_cast<std::uint64_t>(frames))
+      return false;
+    first = static_cast<int>(note.startFrame - start);
+  }
+  if (note.releaseFrame != 0 && note.releaseFrame <= start + first) {
+    note.release = true;
+    note.releaseFrame = 0;
+  }
+  int releaseAt = -1;
+  if (note.releaseFrame != 0 &&
+      note.releaseFrame - start < static_cast<std::uint64_t>(frames)) {
+    releaseAt = static_cast<int>(note.releaseFrame - start);
+    note.releaseFrame = 0;
+  }
 
-  // Add samples to YIN calc
-  // this->yin.addSamples(buffer, len);
+  for (int i = first; i < frames; i++) {
+    if (i == releaseAt)
+      note.release = true;
+    int index = note.index;
+    float adsr;
+    double freq = note.frequency;
 
-  for (int i = 0; i < len; i++) {
-    float sample = 0.0f;
-    buffer[i] = 0;
-
-    for (auto it = notesPressed.begin(); it != notesPressed.end();) {
-      NotePress &note = it->second;
-      int index = note.index;
-      float adsr;
-      double freq = note.frequency;
-
-      // Use ADSR envelope
-      if (note.adsr.reached_sustain(index) && !note.release) {
-        adsr = static_cast<float>(note.adsr.sustain());
-      } else {
-        adsr = static_cast<float>(note.adsr.response(index));
-        note.index++;
+    // Use ADSR envelope
+    if (note.adsr.reached_sustain(index) && !note.release) {
+      adsr = static_cast<float>(note.adsr.sustain());
+    } else {
+      adsr = static_cast<float>(note.adsr.response(index));
+      note.index++;
+    }
+
+    float l, r;
+    if (note.rankPitch < 0 && this->pitchBend != 1.0f)
+      this->bendVoice(note);
+    if (note.rankPitch >= 0) {
+      generateGlideFrame(note, note.slew.next() * this->pitchBend, l, r);
+    } else {
+      generateFrame(note.pitch, note.rankIndex, note.sampleSlots, l, r);
+      // Equal power crossfade from the oscillators swapped out. Gliding
+      // voices keep one set of pipe phases, they switch over at once.
+      const std::uint64_t at = start + i;
+      if (this->fading && at >= this->fadeStart &&
+          at - this->fadeStart < static_cast<std::uint64_t>(this->fadeLength)) {
+        const float x = static_cast<float>(M_PI / 2) *
+                        static_cast<float>(at - this->fadeStart) /
+                        static_cast<float>(this->fadeLength);
+        float oldLeft, oldRight;
+        generateFrame(this->fadingSynth, note.pitch, note.rankIndex,
+                      note.sampleSlots, oldLeft, oldRight);
+        l = std::sin(x) * l + std::cos(x) * oldLeft;
+        r = std::sin(x) * r + std::cos(x) * oldRight;
       }
+    }
+    note.rankIndex++;
+    const float level = adsr * note.velocityGain;
+    left[i] += level * l;
+    right[i] += level * r;
+
+    // Advance phase
+    note.phase += 2.0f * M_PI * freq * deltaT;
+    if (note.phase > 2.0f * M_PI)
+      note.phase -= 2.0f * M_PI;
+
+    if (note.index >= note.adsr.getLength())
+      return true;
+  }
+  return false;
+}
 
-      if (this->legatoMode) {
-        if (it->first.find("--") == std::string::npos) {
-          sample += adsr * generateSample(note.note, note.phase,
-                                          this->legatoRankIndex);
-          this->legatoRankIndex++;
-        }
-      } else {
-        sample += adsr * generateSample(note.note, note.phase, note.rankIndex);
-        note.rankIndex++;
+// Sizes the stereo chorus after the chorus effect, if there is one. Only
+// allocates when the chorus settings have changed.
+const Effect<float>::ChorusConfig *KeyboardStream::configureChorus() {
+  const Effect<float>::ChorusConfig *chorusConfig = nullptr;
+  for (auto &effect : this->effects) {
+    if (auto conf = Effect<float>::getIf<Effect<float>::ChorusConfig>(
+            effect.config)) {
+      chorusConfig = conf;
+    }
+  }
+  if (chorusConfig && this->channels > 1) {
+    this->chorus.configure(chorusConfig->delay, chorusConfig->depth,
+                           chorusConfig->numVoices,
+                           static_cast<float>(this->sampleRate));
+  }
+  return chorusConfig;
+}
+
+// Adds every sounding voice to 'frames' frames of left/right
+void KeyboardStream::renderVoices(float *left, float *right, int frames,
+                                  std::uint64_t start) {
+  this->renderStart = start;
+  this->voices.clear();
+  for (auto &kv : notesPressed) {
+    if (!kv.second.finished)
+      this->voices.push_back(&kv);
+  }
+  for (auto &kv : sequencerVoices) {
+    if (!kv.second.finished)
+      this->voices.push_back(&kv);
+  }
+  const int numVoices = static_cast<int>(this->voices.size());
+
+  if (!this->pool || numVoices < 2) {
+    for (auto *voice : this->voices) {
+      voice->second.finished = renderVoice(voice->second, left, right, frames);
+    }
+  } else {
+    const std::size_t lane = static_cast<std::size_t>(frames) * 2;
+    if (this->voiceScratch.size() < lane * numVoices)
+      this->voiceScratch.resize(lane * numVoices);
+    if (static_cast<int>(this->voiceDone.size()) < numVoices)
+      this->voiceDone.resize(numVoices);
+    this->blockFrames = frames;
+
+    this->pool->run(numVoices, &KeyboardStream::renderVoiceJob, this);
+
+    // Deterministic reduction, always in voice order
+    for (int v = 0; v < numVoices; v++) {
+      const float *laneLeft = &this->voiceScratch[lane * v];
+      const float *laneRight = laneLeft + frames;
+      for (int i = 0; i < frames; i++) {
+        left[i] += laneLeft[i];
+        right[i] += laneRight[i];
       }
+    }
+    for (int v = 0; v < numVoices; v++)
+      this->voices[v]->second.finished = this->voiceDone[v];
+  }
+}
+
+// Starts or releases a note on the sequencer's voices. A note on takes a
+// voice that has finished, or the next one round robin when all sound.
+void KeyboardStream::applySequencerEvent(const Sequencer::Event &event) {
+  if (this->sequencerVoices.empty())
+    return;
+
+  if (!event.on) {
+    for (auto &kv : this->sequencerVoices) {
+      NotePress &voice = kv.second;
+      if (!voice.finished && (event.pitch < 0 || voice.pitch == event.pitch))
+        voice.release = true;
+    }
+    return;
+  }
+
+  const int count = static_cast<int>(this->sequencerVoices.size());
+  int chosen = -1;
+  for (int v = 0; v < count && chosen < 0; v++) {
+    const int candidate = (this->nextSequencerVoice + v) % count;
+    if (this->sequencerVoices[candidate].second.finished)
+      chosen = candidate;
+  }
+  if (chosen < 0)
+    chosen = this->nextSequencerVoice;
+  this->nextSequencerVoice = (chosen + 1) % count;
+
+  NotePress &voice = this->sequencerVoices[chosen].second;
+  this->startNote(voice, notes::getNoteName(event.pitch),
+                  std::clamp(event.velocity, 1, 127));
+}
 
-      // Advance phase
-      note.phase += 2.0f * M_PI * freq * deltaT;
-      if (note.phase > 2.0f * M_PI)
-        note.phase -= 2.0f * M_PI;
+void KeyboardStream::fillBuffer(float *buffer, const int len) {
+  alloccheck::AudioThreadScope audioThread;
+  const int channels = std::max(this->channels, 1);
+  const int frames = len / channels;
+
+  if (static_cast<int>(this->busLeft.size()) < frames) {
+    this->busLeft.resize(frames);
+    this->busRight.resize(frames);
+    this->busMid.resize(frames);
+  }
+  float *left = this->busLeft.data();
+  float *right = this->busRight.data();
+  std::fill_n(left, frames, 0.0f);
+  std::fill_n(right, frames, 0.0f);
+  this->transport.beginBlock(frames);
+  this->blockStart = this->transport.blockSample();
+  this->blockLength = frames;
+  this->blockTime = std::chrono::steady_clock::now();
+
+  // Add samples to YIN calc
+  // this->yin.addSamples(buffer, len);
+
+  this->sequencer.beginBlock(this->transport);
+
+  // A bank installed since the last block fades in from this one on
+  if (this->fadeQueued) {
+    this->fadeQueued = false;
+    this->fading = true;
+    this->fadeStart = this->blockStart;
+  }
+
+  for (Oscillator &oscillator : this->synth)
+    oscillator.beginBlock();
+  if (this->fading) {
+    for (Oscillator &oscillator : this->fadingSynth)
+      oscillator.beginBlock();
+  }
+
+  // Rendered in pieces split at the sequencer's events, so that its notes
+  // start and stop on their exact frame
+  int done = 0;
+  for (int e = 0; e <= this->sequencer.numEvents(); e++) {
+    const bool last = e == this->sequencer.numEvents();
+    const int end = last ? frames
+                         : std::min(this->sequencer.event(e).offset, frames);
+    if (end > done) {
+      this->renderVoices(left + done, right + done, end - done,
+                         this->blockStart + done);
+      done = end;
+    }
+    if (!last)
+      this->applySequencerEvent(this->sequencer.event(e));
+  }
+
+  for (Oscillator &oscillator : this->synth)
+    oscillator.endBlock();
+  if (this->fading) {
+    for (Oscillator &oscillator : this->fadingSynth)
+      oscillator.endBlock();
+    if (this->blockStart + frames >= this->fadeStart + this->fadeLength) {
+      this->fading = false;
+      this->fadeDone.notify_all();
+    }
+  }
 
-      // Remove if done
-      if (note.index >= note.adsr.getLength()) {
-        it = notesPressed.erase(it);
-      } else {
-        ++it;
+  const Effect<float>::ChorusConfig *chorusConfig = this->configureChorus();
+
+  for (int i = 0; i < frames; i++) {
+    if (channels == 1) {
+      float entry = 0.5f * (left[i] + right[i]) * this->gain;
+      // Apply global post effects
+      entry = Sound::applyPostEffects(entry, this->effects);
+      // Apply global iir filters
+      for (std::size_t e = 0; e < this->effects.size(); e++) {
+        for (std::size_t k = 0; k < this->effects[e].iirs.size(); k++) {
+          entry = this->effects[e].iirs[k].process(entry);
+        }
       }
+      left[i] = entry;
+      continue;
     }
 
-    // Output sample
-    float entry = sample * this->gain;
+    float l = left[i] * this->gain;
+    float r = right[i] * this->gain;
+    if (chorusConfig) {
+      this->chorus.process(l, r);
+    }
     // Apply global post effects
-    entry = Sound::applyPostEffects(entry, this->effects);
+    Sound::applyPostEffectsStereo(l, r, this->effects);
     // Apply global iir filters
-    for (int e = 0; e < this->effects.size(); e++) {
-      for (int i = 0; i < this->effects[e].iirs.size(); i++) {
-        entry = this->effects[e].iirs[i].process(entry);
+    for (std::size_t e = 0; e < this->effects.size(); e++) {
+      for (std::size_t k = 0; k < this->effects[e].iirs.size(); k++) {
+        l = this->effects[e].iirs[k].process(l);
+        r = this->effects[e].iirs[k].processRight(r);
       }
     }
-    // Write to buffer
-    buffer[i] += this->looper.update(entry);
+    left[i] = l;
+    right[i] = r;
+  }
+
+  if (channels == 1) {
+    this->looper.process(left, frames);
+  } else {
+    // The looper records and plays back the mid signal
+    float *mid = this->busMid.data();
+    for (int i = 0; i < frames; i++)
+      mid[i] = 0.5f * (left[i] + right[i]);
+    this->looper.process(mid, frames);
+    for (int i = 0; i < frames; i++) {
+      float looped = mid[i] - 0.5f * (left[i] + right[i]);
+      left[i] += looped;
+      right[i] += looped;
+    }
   }
 
+  this->analyzer.write(left, channels == 1 ? nullptr : right, frames);
+  this->transport.endBlock();
+  interleave(left, right, buffer, frames, channels);
+  this->networkSink.write(buffer, frames);
+
   /*
   float yinF = this->yin.getYinFrequency();
   if (yinF > 0) {
@@ -261,31 +967,65 @@ void KeyboardStream::fillBuffer(float *buffer, const int len) {
                .c_str());
   }
   */
-
-  // auto end = std::chrono::high_resolution_clock::now();
-  // std::chrono::duration<double, std::milli> duration = end - start;
-
-  // Optionally keep this if debugging:
-  // printw(" %f (%zu) -", duration.count(), notesPressed.size());
-  // refresh();
 }
 
-float KeyboardStream::generateSample(std::string note, float phase, int index) {
-  float result = 0;
-  float min = static_cast<float>(std::numeric_limits<short>::min());
-  float max = static_cast<float>(std::numeric_limits<short>::max());
+void KeyboardStream::generateFrame(int pitch, int index,
+                                   const std::vector<int> &sampleSlots,
+                                   float &left, float &right) {
+  this->generateFrame(this->synth, pitch, index, sampleSlots, left, right);
+}
 
-  for (Oscillator &oscillator : this->synth) {
+void KeyboardStream::generateFrame(std::vector<Oscillator> &bank, int pitch,
+                                   int index,
+                                   const std::vector<int> &sampleSlots,
+                                   float &left, float &right) {
+  const float min = static_cast<float>(std::numeric_limits<short>::min());
+  const float max = static_cast<float>(std::numeric_limits<short>::max());
+
+  left = 0;
+  right = 0;
+  for (std::size_t o = 0; o < bank.size(); o++) {
+    Oscillator &oscillator = bank[o];
     if (oscillator.volume == 0.0)
       continue;
-    result += oscillator.volume * oscillator.getSample(note, index);
+    // Oscillators added after the note started have no sample for it
+    const int sampleSlot = o < sampleSlots.size() ? sampleSlots[o] : -1;
+    float l, r;
+    oscillator.getFrame(pitch, index, sampleSlot, l, r);
+    left += oscillator.volume * l;
+    right += oscillator.volume * r;
   }
 
-  result =
-      std::clamp(result, static_cast<float>(std::numeric_limits<short>::min()),
-                 static_cast<float>(std::numeric_limits<short>::max()));
+  left = std::clamp(left, min, max);
+  right = std::clamp(right, min, max);
+}
+
+void KeyboardStream::generateGlideFrame(NotePress &note, float ratio,
+                                        float &left, float &right) {
+  const float min = static_cast<float>(std::numeric_limits<short>::min());
+  const float max = static_cast<float>(std::numeric_limits<short>::max());
+
+  left = 0;
+  right = 0;
+  for (std::size_t o = 0; o < this->synth.size(); o++) {
+    Oscillator &oscillator = this->synth[o];
+    const std::size_t offset = o * GLIDE_PIPES;
+    // Oscillators added after the note started stay quiet for it
+    if (offset + GLIDE_PIPES > note.phases.size())
+      break;
+    if (oscillator.volume == 0.0)
+      continue;
+    float l, r;
+    const int sampleSlot =
+        o < note.sampleSlots.size() ? note.sampleSlots[o] : -1;
+    oscillator.getGlideFrame(note.rankPitch, note.rankIndex, sampleSlot,
+                             ratio, &note.phases[offset], GLIDE_PIPES, l, r);
+    left += oscillator.volume * l;
+    right += oscillator.volume * r;
+  }
 
-  return result;
+  left = std::clamp(left, min, max);
+  right = std::clamp(right, min, max);
 }
 
 static void normalizeBuffer(std::vector<short> &buffer) {
@@ -307,39 +1047,128 @@ static void normalizeBuffer(std::vector<short> &buffer) {
 }
 
 void KeyboardStream::Oscillator::setSoundMap(
-    std::map<std::string, std::string> &soundMap, bool normalize) {
-  for (const auto &[key, value] : soundMap) {
-    std::cout << "Key: " << key << ", Value: " << value << std::endl;
+    std::map<std::string, std::vector<SampleLayer>> &soundMap, bool normalize) {
+  auto bank = std::make_shared<std::vector<SampleBuffer>>();
+  this->layerSlots.clear();
+  this->sampleZones.clear();
+
+  // Several notes may share a file, only load it once
+  std::map<std::string, int> loadedSlots;
+  auto loadSlot = [&](const std::string &file) -> int {
+    auto it = loadedSlots.find(file);
+    if (it != loadedSlots.end())
+      return it->second;
+
+    std::cout << "Loading: " << file << std::endl;
     int channels, wavSampleRate, bps, size;
     char *data;
+    if ((data = loadWAV(file, channels, wavSampleRate, bps, size)) == nullptr)
+      return -1;
 
-    if ((data = loadWAV(value, channels, wavSampleRate, bps, size)) !=
-        nullptr) {
-      if (channels == 2) {
-        std::vector<short> buffer_left_in, buffer_right_in;
-        splitChannels(data, size, buffer_left_in, buffer_right_in);
+    std::vector<short> samples;
+    if (channels == 2) {
+      std::vector<short> buffer_left_in, buffer_right_in;
+      splitChannels(data, size, buffer_left_in, buffer_right_in);
 
-        if (normalize) {
-          normalizeBuffer(buffer_left_in);
-          normalizeBuffer(buffer_right_in);
-        }
+      if (normalize) {
+        normalizeBuffer(buffer_left_in);
+        normalizeBuffer(buffer_right_in);
+      }
 
-        std::vector<short> interleaved;
-        interleaved.reserve(buffer_left_in.size() * 2);
-        for (size_t i = 0; i < buffer_left_in.size(); ++i) {
-          interleaved.push_back(buffer_left_in[i]);
-          interleaved.push_back(buffer_right_in[i]);
-        }
-        this->samples[key] = interleaved;
-      } else {
-        std::vector<short> buffer = convertToVector(data, size);
-        if (normalize) {
-          normalizeBuffer(buffer);
+      samples.reserve(buffer_left_in.size() * 2);
+      for (size_t i = 0; i < buffer_left_in.size(); ++i) {
+        samples.push_back(buffer_left_in[i]);
+        samples.push_back(buffer_right_in[i]);
+      }
+    } else {
+      samples = convertToVector(data, size);
+      if (normalize) {
+        normalizeBuffer(samples);
+      }
+    }
+    delete[] data;
+
+    if (wavSampleRate != this->sampleRate) {
+      std::cout << "Resampling: " << file << " (" << wavSampleRate << " -> "
+                << this->sampleRate << " Hz)" << std::endl;
+      samples = Resampler::convertCached(file, samples, channels,
+                                         wavSampleRate, this->sampleRate);
+    }
+
+    SampleBuffer buffer;
+    buffer.data = std::move(samples);
+    buffer.channels = channels == 2 ? 2 : 1;
+    bank->push_back(std::move(buffer));
+    int slot = static_cast<int>(bank->size()) - 1;
+    loadedSlots[file] = slot;
+    return slot;
+  };
+
+  for (auto &[key, layers] : soundMap) {
+    std::vector<SampleLayer> sorted = layers;
+    std::sort(sorted.begin(), sorted.end(),
+              [](const SampleLayer &a, const SampleLayer &b) {
+                return a.velocityLow < b.velocityLow;
+              });
+
+    SampleZone zone;
+    std::vector<std::pair<int, int>> ranges;
+    for (const SampleLayer &layer : sorted) {
+      if (zone.layers.size() >= 255)
+        break;
+
+      SampleZone::Layer l;
+      l.first = static_cast<int>(this->layerSlots.size());
+      for (const std::string &file : layer.files) {
+        int slot = loadSlot(file);
+        if (slot >= 0)
+          this->layerSlots.push_back(slot);
+      }
+      l.count = static_cast<int>(this->layerSlots.size()) - l.first;
+      if (l.count == 0)
+        continue;
+
+      zone.layers.push_back(l);
+      ranges.emplace_back(layer.velocityLow, layer.velocityHigh);
+    }
+    if (zone.layers.empty())
+      continue;
+
+    // Velocities outside every layer fall to the nearest one
+    for (int v = 0; v < 128; v++) {
+      int best = 0;
+      int bestDistance = 128;
+      for (size_t l = 0; l < ranges.size(); l++) {
+        int distance = 0;
+        if (v < ranges[l].first)
+          distance = ranges[l].first - v;
+        else if (v > ranges[l].second)
+          distance = v - ranges[l].second;
+        if (distance < bestDistance) {
+          bestDistance = distance;
+          best = static_cast<int>(l);
         }
-        this->samples[key] = buffer;
       }
+      zone.layerForVelocity[v] = static_cast<uint8_t>(best);
     }
+
+    this->sampleZones[key] = std::move(zone);
   }
+  this->sampleBank = std::move(bank);
+}
+
+int KeyboardStream::Oscillator::pickSample(const std::string &note,
+                                           int velocity) {
+  auto it = this->sampleZones.find(note);
+  if (it == this->sampleZones.end())
+    return -1;
+
+  SampleZone &zone = it->second;
+  SampleZone::Layer &layer =
+      zone.layers[zone.layerForVelocity[std::clamp(velocity, 0, 127)]];
+  int slot = this->layerSlots[layer.first + layer.next];
+  layer.next = (layer.next + 1) % layer.count;
+  return slot;
 }
 
 void KeyboardStream::Oscillator::setVolume(float volume) {
@@ -363,67 +1192,83 @@ void KeyboardStream::Oscillator::setSound(Sound::Rank<float>::Preset sound) {
   this->sound = sound;
 }
 
-float KeyboardStream::Oscillator::getSample(const std::string &note,
-                                            int index) {
+void KeyboardStream::Oscillator::getFrame(int pitch, int index,
+                                          int sampleSlot, float &left,
+                                          float &right) {
+  left = 0;
+  right = 0;
   // check if we are using wave samples
-  if (!this->samples.empty()) {
-    if (this->samples.find(note) != this->samples.end()) {
-      int indexMax = static_cast<int>(this->samples[note].size());
-      if (index < indexMax) {
-        float maxVal16 =
-            static_cast<float>(std::numeric_limits<int16_t>::max());
-        return static_cast<float>(this->samples[note][index]) / maxVal16;
+  if (this->hasSamples()) {
+    if (sampleSlot >= 0 &&
+        sampleSlot < static_cast<int>(this->sampleBank->size())) {
+      const SampleBuffer &samples = (*this->sampleBank)[sampleSlot];
+      const std::size_t offset =
+          static_cast<std::size_t>(index) * samples.channels;
+      if (offset + samples.channels <= samples.data.size()) {
+        const float scale =
+            1.0f / static_cast<float>(std::numeric_limits<int16_t>::max());
+        left = static_cast<float>(samples.data[offset]) * scale;
+        right = samples.channels == 2
+                    ? static_cast<float>(samples.data[offset + 1]) * scale
+                    : left;
       }
-      return 0.0;
     }
-    return 0.0;
+    return;
   }
-  // using raw synth
-  if (!this->initialized) {
-    this->initialize();
+  // using raw synth, the caller holds the rank lock (see beginBlock())
+  if (pitch >= notes::LOWEST_NOTE &&
+      pitch < static_cast<int>(this->ranks.size())) {
+    const float ratio = this->pitches->ratios[pitch];
+    // Zero for keys the tuning leaves unmapped
+    if (ratio > 0.0f)
+      this->ranks[pitch].generateRankFrameIndex(index, left, right, ratio);
   }
-  float result = 0;
-  std::lock_guard<std::mutex> lk(this->ranksMtx.mutex);
-  if (this->legatoMode && !this->legatoRank.has_value()) {
-    std::vector<Effect<float>> effectsClone(effects);
-    Note n{note, this->adsr.length, this->sampleRate, this->tuning};
+}
 
-    float freq = notes::getFrequency(note, this->tuning);
-    Sound::Rank<float> r = Sound::Rank<float>::fromPreset(
-        this->sound, freq, this->adsr.length, this->sampleRate);
-    r.adsr = adsr;
-    for (int e = 0; e < effectsClone.size(); e++) {
-      r.addEffect(effectsClone[e]);
-    }
+void KeyboardStream::Oscillator::glidePhases(int pitch, int index,
+                                             float *phases,
+                                             std::size_t count) {
+  if (this->hasSamples() || pitch < notes::LOWEST_NOTE ||
+      pitch >= static_cast<int>(this->ranks.size()))
+    return;
+  const float ratio = this->pitches->ratios[pitch];
+  if (ratio > 0.0f)
+    this->ranks[pitch].glidePhases(index, ratio, phases, count);
+}
 
-    this->legatoRank = std::move(r);
-  }
-  if (this->legatoRank.has_value()) {
-    float frequency = notes::getFrequency(note, this->tuning);
-    this->applyLegatoFrequency(frequency);
-    result = this->legatoRank->generateRankSampleIndex(index);
-  } else if (this->ranks.find(note) != this->ranks.end()) {
-    result = this->ranks[note].generateRankSampleIndex(index);
+void KeyboardStream::Oscillator::getGlideFrame(int pitch, int index,
+                                               int sampleSlot, float ratio,
+                                               float *phases,
+                                               std::size_t count, float &left,
+                                               float &right) {
+  // Samples play back as recorded
+  if (this->hasSamples()) {
+    this->getFrame(pitch, index, sampleSlot, left, right);
+    return;
   }
-  return result;
+  left = 0;
+  right = 0;
+  if (ratio > 0.0f && pitch >= notes::LOWEST_NOTE &&
+      pitch < static_cast<int>(this->ranks.size()))
+    this->ranks[pitch].generateRankFrameGlide(index, ratio, phases, count,
+                                              left, right);
 }
 
 void KeyboardStream::Oscillator::reset(const std::string &note) {
   std::lock_guard<std::mutex> lk(this->ranksMtx.mutex);
-  if (this->ranks.find(note) != this->ranks.end()) {
-    this->ranks[note].reset();
+  int pitch = notes::getNoteIndex(note);
+  if (pitch >= notes::LOWEST_NOTE &&
+      pitch < static_cast<int>(this->ranks.size())) {
+    this->ranks[pitch].reset();
   }
 }
 
 void KeyboardStream::Oscillator::initialize() {
-  auto notes = notes::getNotes(this->tuning);
-
   std::vector<Effect<float>> effectsClone(effects);
-  for (int i = 0; i < notes.size(); ++i) {
-    auto const &key = notes[i];
-    Note n{key, this->adsr.length, this->sampleRate, this->tuning};
-
-    float freq = notes::getFrequency(key, this->tuning);
+  this->ranks.clear();
+  this->ranks.resize(notes::NOTE_TABLE_SIZE);
+  for (int pitch = notes::LOWEST_NOTE; pitch <= notes::HIGHEST_NOTE; ++pitch) {
+    float freq = notes::frequenciesEqual[pitch];
     Sound::Rank<float> r = Sound::Rank<float>::fromPreset(
         this->sound, freq, this->adsr.length, this->sampleRate);
     r.adsr = adsr;
@@ -431,13 +1276,40 @@ void KeyboardStream::Oscillator::initialize() {
       r.addEffect(effectsClone[e]);
     }
 
-    { this->ranks[key] = std::move(r); }
+    this->ranks[pitch] = std::move(r);
   }
-
-  this->legatoRank = std::nullopt;
+  if (this->retuned)
+    this->applyFrequencies();
   this->initialized = true;
 }
 
+void KeyboardStream::Oscillator::applyFrequencies() {
+  for (Sound::Rank<float> &r : this->ranks) {
+    for (Sound::Pipe &pipe : r.pipes) {
+      Note &note = pipe.first;
+      note.frequencyAltered = note.frequency * 2 *
+                              pow(2, this->detune / 1200.0) * 2 *
+                              pow(2, this->octave);
+    }
+  }
+}
+
+KeyboardStream::Oscillator KeyboardStream::Oscillator::unbuilt() const {
+  Oscillator copy(Unbuilt{}, this->sampleRate, this->tuning);
+  copy.volume = this->volume;
+  copy.octave = this->octave;
+  copy.detune = this->detune;
+  copy.adsr = this->adsr;
+  copy.sound = this->sound;
+  copy.effects = this->effects;
+  copy.index = this->index;
+  copy.retuned = this->retuned;
+  copy.sampleBank = this->sampleBank;
+  copy.layerSlots = this->layerSlots;
+  copy.sampleZones = this->sampleZones;
+  return copy;
+}
+
 std::string KeyboardStream::Oscillator::printSynthConfig() const {
   std::ostringstream out;
 
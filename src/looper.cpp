@@ -1,9 +1,11 @@
 #include "looper.hpp"
 #include "config.hpp"
+#include "resampler.hpp"
 #include "sound.hpp"
 #include "waveread.hpp"
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 
 const float PI = 3.14159265358979323846f;
@@ -11,11 +13,6 @@ const float PI = 3.14159265358979323846f;
 // --------------------------- Utilities ---------------------------
 
 namespace {
-inline std::size_t wrap_advance(std::size_t pos, std::size_t len) {
-  ++pos;
-  return (pos == len) ? 0 : pos;
-}
-
 inline float fastExpDecay(float x) {
   // x in [0,1], snappy decay for a click envelope
   return std::exp(-6.0f * x);
@@ -24,216 +21,646 @@ inline float fastExpDecay(float x) {
 
 // --------------------------- Looper ------------------------------
 
-Looper::Looper()
+Looper::Looper(Transport &transport)
     : tracks_(Config::instance().getNumTracks()), activeTrack_(0),
-      recording_(false), numBars_(8), bpm_(120.0f), metronomeEnabled_(false),
-      metronomePhase_(0.0), metronomeIncrement_(0.0), metronomeVolume_(0.25f) {
-  updateLoopLength();
-  updateMetronomeIncrement();
-
-  // Allocate per-track buffers to loop length
-  for (auto &t : tracks_) {
-    t.data.assign(loopLengthSamples_, 0.0f);
+      transport_(transport),
+      numBars_(std::clamp(Config::instance().getNumBars(), 1, MAX_BARS)),
+      loopTempo_(std::clamp(transport.getTempo(), MIN_BPM,
+                            Transport::MAX_TEMPO)),
+      metronomeEnabled_(false), metronomeVolume_(0.25f),
+      spares_(SPARE_SEGMENTS), released_(2 * SPARE_SEGMENTS) {
+  // Never reaches zero, whoever lets go of it
+  silence_.refs = 1 << 30;
+  std::fill(std::begin(silence_.samples), std::end(silence_.samples), 0.0f);
+  playScratch_.assign(tracks_.size() * CHUNK, 0.0f);
+  exportScratch_.assign((tracks_.size() + 1) * CHUNK, 0.0f);
+
+  {
+    std::lock_guard<std::mutex> lk(controlMtx_);
+    resizeTracks();
+    housekeeping();
+  }
+  worker_ = std::thread(&Looper::workerLoop, this);
+}
+
+Looper::~Looper() {
+  {
+    std::lock_guard<std::mutex> lk(workerMtx_);
+    stopWorker_ = true;
+  }
+  workerCv_.notify_one();
+  worker_.join();
+  stopExport();
+
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  Segment *segment;
+  while (released_.pop(segment))
+    release(segment);
+  while (spares_.pop(segment))
+    release(segment);
+  for (Track &track : tracks_) {
+    dropHistory(track.undo);
+    dropHistory(track.redo);
+    // Nothing plays anymore, every buffer can go
+    track.inUse = generation_ + 1;
+    reclaim(track);
   }
 }
 
 // --- Recording control ---
 void Looper::setRecording(bool enabled) {
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  if (enabled && !recording_)
+    beginOverdub(activeTrack_);
   recording_ = enabled;
-  if (tracks_.size() > this->activeTrack_) {
-    tracks_[this->activeTrack_].recordingStartIdx = idx_;
-    tracks_[this->activeTrack_].noInputYet = true;
-  }
 }
 
 bool Looper::isRecording() const { return recording_; }
 
+void Looper::toggleRecording() {
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  if (!recording_)
+    beginOverdub(activeTrack_);
+  recording_ = !recording_;
+}
+
 void Looper::setActiveTrack(int index) {
   if (index < 0)
     index = 0;
-  if (index >= Config::instance().getNumTracks())
-    index = Config::instance().getNumTracks() - 1;
+  if (index >= static_cast<int>(tracks_.size()))
+    index = static_cast<int>(tracks_.size()) - 1;
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  // Recording moves over to the new track
+  if (recording_ && index != activeTrack_)
+    beginOverdub(index);
   activeTrack_ = index;
 }
 
 int Looper::getActiveTrack() const { return activeTrack_; }
 
 void Looper::clearTrack(int index) {
-  if (index < 0 || index >= Config::instance().getNumTracks())
+  if (index < 0 || index >= static_cast<int>(tracks_.size()))
     return;
-  auto &t = tracks_[index];
-  t.data.assign(loopLengthSamples_, 0.0f);
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  // Undoable like a recording pass. A track being recorded carries on
+  // recording into the cleared loop.
+  const bool wasRecording = stopRecording(index);
+  beginOverdub(index);
+  publish(tracks_[index], getLoopLength());
+  if (wasRecording)
+    recording_ = true;
+}
+
+// --- Overdub history ---
+bool Looper::undo(int index) {
+  if (index < 0 || index >= static_cast<int>(tracks_.size()))
+    return false;
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  Track &track = tracks_[index];
+  if (track.undo.empty())
+    return false;
+  // An undo ends the pass being recorded
+  stopRecording(index);
+
+  track.redo.push_back(capture(track));
+  Snapshot previous = std::move(track.undo.back());
+  track.undo.pop_back();
+  restore(track, previous);
+  return true;
+}
+
+bool Looper::redo(int index) {
+  if (index < 0 || index >= static_cast<int>(tracks_.size()))
+    return false;
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  Track &track = tracks_[index];
+  if (track.redo.empty())
+    return false;
+  stopRecording(index);
+
+  track.undo.push_back(capture(track));
+  Snapshot next = std::move(track.redo.back());
+  track.redo.pop_back();
+  restore(track, next);
+  return true;
+}
+
+int Looper::getUndoDepth(int index) {
+  if (index < 0 || index >= static_cast<int>(tracks_.size()))
+    return 0;
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  return static_cast<int>(tracks_[index].undo.size());
+}
+
+int Looper::getRedoDepth(int index) {
+  if (index < 0 || index >= static_cast<int>(tracks_.size()))
+    return 0;
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  return static_cast<int>(tracks_[index].redo.size());
+}
+
+// --- Export ---
+bool Looper::startExport(const std::string &prefix) {
+  std::lock_guard<std::mutex> lk(exportMtx_);
+  if (exporting_)
+    return false;
+
+  std::vector<std::unique_ptr<WaveWriter>> files;
+  const int sr = Config::instance().getSampleRate();
+  for (std::size_t f = 0; f <= tracks_.size(); f++) {
+    std::string name = f == 0 ? prefix + "-mix.wav"
+                              : prefix + "-track" + std::to_string(f) + ".wav";
+    auto file = std::make_unique<WaveWriter>();
+    if (!file->open(name, 1, sr))
+      return false;
+    files.push_back(std::move(file));
+  }
+  exportFiles_ = std::move(files);
+
+  // A second of audio, created once since the audio thread holds on to it
+  if (!exportRing_) {
+    exportRing_ = std::make_unique<SpscRing<float>>(
+        static_cast<std::size_t>(sr) * (tracks_.size() + 1));
+  }
+  // Left over from a block that came in after the last export stopped
+  drainExport(true);
+  exportOverruns_ = 0;
+  exporting_.store(true, std::memory_order_release);
+  return true;
+}
+
+void Looper::stopExport() {
+  exporting_ = false;
+  std::lock_guard<std::mutex> lk(exportMtx_);
+  drainExport(false);
+  exportFiles_.clear();
+}
+
+// Called with exportMtx_ held
+void Looper::drainExport(bool discard) {
+  if (!exportRing_)
+    return;
+  const std::size_t channels = tracks_.size() + 1;
+  std::vector<float> frames(channels * CHUNK);
+  std::vector<float> channel(CHUNK);
+  std::size_t count;
+  while ((count = exportRing_->pop(frames.data(), frames.size())) > 0) {
+    if (discard || exportFiles_.size() != channels)
+      continue;
+    const std::size_t n = count / channels;
+    for (std::size_t c = 0; c < channels; c++) {
+      for (std::size_t i = 0; i < n; i++)
+        channel[i] = frames[i * channels + c];
+      exportFiles_[c]->write(channel.data(), n);
+    }
+  }
 }
 
 // --- Loop length control ---
 void Looper::setNumBars(int bars) {
-  if (bars < 1)
-    bars = 1;
-  if (numBars_ == bars)
+  bars = std::clamp(bars, 1, MAX_BARS);
+  if (numBars_.exchange(bars) == bars)
     return;
-  numBars_ = bars;
-  updateLoopLength();
-
-  // Reallocate tracks to the new loop length (clear for simplicity)
-  for (auto &t : tracks_) {
-    t.data.assign(loopLengthSamples_, 0.0f);
-  }
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  resizeTracks();
 }
 
 int Looper::getNumBars() const { return numBars_; }
 
+std::size_t Looper::getLoopLength() const {
+  const double beat = transport_.getSamplesPerBeat(loopTempo_);
+  const double beats =
+      static_cast<double>(numBars_) * transport_.getBeatsPerBar();
+  return static_cast<std::size_t>(std::llround(beat * beats));
+}
+
 // --- Metronome control ---
 void Looper::setBPM(float bpm) {
-  if (bpm < 0.0f)
-    bpm = 0.0f;
-  if (bpm_ == bpm)
+  transport_.setTempo(bpm);
+  const double tempo = transport_.getTempo();
+  // A stop, the loops wait for the clock to start again
+  if (tempo == 0.0)
     return;
-  bpm_ = bpm;
+  const double loopTempo = std::max(tempo, MIN_BPM);
+  if (loopTempo_.exchange(loopTempo) == loopTempo)
+    return;
+  std::lock_guard<std::mutex> lk(controlMtx_);
+  resizeTracks();
 }
 
-float Looper::getBPM() const { return bpm_; }
+float Looper::getBPM() const {
+  return static_cast<float>(transport_.getTempo());
+}
 
 void Looper::enableMetronome(bool enable) { metronomeEnabled_ = enable; }
 
 bool Looper::isMetronomeEnabled() const { return metronomeEnabled_; }
 
 // --- Helpers ---
-void Looper::updateMetronomeIncrement() {
-  const int sr = Config::instance().getSampleRate();
-  metronomeIncrement_ =
-      (sr > 0) ? (static_cast<double>(bpm_) / 60.0) / static_cast<double>(sr)
-               : 0.0;
+// Every track at the current loop length, new ones silent. A track being
+// recorded carries on recording into its refitted loop.
+void Looper::resizeTracks() {
+  const std::size_t length = getLoopLength();
+  for (std::size_t t = 0; t < tracks_.size(); t++) {
+    Track &track = tracks_[t];
+    const TrackBuffer *buffer = track.next.load(std::memory_order_acquire);
+    if (!buffer) {
+      publish(track, length);
+      continue;
+    }
+    // Never fitted to nothing, that would lose the loop without an undo
+    if (length == 0 ||
+        (buffer->length == length && buffer->bars == numBars_))
+      continue;
+
+    const bool wasRecording = stopRecording(static_cast<int>(t));
+    Snapshot current = capture(track);
+    restore(track, current);
+    if (wasRecording)
+      recording_ = true;
+  }
 }
 
-void Looper::updateLoopLength() {
-  const int sr = Config::instance().getSampleRate();
-  if (sr <= 0 || bpm_ <= 0.0f) {
-    loopLengthSamples_ = 0;
+// Publishes 'snapshot', whose references it takes over, fitted to the
+// current loop length
+void Looper::restore(Track &track, Snapshot &snapshot) {
+  const std::size_t length = getLoopLength();
+  if (snapshot.length == length && snapshot.bars == numBars_) {
+    publish(track, length, &snapshot.segments);
     return;
   }
-  const double secondsPerBeat = 60.0 / static_cast<double>(bpm_);
-  const double totalSeconds = 30;
-  loopLengthSamples_ = static_cast<std::size_t>(
-      std::max(1.0, std::round(totalSeconds * static_cast<double>(sr))));
-}
-
-// Metronome: cheap click with short envelope on beat wrap
-float Looper::generateMetronomeSample() {
-  struct ClickEnv {
-    float toneLengthOther = 0.025f;
-    float toneLengthStart = 0.05f;
-    int idx = 0;
-    float phase = 0;
-    // Unless we use sampler
-    float freqLow = 880;
-    float freqHigh = 1760;
-    // If we use sampler
-    int sampleIdx = 0;
+  std::vector<Segment *> fitted = fit(snapshot, length);
+  for (Segment *segment : snapshot.segments)
+    release(segment);
+  snapshot.segments.clear();
+  publish(track, length, fitted.empty() ? nullptr : &fitted);
+}
+
+// New segments holding 'snapshot' at 'length' samples and the current number
+// of bars. Its bars are stretched to the new bar length and repeated or cut
+// to the new number of bars, with 4-point Hermite interpolation around the
+// loop. Empty for a silent loop.
+std::vector<Looper::Segment *> Looper::fit(const Snapshot &snapshot,
+                                           std::size_t length) {
+  const std::size_t from = snapshot.length;
+  const bool silent =
+      std::all_of(snapshot.segments.begin(), snapshot.segments.end(),
+                  [this](const Segment *s) { return s == &silence_; });
+  if (from == 0 || length == 0 || silent)
+    return {};
+
+  auto at = [&](std::size_t i) {
+    i %= from;
+    return snapshot.segments[i >> SEGMENT_SHIFT]
+        ->samples[i & (SEGMENT_SIZE - 1)];
   };
-  static ClickEnv s;
+  // Source samples per target sample
+  const double step = static_cast<double>(from) * numBars_ /
+                      (static_cast<double>(snapshot.bars) * length);
+
+  std::vector<Segment *> segments((length + SEGMENT_SIZE - 1) >>
+                                  SEGMENT_SHIFT);
+  for (std::size_t s = 0; s < segments.size(); s++) {
+    try {
+      segments[s] = new Segment;
+    } catch (...) {
+      for (std::size_t k = 0; k < s; k++)
+        delete segments[k];
+      throw;
+    }
+    for (std::size_t k = 0; k < SEGMENT_SIZE; k++) {
+      const std::size_t j = (s << SEGMENT_SHIFT) + k;
+      if (j >= length) {
+        segments[s]->samples[k] = 0.0f;
+        continue;
+      }
+      const double x = static_cast<double>(j) * step;
+      const std::size_t i = static_cast<std::size_t>(x);
+      const float t = static_cast<float>(x - static_cast<double>(i));
+      const float y0 = at(i + from - 1), y1 = at(i), y2 = at(i + 1),
+                  y3 = at(i + 2);
+      const float c1 = 0.5f * (y2 - y0);
+      const float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+      const float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+      segments[s]->samples[k] = ((c3 * t + c2) * t + c1) * t + y1;
+    }
+  }
+  return segments;
+}
 
-  float result = 0;
-  bool useStart = false;
+// Publishes a buffer of 'length' samples made of 'segments', whose
+// references it takes over, or of silence
+void Looper::publish(Track &track, std::size_t length,
+                     const std::vector<Segment *> *segments) {
+  auto buffer = std::make_unique<TrackBuffer>();
+  const std::size_t count = (length + SEGMENT_SIZE - 1) >> SEGMENT_SHIFT;
+  buffer->length = length;
+  buffer->bars = numBars_;
+  buffer->segments = std::vector<std::atomic<Segment *>>(count);
+  for (std::size_t s = 0; s < count; s++)
+    buffer->segments[s] = segments ? (*segments)[s] : &silence_;
+  buffer->generation = ++generation_;
+
+  reclaim(track);
+  track.next.store(buffer.get(), std::memory_order_release);
+  track.buffers.push_back(std::move(buffer));
+}
 
-  const int sr = Config::instance().getSampleRate();
+// Frees the buffers older than the one being played, they won't be looked
+// at again
+void Looper::reclaim(Track &track) {
+  const std::uint64_t inUse = track.inUse.load(std::memory_order_acquire);
+  auto old = std::stable_partition(
+      track.buffers.begin(), track.buffers.end(),
+      [inUse](const std::unique_ptr<TrackBuffer> &b) {
+        return b->generation >= inUse;
+      });
+  for (auto it = old; it != track.buffers.end(); ++it) {
+    for (auto &segment : (*it)->segments)
+      release(segment.load(std::memory_order_relaxed));
+  }
+  track.buffers.erase(old, track.buffers.end());
+}
 
-  int indexSoundStart = sr * 60 / static_cast<int>(bpm_);
-  int indexBar = indexSoundStart * numBars_;
+// The newest buffer of a track as a snapshot. The track must not be
+// recording (see stopRecording()), or the snapshot may catch the block
+// being written.
+Looper::Snapshot Looper::capture(const Track &track) {
+  Snapshot snapshot;
+  const TrackBuffer *buffer = track.next.load(std::memory_order_acquire);
+  snapshot.length = buffer->length;
+  snapshot.bars = buffer->bars;
+  snapshot.segments.reserve(buffer->segments.size());
+  for (const auto &segment : buffer->segments) {
+    Segment *s = segment.load(std::memory_order_acquire);
+    retain(s);
+    snapshot.segments.push_back(s);
+  }
+  return snapshot;
+}
 
-  int soundLen;
-  // We beat every 1 out of 4
-  if ((s.idx % (4 * indexSoundStart)) < indexSoundStart) {
-    useStart = true;
+// Called before 'track' starts recording a pass
+void Looper::beginOverdub(int index) {
+  if (index < 0 || index >= static_cast<int>(tracks_.size()))
+    return;
+  Track &track = tracks_[index];
+  track.undo.push_back(capture(track));
+  if (track.undo.size() > HISTORY_DEPTH) {
+    std::vector<Snapshot> oldest(1);
+    oldest[0] = std::move(track.undo.front());
+    track.undo.erase(track.undo.begin());
+    dropHistory(oldest);
   }
+  dropHistory(track.redo);
+}
 
-  int idxNorm = s.idx % indexSoundStart;
+// Stops recording 'track', if it is, and waits for the block that may still
+// be writing to it to end, so that it can be captured. True if it was
+// recording.
+bool Looper::stopRecording(int index) {
+  if (!recording_ || activeTrack_ != index)
+    return false;
+  recording_ = false;
+  // A block that starts from here on sees recording_ off
+  const std::uint64_t block = blockCount_.load();
+  if (block % 2 == 1) {
+    while (blockCount_.load() == block)
+      std::this_thread::yield();
+  }
+  return true;
+}
 
-  if (metronomeUseSampler_) {
+void Looper::dropHistory(std::vector<Snapshot> &history) {
+  for (Snapshot &snapshot : history) {
+    for (Segment *segment : snapshot.segments)
+      release(segment);
+  }
+  history.clear();
+}
 
-    if (s.idx % indexSoundStart == 0) {
-      s.sampleIdx = 0;
-    }
+void Looper::retain(Segment *segment) {
+  if (segment != &silence_)
+    segment->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Looper::release(Segment *segment) {
+  if (segment != &silence_ &&
+      segment->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete segment;
+}
 
-    if (useStart) {
-      soundLen = static_cast<int>(metronomeSamplesHigh_.size());
-    } else {
-      soundLen = static_cast<int>(metronomeSamplesLow_.size());
+// Takes back what the audio thread let go of and tops up its spares
+void Looper::housekeeping() {
+  Segment *segment;
+  while (released_.pop(segment))
+    release(segment);
+  while (spares_.writeAvailable() > 0) {
+    segment = new Segment;
+    if (!spares_.push(segment)) {
+      delete segment;
+      break;
     }
+  }
+  for (Track &track : tracks_)
+    reclaim(track);
+}
 
-    if (s.sampleIdx < soundLen) {
-      if (useStart) {
-        result = metronomeSamplesHigh_[s.sampleIdx];
-      } else {
-        result = metronomeSamplesLow_[s.sampleIdx];
-      }
+void Looper::workerLoop() {
+  std::unique_lock<std::mutex> lk(workerMtx_);
+  while (!stopWorker_) {
+    workerCv_.wait_for(lk, std::chrono::milliseconds(10));
+    lk.unlock();
+    {
+      std::lock_guard<std::mutex> control(controlMtx_);
+      housekeeping();
+    }
+    {
+      std::lock_guard<std::mutex> exports(exportMtx_);
+      drainExport(false);
     }
+    lk.lock();
+  }
+}
 
-    s.sampleIdx++;
-  } else {
-    float deltaT = 1.0f / Config::instance().getSampleRate();
-    float add = 2.0 * PI * s.freqLow * deltaT;
+// Audio thread: switches to the newest buffer of a track
+void Looper::adopt(Track &track) {
+  TrackBuffer *next = track.next.load(std::memory_order_acquire);
+  if (next == track.current)
+    return;
+  track.current = next;
+  track.inUse.store(next->generation, std::memory_order_release);
+}
 
-    soundLen = static_cast<int>(s.toneLengthOther * static_cast<float>(sr));
+// Audio thread: puts a track where the transport is within the loop. Rounded
+// to the nearest sample so that steady playback never moves it; a loop that
+// isn't a whole number of samples long slips by under a sample as it wraps.
+void Looper::syncTrack(Track &track) {
+  const std::size_t length = track.current->length;
+  const double samplesPerBeat = transport_.blockSamplesPerBeat();
+  if (length == 0 || samplesPerBeat <= 0.0) {
+    track.pos = 0;
+    return;
+  }
+  const double loopBeats =
+      static_cast<double>(numBars_) * transport_.getBeatsPerBar();
+  const double beat = transport_.blockBeat();
+  const double into = beat - std::floor(beat / loopBeats) * loopBeats;
+  // Off by one block while a new tempo and the resized loop catch up
+  track.pos = static_cast<std::size_t>(std::llround(into * samplesPerBeat)) %
+              length;
+}
 
-    if (useStart) {
-      soundLen = static_cast<int>(s.toneLengthStart * static_cast<float>(sr));
-      add = 2.0 * PI * s.freqHigh * deltaT;
-    }
+// Audio thread: the segment at 'index', copied first if anything else
+// refers to it. Null if there was no spare to copy it to.
+Looper::Segment *Looper::writable(TrackBuffer &buffer, std::size_t index) {
+  Segment *segment = buffer.segments[index].load(std::memory_order_relaxed);
+  if (segment->refs.load(std::memory_order_acquire) == 1)
+    return segment;
+
+  Segment *copy;
+  if (released_.writeAvailable() == 0 || !spares_.pop(copy))
+    return nullptr;
+  std::copy(std::begin(segment->samples), std::end(segment->samples),
+            copy->samples);
+  buffer.segments[index].store(copy, std::memory_order_release);
+  released_.push(segment);
+  return copy;
+}
 
-    if (idxNorm < soundLen) {
-      result = Sound::square(s.phase, 0.5) * 0.2;
-    }
+// Metronome: a sample, or a short square tone, from every beat, the high
+// one on the first beat of a bar
+void Looper::startClick(bool downbeat) {
+  const int sr = transport_.getSampleRate();
+  click_.pos = 0;
+  click_.downbeat = downbeat;
+  click_.phase = 0.0f;
+  if (metronomeUseSampler_) {
+    click_.length = static_cast<int>(downbeat ? metronomeSamplesHigh_.size()
+                                              : metronomeSamplesLow_.size());
+  } else {
+    click_.length = static_cast<int>((downbeat ? 0.05f : 0.025f) * sr);
+  }
+}
 
-    s.phase += add;
-    if (s.phase > 2.0 * PI) {
-      s.phase -= 2.0 * PI;
-    }
+// Adds what is left of the click to frames [from, to) of 'buffer'
+void Looper::renderClick(float *buffer, int from, int to) {
+  const int end = std::min(to, from + (click_.length - click_.pos));
+  if (end <= from)
+    return;
+
+  if (metronomeUseSampler_) {
+    const std::vector<float> &samples =
+        click_.downbeat ? metronomeSamplesHigh_ : metronomeSamplesLow_;
+    for (int i = from; i < end; i++)
+      buffer[i] += samples[click_.pos++] * metronomeVolume_;
+    return;
   }
 
-  s.idx++;
-  s.idx = s.idx % indexBar;
-  return result;
+  const float freq = click_.downbeat ? 1760.0f : 880.0f;
+  const float add = 2.0f * PI * freq / transport_.getSampleRate();
+  for (int i = from; i < end; i++) {
+    buffer[i] += Sound::square(click_.phase, 0.5) * 0.2f * metronomeVolume_;
+    click_.phase += add;
+    if (click_.phase > 2.0f * PI)
+      click_.phase -= 2.0f * PI;
+  }
+  click_.pos += end - from;
 }
 
-float Looper::update(float input) {
-  float result = input;
-  bool useStart = false;
+void Looper::process(float *buffer, int frames) {
+  // Ordered with stopRecording(), and acquires the buffers published before
+  // recording was turned on
+  blockCount_.fetch_add(1);
+  const bool recording = recording_.load();
+  const int recordTrack =
+      recording ? activeTrack_.load(std::memory_order_relaxed) : -1;
+
+  for (Track &track : tracks_) {
+    adopt(track);
+    syncTrack(track);
+  }
 
-  const int sr = Config::instance().getSampleRate();
-  int slackInterval = static_cast<int>(static_cast<float>(sr) * 0.5f);
+  for (int done = 0; done < frames; done += CHUNK)
+    processChunk(buffer + done, std::min(CHUNK, frames - done), recordTrack);
+
+  if (metronomeEnabled_ && transport_.getTempo() >= 1.0) {
+    int done = 0;
+    for (int b = 0; b < transport_.numBeats(); b++) {
+      const Transport::Beat &beat = transport_.beat(b);
+      const int offset = std::min(beat.offset, frames);
+      renderClick(buffer, done, offset);
+      startClick(beat.downbeat);
+      done = offset;
+    }
+    renderClick(buffer, done, frames);
+  }
+  blockCount_.fetch_add(1);
+}
 
-  int indexSoundStart = sr * 60 / static_cast<int>(bpm_);
-  int indexBar = indexSoundStart * (numBars_ * 4);
+void Looper::processChunk(float *buffer, int frames, int recordTrack) {
+  const std::size_t numTracks = tracks_.size();
 
-  for (size_t t = 0; t < tracks_.size(); t++) {
+  // What every track plays, the recording track taking in the dry input
+  // after what it held was read
+  for (std::size_t t = 0; t < numTracks; t++) {
     Track &track = tracks_[t];
-    if (idx_ < static_cast<int>(track.data.size())) {
-      result += track.data[idx_];
-      if (static_cast<int>(t) == activeTrack_ && recording_) {
-        if (input == 0 && tracks_[activeTrack_].noInputYet) {
-          tracks_[activeTrack_].recordingStartIdx = idx_;
+    TrackBuffer &data = *track.current;
+    float *played = &playScratch_[t * CHUNK];
+    if (data.length == 0) {
+      std::fill_n(played, frames, 0.0f);
+      continue;
+    }
+
+    const bool record = static_cast<int>(t) == recordTrack;
+    std::size_t pos = track.pos;
+    for (int i = 0; i < frames;) {
+      const std::size_t index = pos >> SEGMENT_SHIFT;
+      const std::size_t offset = pos & (SEGMENT_SIZE - 1);
+      const int run = static_cast<int>(
+          std::min({static_cast<std::size_t>(frames - i),
+                    SEGMENT_SIZE - offset, data.length - pos}));
+
+      const Segment *segment =
+          data.segments[index].load(std::memory_order_relaxed);
+      std::copy_n(segment->samples + offset, run, played + i);
+      if (record) {
+        // Without a spare segment the input is dropped, which only
+        // happens if the background thread is starved
+        if (Segment *target = writable(data, index)) {
+          for (int k = 0; k < run; k++)
+            target->samples[offset + k] = played[i + k] + buffer[i + k];
         }
-        // if (input == 0 && abs(idx_ - tracks_[activeTrack_].recordingStartIdx)
-        // <
-        //                       slackInterval) {
-        //  Let this be, so that we don't overwrite here.
-        //} else {
-        track.data[idx_] += input;
-        tracks_[activeTrack_].noInputYet = false;
-        //}
-        // TODO: Fix this smooth transition thing
       }
+
+      i += run;
+      pos += run;
+      if (pos == data.length)
+        pos = 0;
     }
+    track.pos = pos;
   }
 
-  idx_++;
-  idx_ = idx_ % indexBar;
-
-  if (metronomeEnabled_) {
-    result += generateMetronomeSample() * metronomeVolume_;
+  for (std::size_t t = 0; t < numTracks; t++) {
+    const float *played = &playScratch_[t * CHUNK];
+    for (int i = 0; i < frames; i++)
+      buffer[i] += played[i];
   }
 
-  return result;
+  if (exporting_.load(std::memory_order_acquire)) {
+    const std::size_t channels = numTracks + 1;
+    for (int i = 0; i < frames; i++) {
+      float *frame = &exportScratch_[i * channels];
+      frame[0] = buffer[i];
+      for (std::size_t t = 0; t < numTracks; t++)
+        frame[t + 1] = playScratch_[t * CHUNK + i];
+    }
+    const std::size_t count = frames * channels;
+    // Whole chunks or nothing, so that frames stay aligned
+    if (exportRing_->writeAvailable() >= count)
+      exportRing_->push(exportScratch_.data(), count);
+    else
+      exportOverruns_++;
+  }
 }
 
 bool Looper::setMetronomeSampler(const std::string &waveFileHigh,
@@ -266,15 +693,6 @@ bool Looper::setMetronomeSampler(const std::string &waveFileHigh,
   }
 
   int expectedRate = Config::instance().getSampleRate();
-  if (samplerateHigh != expectedRate || samplerateLow != expectedRate) {
-    std::cerr << "Error: Metronome sample rate mismatch. Expected "
-              << expectedRate << " Hz, got " << samplerateHigh << " / "
-              << samplerateLow << " Hz." << std::endl;
-
-    delete[] dataHigh;
-    delete[] dataLow;
-    return false;
-  }
 
   int numSamplesHigh = sizeHigh / (bpsHigh / 8);
   int numSamplesLow = sizeLow / (bpsLow / 8);
@@ -300,6 +718,12 @@ bool Looper::setMetronomeSampler(const std::string &waveFileHigh,
   rawHigh = extractMono(rawHigh, chanHigh);
   rawLow = extractMono(rawLow, chanLow);
 
+  // Clicks recorded at another rate are converted rather than rejected
+  rawHigh = Resampler::convertCached(waveFileHigh, rawHigh, 1, samplerateHigh,
+                                     expectedRate);
+  rawLow = Resampler::convertCached(waveFileLow, rawLow, 1, samplerateLow,
+                                    expectedRate);
+
   auto toFloat = [](const std::vector<short> &input) -> std::vector<float> {
     std::vector<float> out;
     out.reserve(input.size());
@@ -16,9 +16,6 @@
 #include "keyboard.hpp"
 #include "term.hpp"
 
-// MIDI note number to frequency
-float noteToFreq(int note) { return 440.0f * pow(2, (note - 69) / 12.0f); }
-
 bool fileExists(const std::string &file) {
   return std::filesystem::exists(file);
 }
@@ -39,6 +36,7 @@ public:
   float duration = 0.1f;
   notes::TuningSystem tuning = notes::TuningSystem::EqualTemperament;
   int parallelization = 8; // Number of threads to use in keyboard preparation
+  std::string noteCache = "synths/cache"; // Rendered notes, empty for none
 
   void printConfig() {
     term::print(term::Style::WhiteBold, "Keyboard sound configuration:\n");
@@ -229,8 +227,11 @@ void printHelp(char *argv0) {
          "Hz\n");
   printf("                (default no highpass)\n");
   printf("   --parallelization [int]: Number of threads used in keyboard "
-         "preparation default: 8");
-  printf("\n");
+         "preparation default: 8\n");
+  printf("   --note-cache [dir]: Keep rendered notes in this directory, to "
+         "start faster\n");
+  printf("                with the same sound, default: synths/cache\n");
+  printf("   --no-note-cache: Render the notes on every start\n");
   printf("%s compiled %s %s\n", argv0, __DATE__, __TIME__);
 }
 
@@ -408,6 +409,10 @@ int parseArguments(int argc, char *argv[], PlayConfig &config) {
       v.numVoices = std::atoi(argv[i + 1]);
     } else if (arg == "--parallelization" && i + 1 < argc) {
       config.parallelization = std::atoi(argv[i + 1]);
+    } else if (arg == "--note-cache" && i + 1 < argc) {
+      config.noteCache = argv[i + 1];
+    } else if (arg == "--no-note-cache") {
+      config.noteCache.clear();
     } else if (arg == "--midi" && i + 1 < argc) {
       config.midiFile = argv[i + 1];
     } else if (arg == "-r" || arg == "--reverb" && i + 1 < argc) {
@@ -483,6 +488,7 @@ int main(int argc, char *argv[]) {
     config.waveForm = Sound::WaveForm::WaveFile;
   }
   keyboard.setLoaderFunc(loaderFunc);
+  keyboard.setNoteCache(config.noteCache);
   keyboard.setVolume(config.volume);
   std::vector<Effect<short>> effects;
   if (config.effectFIR) {
@@ -537,9 +543,7 @@ int main(int argc, char *argv[]) {
       for (int event = 0; event < midiFile[track].size(); event++) {
         if (midiFile[track][event].isNoteOn()) {
           int note = midiFile[track][event][1];
-          float frequency = noteToFreq(note);
-
-          std::string noteKey = notes::getClosestNote(frequency, tuning);
+          const std::string &noteKey = notes::getNoteName(note);
 
           float duration = midiFile[track][event].getDurationInSeconds();
           float startTime = midiFile[track][event].seconds;
@@ -1,6 +1,7 @@
 
 #include <chrono>
 #include <cmath>
+#include <csignal>
 #include <filesystem>
 #include <functional>
 #include <iostream>
@@ -19,26 +20,82 @@ using json = nlohmann::json;
 
 #include "adsr.hpp"
 #include "api.hpp"
+#include "audiobackend.hpp"
 #include "config.hpp"
 #include "effect.hpp"
 #include "keyboardstream.hpp"
+#include "midiinput.hpp"
+#include "scala.hpp"
+#include "session.hpp"
 #include "term.hpp"
 
-// MIDI note number to frequency
-float noteToFreq(int note) { return 440.0f * pow(2, (note - 69) / 12.0f); }
-
 bool fileExists(const std::string &file) {
   return std::filesystem::exists(file);
 }
 
-void SDL2AudioCallback(void *userdata, Uint8 *stream, int len) {
-  auto *ks = static_cast<KeyboardStream *>(userdata);
-  float *streamBuf = reinterpret_cast<float *>(stream);
-  int samples = len / sizeof(float);
-  ks->lock();
-  ks->fillBuffer(streamBuf, samples);
-  ks->unlock();
-}
+// The sound card, through SDL2 (see audiobackend.hpp for the others)
+class SdlAudioBackend : public AudioBackend {
+public:
+  ~SdlAudioBackend() override {
+    if (opened_)
+      SDL_CloseAudio();
+  }
+
+  bool open(int sampleRate, int channels, int frames, Render render) override {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+      std::cerr << "SDL_Init failed: " << SDL_GetError() << std::endl;
+      return false;
+    }
+    render_ = std::move(render);
+    channels_ = channels;
+
+    SDL_AudioSpec desired, obtained;
+    SDL_zero(desired);
+    desired.freq = sampleRate;
+    desired.format = AUDIO_F32SYS;
+    desired.channels = channels;
+    desired.samples = frames;
+    desired.callback = &SdlAudioBackend::callback;
+    desired.userdata = this;
+
+    if (SDL_OpenAudio(&desired, &obtained) < 0) {
+      std::cerr << "SDL_OpenAudio failed: " << SDL_GetError() << std::endl;
+      return false;
+    }
+    if (obtained.freq != desired.freq || obtained.format != desired.format ||
+        obtained.channels != desired.channels) {
+      // The device can't run at the requested format, let SDL convert for us
+      std::cerr << "Audio device opened at " << obtained.freq
+                << " Hz, converting from " << desired.freq << " Hz"
+                << std::endl;
+      SDL_CloseAudio();
+      if (SDL_OpenAudio(&desired, nullptr) < 0) {
+        std::cerr << "SDL_OpenAudio failed: " << SDL_GetError() << std::endl;
+        return false;
+      }
+    }
+    opened_ = true;
+    return true;
+  }
+  void start() override { SDL_PauseAudio(0); }
+  void stop() override {
+    if (opened_)
+      SDL_PauseAudio(1);
+  }
+  const char *name() const override { return "sdl"; }
+
+private:
+  Render render_;
+  int channels_ = 1;
+  bool opened_ = false;
+
+  static void callback(void *userdata, Uint8 *stream, int len) {
+    auto *self = static_cast<SdlAudioBackend *>(userdata);
+    const int samples = len / sizeof(float);
+    self->render_(reinterpret_cast<float *>(stream), samples);
+    self->framesRendered_ += samples / self->channels_;
+  }
+};
 
 void printHelp(char *argv0) {
   printf("Usage: %s [flags]\n", argv0);
@@ -70,9 +127,30 @@ void printHelp(char *argv0) {
   printf("   --notes [file]: Map notes to .wav files as mapped in this .json "
          "file\n");
   printf("   --midi [file]: Play this MIDI (.mid) file\n");
+  printf("   --midi-in [port]: Play from a live ALSA MIDI port (client:port "
+         "or client name), 'none' to wait for a connection\n");
+  printf("   --midi-list: List the ALSA MIDI ports to play from\n");
+  printf("   --scope-rate [float]: Live scope and spectrum frames per second "
+         "sent to the config tool (default 20)\n");
+  printf("   --audio [sdl|null|null-fast|wav|pipe]: Audio output, the sound "
+         "card, nothing in real time or as fast as possible, a wav file, or "
+         "raw 16 bit PCM on stdout (default sdl)\n");
+  printf("   --audio-file [file]: File the wav output writes to (default "
+         "output.wav)\n");
+  printf("   --sessions [int]: Server mode, host this many independent synths "
+         "without an audio device, reached at /api/session/{id}/\n");
+  printf("   --session-output [null|wav]: Where the sessions' audio goes "
+         "(default null)\n");
+  printf("   --session-dir [dir]: Directory of the sessions' wav files "
+         "(default sessions)\n");
   printf("   --volume [float]: Set the volume knob (default 1.0)\n");
   printf("   --legato [float]: Set legato, and legato speed in milliseconds "
          "(default 500)\n");
+  printf("   --glide-mode [poly|last|low|high]: Legato voicing, a voice per "
+         "note or one voice sounding the last, lowest or highest held key "
+         "(default last)\n");
+  printf("   --glide-curve [linear|exponential]: Legato pitch slew "
+         "(default linear)\n");
   printf("   --duration [float]: Note ADSR quanta duration in seconds (default "
          "0.1)\n");
   printf("   --adsr [int,int,int,int]: Set the ADSR quant intervals "
@@ -87,6 +165,18 @@ void printHelp(char *argv0) {
   printf("   --parallelization [int]: Number of threads used in keyboard "
          "preparation default: 8\n");
   printf("   --tuning [string]: Set the tuning used (equal | werckmeister3)\n");
+  printf("   --scala [file]: Load a Scala scale (.scl) and use it as tuning\n");
+  printf("   --kbm [file]: Scala keyboard mapping (.kbm) for the --scala "
+         "scale\n");
+  printf("   --sample-rate [int]: Sample rate in Hz used for synthesis and the "
+         "audio device (default: %d)\n",
+         defaults::sampleRate);
+  printf("   --channels [int]: Output channels, 1 for mono, 2 for stereo "
+         "(default: %d)\n",
+         defaults::channels);
+  printf("   --render-threads [int]: Worker threads rendering voices besides "
+         "the audio thread, 0 renders on the audio thread only (default: one "
+         "per core)\n");
   printf("   --looper: Activate a looper, will work based on metronome-bpm\n");
   printf("   --looper-bars: Set how many bars the looper will operate over "
          "(default 8)\n");
@@ -96,12 +186,11 @@ void printHelp(char *argv0) {
   printf(
       "   --metronome-volume [float]: Set the metronome volume (default: %f)\n",
       Config::instance().getMetronomeVolume());
-  printf(
-      "   --metronome-low [string]: Set the metronome low sound to this wave "
-      "file (needs to be of %d sample rate)\n",
-      Config::instance().getSampleRate());
+  printf("   --metronome-low [string]: Set the metronome low sound to this "
+         "wave file (resampled to %d Hz if needed)\n",
+         Config::instance().getSampleRate());
   printf("   --metronome-high [string]: Set the metronome high sound to this "
-         "wave file (needs to be of %d sample rate)\n",
+         "wave file (resampled to %d Hz if needed)\n",
          Config::instance().getSampleRate());
 
   printf("\n");
@@ -116,6 +205,29 @@ void loaderFunc(unsigned ticks, unsigned tick) {
   fflush(stdout);
 }
 
+// The sample rate has to be known before anything that depends on it is
+// constructed (ADSR lengths, effects, the looper), so it is read first.
+int parseSampleRate(int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg != "--sample-rate")
+      continue;
+    if (i + 1 >= argc) {
+      std::cerr << "--sample-rate requires a value (e.g. 44100 | 48000 | "
+                   "96000)\n";
+      return 1;
+    }
+    int rate = std::atoi(argv[i + 1]);
+    if (rate < 8000 || rate > 192000) {
+      std::cerr << "Unsupported sample rate: " << argv[i + 1]
+                << " (expected 8000 - 192000 Hz)\n";
+      return 1;
+    }
+    Config::instance().setSampleRate(rate);
+  }
+  return 0;
+}
+
 int parseArguments(int argc, char *argv[], KeyboardStreamPlayConfig &config) {
   auto ensureVibrato = [&](float defFreq = 6.0f, float defDepth = 0.3f) {
     if (!config.effectVibrato) {
@@ -204,6 +316,22 @@ int parseArguments(int argc, char *argv[], KeyboardStreamPlayConfig &config) {
     } else if (arg == "--legato" && i + 1 < argc) {
       config.legatoSpeed = std::stof(argv[i + 1]); // change depth only
       printf("config.legatoSpeed: %f\n", *config.legatoSpeed);
+    } else if (arg == "--glide-mode" && i + 1 < argc) {
+      std::optional<glide::Mode> mode = glide::modeFromString(argv[i + 1]);
+      if (!mode) {
+        std::cerr << "Invalid glide mode: " << argv[i + 1] << "\n";
+        return 1;
+      }
+      config.glideMode = *mode;
+      ++i;
+    } else if (arg == "--glide-curve" && i + 1 < argc) {
+      std::optional<glide::Curve> curve = glide::curveFromString(argv[i + 1]);
+      if (!curve) {
+        std::cerr << "Invalid glide curve: " << argv[i + 1] << "\n";
+        return 1;
+      }
+      config.glideCurve = *curve;
+      ++i;
     } else if (arg == "--vibrato-depth" && i + 1 < argc) {
       ensureVibrato(); // keep existing freq
       auto &v =
@@ -266,6 +394,24 @@ int parseArguments(int argc, char *argv[], KeyboardStreamPlayConfig &config) {
       config.metronomeLow = std::string(argv[i + 1]);
     } else if (arg == "--metronome-high" && i + 1 < argc) {
       config.metronomeHigh = std::string(argv[i + 1]);
+    } else if (arg == "--channels" && i + 1 < argc) {
+      int channels = std::atoi(argv[i + 1]);
+      if (channels < 1 || channels > 8) {
+        std::cerr << "Unsupported channel count: " << argv[i + 1]
+                  << " (expected 1 - 8)\n";
+        return 1;
+      }
+      Config::instance().setChannels(channels);
+    } else if (arg == "--render-threads" && i + 1 < argc) {
+      int workers = std::atoi(argv[i + 1]);
+      if (workers < 0 || workers > 64) {
+        std::cerr << "Unsupported number of render threads: " << argv[i + 1]
+                  << " (expected 0 - 64)\n";
+        return 1;
+      }
+      Config::instance().setRenderWorkers(workers);
+    } else if (arg == "--sample-rate" && i + 1 < argc) {
+      i++; // already applied by parseSampleRate()
     } else if (arg == "--tuning") { // enable with defaults
       if (i + 1 < argc) {           // make sure there's a value after --tuning
         std::string tuningArg = argv[++i];
@@ -283,27 +429,65 @@ int parseArguments(int argc, char *argv[], KeyboardStreamPlayConfig &config) {
                      "werckmeister3)\n";
         return 1;
       }
+    } else if (arg == "--scala" && i + 1 < argc) {
+      config.scalaFile = argv[++i];
+    } else if (arg == "--kbm" && i + 1 < argc) {
+      config.keyboardMappingFile = argv[++i];
     } else if (arg == "--chorus") { // enable with defaults
       ensureChorus();
     } else if (arg == "--chorus_delay" && i + 1 < argc) {
       ensureChorus();
       auto &v =
-          std::get<Effect<float>::ChorusConfig>(config.effectVibrato->config);
+          std::get<Effect<float>::ChorusConfig>(config.effectChorus->config);
       v.delay = std::stof(argv[i + 1]);
     } else if (arg == "--chorus_depth" && i + 1 < argc) {
       ensureChorus();
       auto &v =
-          std::get<Effect<float>::ChorusConfig>(config.effectVibrato->config);
+          std::get<Effect<float>::ChorusConfig>(config.effectChorus->config);
       v.depth = std::stof(argv[i + 1]);
     } else if (arg == "--chorus_voices" && i + 1 < argc) {
       ensureChorus();
       auto &v =
-          std::get<Effect<float>::ChorusConfig>(config.effectVibrato->config);
+          std::get<Effect<float>::ChorusConfig>(config.effectChorus->config);
       v.numVoices = std::atoi(argv[i + 1]);
     } else if (arg == "--parallelization" && i + 1 < argc) {
       config.parallelization = std::atoi(argv[i + 1]);
     } else if (arg == "--midi" && i + 1 < argc) {
       config.midiFile = argv[i + 1];
+    } else if (arg == "--midi-in") {
+      if (i + 1 >= argc) {
+        std::cerr << "--midi-in requires a port (client:port, client name "
+                     "or none)\n";
+        return 1;
+      }
+      config.midiInput = argv[++i];
+    } else if (arg == "--scope-rate" && i + 1 < argc) {
+      config.scopeRate = std::stod(argv[++i]);
+    } else if (arg == "--audio" && i + 1 < argc) {
+      config.audioBackend = argv[++i];
+      if (config.audioBackend != "sdl" &&
+          !AudioBackend::create(config.audioBackend, "")) {
+        std::cerr << "--audio expects sdl, null, null-fast, wav or pipe\n";
+        return 1;
+      }
+    } else if (arg == "--audio-file" && i + 1 < argc) {
+      config.audioFile = argv[++i];
+    } else if (arg == "--sessions" && i + 1 < argc) {
+      config.sessions = std::max(std::atoi(argv[++i]), 0);
+    } else if (arg == "--session-output" && i + 1 < argc) {
+      config.sessionOutput = argv[++i];
+      if (!Session::outputFromString(config.sessionOutput)) {
+        std::cerr << "--session-output expects null or wav\n";
+        return 1;
+      }
+    } else if (arg == "--session-dir" && i + 1 < argc) {
+      config.sessionDirectory = argv[++i];
+    } else if (arg == "--midi-list") {
+      if (!MidiInput::available())
+        printf("Built without ALSA, no live MIDI input\n");
+      for (const std::string &source : MidiInput::listSources())
+        printf("%s\n", source.c_str());
+      return -1;
     } else if (arg == "-r" || arg == "--reverb" && i + 1 < argc) {
       FIR fir(Config::instance().getSampleRate());
       fir.loadFromFile(argv[i + 1]);
@@ -328,6 +512,18 @@ int parseArguments(int argc, char *argv[], KeyboardStreamPlayConfig &config) {
       return -1;
     }
   }
+  if (!config.scalaFile.empty()) {
+    std::string error;
+    if (!scala::load(config.scalaFile, config.keyboardMappingFile, error)) {
+      std::cerr << "Failed to load tuning: " << error << "\n";
+      return 1;
+    }
+    config.tuning = notes::TuningSystem::Scala;
+  } else if (!config.keyboardMappingFile.empty()) {
+    std::cerr << "--kbm requires --scala\n";
+    return 1;
+  }
+
   // make sure there is always tremolo and vibrato
   ensureTremolo(6.0, 0.0);
   ensureVibrato(6.0, 0.0);
@@ -336,6 +532,80 @@ int parseArguments(int argc, char *argv[], KeyboardStreamPlayConfig &config) {
   return 0;
 }
 
+// Sets up 'stream' to play as the command line says, the same for the
+// single synth and for every session of the session server
+void prepareStream(KeyboardStream &stream, KeyboardStreamPlayConfig &config) {
+  stream.setTuning(config.tuning);
+  if (config.waveFile.size() > 0) {
+    stream.loadSoundMap(config.waveFile);
+    config.waveForm = Sound::WaveForm::WaveFile;
+  }
+  stream.setLoaderFunc(loaderFunc);
+  stream.setVolume(config.volume);
+  std::vector<Effect<float>> effects;
+  // Always have an echo effect included
+  Effect<float> echo;
+  echo.effectType = Effect<float>::Type::Echo;
+  echo.config = config.effectEcho;
+  effects.push_back(echo);
+  // Conditionally applied effects
+  if (config.effectFIR) {
+    effects.push_back(*config.effectFIR);
+  }
+  if (config.effectChorus) {
+    effects.push_back(*config.effectChorus);
+  }
+  if (config.effectIIR) {
+    effects.push_back(*config.effectIIR);
+  }
+  if (config.effectVibrato) {
+    effects.push_back(*config.effectVibrato);
+  }
+  if (config.effectTremolo) {
+    effects.push_back(*config.effectTremolo);
+  }
+  if (config.effectPhaseDist) {
+    effects.push_back(*config.effectPhaseDist);
+  }
+  if (config.effectGainDist) {
+    effects.push_back(*config.effectGainDist);
+  }
+
+  Effect<float> reverb;
+  if (config.effectReverb) {
+    reverb = PresetEffects::syntheticReverb(1.0, 0.7);
+  } else {
+    reverb = PresetEffects::syntheticReverb(1.0, 0.0);
+  }
+  effects.push_back(reverb);
+  stream.prepareSound(Config::instance().getSampleRate(), config.adsr, effects);
+  if (config.legatoSpeed) {
+    stream.setLegato(true, *config.legatoSpeed);
+    stream.setGlide(config.glideMode, config.glideCurve);
+  }
+
+  // Setup metronome in the keyboardstream looper
+  Looper &looper = stream.getLooper();
+  if (!looper.setMetronomeSampler(config.metronomeHigh, config.metronomeLow)) {
+    printf("Failed to load metronome sounds:\n");
+    printf("  metronome-low:  %s\n", config.metronomeLow.c_str());
+    printf("  metronome-high: %s\n", config.metronomeHigh.c_str());
+    printf("Are they readable 16 bit wave-files?\n");
+  }
+  looper.setBPM(static_cast<float>(Config::instance().getMetronomeBPM()));
+  looper.setMetronomeVolume(Config::instance().getMetronomeVolume());
+  looper.setNumBars(config.looperBars);
+  if (config.metronomeActive) {
+    looper.enableMetronome(true);
+  } else {
+    looper.enableMetronome(false);
+  }
+
+  if (config.looperActive) {
+    looper.setRecording(true);
+  }
+}
+
 void start_http_server(KeyboardStream *kbs, int port) {
   char portStr[20];
   memset(portStr, 0, sizeof(portStr));
@@ -361,6 +631,13 @@ void start_http_server(KeyboardStream *kbs, int port) {
   mg_set_request_handler(ctx, "/api/config", config_api_handler, kbs);
   mg_set_request_handler(ctx, "/api/presets", presets_api_handler, kbs);
   mg_set_request_handler(ctx, "/api/recorder", recorder_handler, kbs);
+  mg_set_request_handler(ctx, "/api/sequencer", sequencer_handler, kbs);
+  mg_set_request_handler(ctx, "/api/stream", stream_handler, kbs);
+  mg_set_websocket_handler(ctx, "/ws/input", input_ws_connect_handler,
+                           nullptr, input_ws_data_handler, nullptr, kbs);
+  mg_set_websocket_handler(ctx, "/ws/scope", scope_ws_connect_handler,
+                           scope_ws_ready_handler, scope_ws_data_handler,
+                           scope_ws_close_handler, kbs);
 
   term::print("\nHttp server for synth configuration running on port %d, "
               "http://localhost:%d\n",
@@ -373,7 +650,70 @@ void start_http_server(KeyboardStream *kbs, int port) {
   mg_stop(ctx);
 }
 
+static volatile std::sig_atomic_t stopRequested = 0;
+
+// Server mode: 'config.sessions' synths without an audio device, each with
+// its own API under /api/session/{id}/ and input websocket at
+// /ws/session/{id}/input. Runs until interrupted.
+int run_session_server(KeyboardStreamPlayConfig &config) {
+  // The sessions share one pool of render threads, rather than every
+  // session having a pool of its own
+  const int workers = Config::instance().getRenderWorkers();
+  Config::instance().setRenderWorkers(0);
+
+  const Session::Output output =
+      *Session::outputFromString(config.sessionOutput);
+  if (output == Session::Output::Wave) {
+    std::error_code error;
+    std::filesystem::create_directories(config.sessionDirectory, error);
+  }
+  printf("Preparing %d sessions...\n", config.sessions);
+  SessionServer server(
+      config.sessions, output, config.sessionDirectory, workers,
+      [&config](KeyboardStream &stream) { prepareStream(stream, config); });
+
+  char portStr[20];
+  snprintf(portStr, sizeof(portStr), "%d", config.port);
+  const char *options[] = {"document_root", "public", "listening_ports",
+                           portStr, nullptr};
+  struct mg_callbacks callbacks = {};
+  struct mg_context *ctx = mg_start(&callbacks, nullptr, options);
+  if (ctx == nullptr) {
+    std::fprintf(stderr,
+                 "[HTTP] ERROR: Failed to start CivetWeb server on port %d\n",
+                 config.port);
+    return 1;
+  }
+  mg_set_request_handler(ctx, "/api/session", session_api_handler, &server);
+  for (int id = 0; id < server.getNumSessions(); id++) {
+    const std::string path = "/ws/session/" + std::to_string(id) + "/input";
+    mg_set_websocket_handler(ctx, path.c_str(), input_ws_connect_handler,
+                             nullptr, input_ws_data_handler, nullptr,
+                             &server.getSession(id)->getStream());
+  }
+
+  server.start();
+  printf("Hosting %d sessions (%s output) on %d render threads, "
+         "http://localhost:%d/api/session\n",
+         server.getNumSessions(), config.sessionOutput.c_str(),
+         server.getNumWorkers() + 1, config.port);
+
+  std::signal(SIGINT, [](int) { stopRequested = 1; });
+  std::signal(SIGTERM, [](int) { stopRequested = 1; });
+  while (!stopRequested)
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  printf("\nStopping the sessions\n");
+  mg_stop(ctx);
+  server.stop();
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
+  if (parseSampleRate(argc, argv) != 0) {
+    return 1;
+  }
+
   float duration = 0.1f;
   short amplitude = 32767;
   int maxPolyphony = 50;
@@ -410,105 +750,37 @@ int main(int argc, char *argv[]) {
   } else if (c > 0) {
     return 1;
   }
+  // Once, rather than for every session prepareStream() sets up
+  printf("Adding echo with mix %f\n", config.effectEcho.mix);
+  if (config.sessions > 0) {
+    return run_session_server(config);
+  }
 
   KeyboardStream stream(Config::instance().getSampleRate(), config.tuning);
   bool running = true;
   int port = config.port;
-  if (SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO) < 0) {
-    std::cerr << "SDL_Init failed: " << SDL_GetError() << std::endl;
-    return 1;
-  }
 
-  SDL_AudioSpec desired, obtained;
-  SDL_zero(desired);
-  desired.freq = Config::instance().getSampleRate();
-  desired.format = AUDIO_F32SYS;
-  desired.channels = 1;
-  desired.samples = Config::instance().getBufferSize();
-  desired.callback = SDL2AudioCallback;
-  desired.userdata = &stream;
-
-  if (SDL_OpenAudio(&desired, &obtained) < 0) {
-    std::cerr << "SDL_OpenAudio failed: " << SDL_GetError() << std::endl;
+  std::unique_ptr<AudioBackend> backend =
+      config.audioBackend == "sdl"
+          ? std::make_unique<SdlAudioBackend>()
+          : AudioBackend::create(config.audioBackend, config.audioFile);
+  if (!backend->open(Config::instance().getSampleRate(),
+                     Config::instance().getChannels(),
+                     static_cast<int>(Config::instance().getBufferSize()),
+                     [&stream](float *buffer, int len) {
+                       stream.lock();
+                       stream.fillBuffer(buffer, len);
+                       stream.unlock();
+                     })) {
     return 1;
   }
 
   // stream.startKeypressWatchdog();
 
-  SDL_PauseAudio(0); // Start audio
-
   printf("Processing buffers... preparing sound..\n");
 
-  if (config.waveFile.size() > 0) {
-    stream.loadSoundMap(config.waveFile);
-    config.waveForm = Sound::WaveForm::WaveFile;
-  }
-  stream.setLoaderFunc(loaderFunc);
-  stream.setVolume(config.volume);
-  std::vector<Effect<float>> effects;
-  // Always have an echo effect included
-  Effect<float> echo;
-  echo.effectType = Effect<float>::Type::Echo;
-  echo.config = config.effectEcho;
-  effects.push_back(echo);
-  printf("Adding echo with mix %f\n", config.effectEcho.mix);
-  // Conditionally applied effects
-  if (config.effectFIR) {
-    effects.push_back(*config.effectFIR);
-  }
-  if (config.effectChorus) {
-    effects.push_back(*config.effectChorus);
-  }
-  if (config.effectIIR) {
-    effects.push_back(*config.effectIIR);
-  }
-  if (config.effectVibrato) {
-    effects.push_back(*config.effectVibrato);
-  }
-  if (config.effectTremolo) {
-    effects.push_back(*config.effectTremolo);
-  }
-  if (config.effectPhaseDist) {
-    effects.push_back(*config.effectPhaseDist);
-  }
-  if (config.effectGainDist) {
-    effects.push_back(*config.effectGainDist);
-  }
-
-  Effect<float> reverb;
-  if (config.effectReverb) {
-    reverb = PresetEffects::syntheticReverb(1.0, 0.7);
-  } else {
-    reverb = PresetEffects::syntheticReverb(1.0, 0.0);
-  }
-  effects.push_back(reverb);
   auto start = std::chrono::high_resolution_clock::now();
-  stream.prepareSound(Config::instance().getSampleRate(), config.adsr, effects);
-  if (config.legatoSpeed) {
-    stream.setLegato(true, *config.legatoSpeed);
-  }
-
-  // Setup metronome in the keyboardstream looper
-  Looper &looper = stream.getLooper();
-  if (!looper.setMetronomeSampler(config.metronomeHigh, config.metronomeLow)) {
-    printf("Failed to load metronome sounds:\n");
-    printf("  metronome-low:  %s\n", config.metronomeLow.c_str());
-    printf("  metronome-high: %s\n", config.metronomeHigh.c_str());
-    printf("Are they are wave-files with sample rate: %d?\n",
-           Config::instance().getSampleRate());
-  }
-  looper.setBPM(static_cast<float>(Config::instance().getMetronomeBPM()));
-  looper.setMetronomeVolume(Config::instance().getMetronomeVolume());
-  looper.setNumBars(config.looperBars);
-  if (config.metronomeActive) {
-    looper.enableMetronome(true);
-  } else {
-    looper.enableMetronome(false);
-  }
-
-  if (config.looperActive) {
-    looper.setRecording(true);
-  }
+  prepareStream(stream, config);
 
   auto end = std::chrono::high_resolution_clock::now();
   auto prepTime =
@@ -518,11 +790,28 @@ int main(int argc, char *argv[]) {
          static_cast<double>(prepTime) / 1000.0);
   printf("\nSound OK!\n");
 
+  backend->start(); // Start audio
+  const auto audioStart = std::chrono::steady_clock::now();
+
   term::setup_screen();
 
   std::thread http_thread(
       [&stream, port]() { start_http_server(&stream, port); });
   http_thread.detach(); // runs independently, main thread continues
+  stream.getAnalyzer().start(config.scopeRate, scope_ws_broadcast);
+
+  MidiInput midiInput([&stream](const MidiInput::Event &event) {
+    stream.lock();
+    stream.applyMidiEvent(event);
+    stream.unlock();
+  });
+  if (config.midiInput.size() > 0) {
+    const std::string source =
+        config.midiInput == "none" ? "" : config.midiInput;
+    if (!midiInput.open(source))
+      printf("error: Unable to open MIDI input '%s'\n",
+             config.midiInput.c_str());
+  }
 
   if (config.midiFile.size() > 0) {
     term::clear_screen();
@@ -540,8 +829,13 @@ int main(int argc, char *argv[]) {
     midiFile.doTimeAnalysis();
     midiFile.linkNotePairs();
 
-    // 2) Build notesMap: startSample → vector<(noteKey, duration)>
-    std::map<int, std::vector<std::pair<std::string, float>>> notesMap;
+    // 2) Build notesMap: startSample → vector<(noteKey, duration, velocity)>
+    struct MidiNote {
+      std::string key;
+      float duration;
+      int velocity;
+    };
+    std::map<int, std::vector<MidiNote>> notesMap;
     for (int track = 0; track < midiFile.getTrackCount(); ++track) {
       int evCount = midiFile[track].size();
       for (int evIndex = 0; evIndex < evCount; ++evIndex) {
@@ -549,11 +843,11 @@ int main(int argc, char *argv[]) {
         if (!ev.isNoteOn())
           continue;
         int note = ev[1];
-        float freq = noteToFreq(note);
-        auto key = notes::getClosestNote(freq, config.tuning);
+        int velocity = ev[2];
+        const std::string &key = notes::getNoteName(note);
         float dur = ev.getDurationInSeconds();
         int startS = int(ev.seconds * Config::instance().getSampleRate());
-        notesMap[startS].emplace_back(key, dur);
+        notesMap[startS].push_back({key, dur, velocity});
       }
     }
 
@@ -570,9 +864,11 @@ int main(int argc, char *argv[]) {
                                          (long)(startSample * usPerSample));
         std::this_thread::sleep_until(when);
 
+        stream.lock();
         for (auto const &p : vec) {
-          stream.registerNote(p.first);
+          stream.registerNote(p.key, p.velocity);
         }
+        stream.unlock();
       }
     });
 
@@ -580,10 +876,12 @@ int main(int argc, char *argv[]) {
     std::thread releaseThread([&]() {
       for (auto const &[startSample, vec] : notesMap) {
         for (auto const &p : vec) {
-          long offsetUs = long(startSample * usPerSample + p.second * 1e6);
+          long offsetUs = long(startSample * usPerSample + p.duration * 1e6);
           auto when = startTimePoint + std::chrono::microseconds(offsetUs);
           std::this_thread::sleep_until(when);
-          stream.registerNoteRelease(p.first);
+          stream.lock();
+          stream.registerNoteRelease(p.key);
+          stream.unlock();
         }
       }
     });
@@ -598,12 +896,22 @@ int main(int argc, char *argv[]) {
     stream.printInstructions();
     term::refresh_if_needed();
 
-    SDL_Window *window =
-        SDL_CreateWindow("Keyboard Synth", SDL_WINDOWPOS_CENTERED,
-                         SDL_WINDOWPOS_CENTERED, 100, 100, SDL_WINDOW_SHOWN);
-    if (!window) {
+    SDL_Window *window = nullptr;
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) == 0) {
+      window =
+          SDL_CreateWindow("Keyboard Synth", SDL_WINDOWPOS_CENTERED,
+                           SDL_WINDOWPOS_CENTERED, 100, 100, SDL_WINDOW_SHOWN);
+    }
+    if (!window && config.audioBackend != "sdl") {
+      // Headless, played through the API and MIDI input only
+      printf("No window (%s), playing until interrupted\n", SDL_GetError());
+      std::signal(SIGINT, [](int) { stopRequested = 1; });
+      std::signal(SIGTERM, [](int) { stopRequested = 1; });
+      while (!stopRequested)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    } else if (!window) {
       std::cerr << "SDL_CreateWindow Error: " << SDL_GetError() << std::endl;
-      SDL_CloseAudio();
+      backend.reset();
       SDL_Quit();
       term::teardown_screen();
       return 1;
@@ -613,7 +921,7 @@ int main(int argc, char *argv[]) {
     SDL_Event event;
     bool running = true;
 
-    while (running) {
+    while (window && running) {
       while (SDL_PollEvent(&event)) {
         switch (event.type) {
 
@@ -633,12 +941,13 @@ int main(int argc, char *argv[]) {
               break;
             }
 
+            stream.lock();
             stream.registerButtonPress(ch);
+            stream.unlock();
 
             if (ch == SDLK_o || ch == SDLK_p) {
               if (mod & KMOD_SHIFT) {
                 // 'O' or 'P' (capitalized)
-                stream.teardown();
                 printf("Updating the keyboard...\n");
 
                 if (ch == SDLK_p) {
@@ -647,8 +956,14 @@ int main(int argc, char *argv[]) {
                   rankIndex = (rankIndex + presets.size() - 1) % presets.size();
                 }
 
-                stream.prepareSound(Config::instance().getSampleRate(),
-                                    config.adsr, effects);
+                // Built in the background and crossfaded to, the notes
+                // that sound keep sounding
+                const Sound::Rank<float>::Preset preset = presets[rankIndex];
+                stream.swapSynth(
+                    [preset](std::vector<KeyboardStream::Oscillator> &bank) {
+                      if (!bank.empty())
+                        bank[0].sound = preset;
+                    });
 
                 config.rankPreset = presets[rankIndex];
                 term::clear_screen();
@@ -674,7 +989,9 @@ int main(int argc, char *argv[]) {
 
         case SDL_KEYUP: {
           int ch = event.key.keysym.sym;
+          stream.lock();
           stream.registerButtonRelease(ch);
+          stream.unlock();
         } break;
         }
       }
@@ -682,11 +999,19 @@ int main(int argc, char *argv[]) {
       // Optionally you could add SDL_Delay(1); to not burn CPU
     }
 
-    SDL_DestroyWindow(window);
+    if (window)
+      SDL_DestroyWindow(window);
   }
 
   term::teardown_screen(); // End curses mode
-  SDL_CloseAudio();
+  backend->stop();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - audioStart;
+  printf("Rendered %.1f s of audio in %.1f s (%s)\n",
+         static_cast<double>(backend->getFramesRendered()) /
+             Config::instance().getSampleRate(),
+         elapsed.count(), backend->name());
+  backend.reset();
   SDL_Quit();
 
   return 0;
@@ -0,0 +1,213 @@
+#include "midiinput.hpp"
+#include <iostream>
+
+#ifdef BUILD_WITH_ALSA
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#endif
+
+MidiInput::MidiInput(Handler handler) : handler_(std::move(handler)) {}
+
+MidiInput::~MidiInput() { close(); }
+
+bool MidiInput::available() {
+#ifdef BUILD_WITH_ALSA
+  return true;
+#else
+  return false;
+#endif
+}
+
+void MidiInput::parse(const unsigned char *bytes, std::size_t count,
+                      Clock::time_point time, std::vector<Event> &events) {
+  std::size_t i = 0;
+  while (i < count) {
+    const unsigned char status = bytes[i++];
+    if (status < 0x80)
+      continue; // a data byte without a status, out of step
+    // Program change and channel pressure carry one data byte, system
+    // messages are skipped up to the next status byte
+    const int kind = status & 0xf0;
+    const std::size_t length = kind == 0xc0 || kind == 0xd0 ? 1
+                               : kind == 0xf0               ? 0
+                                                            : 2;
+    if (i + length > count)
+      break;
+    const unsigned char *data = bytes + i;
+    i += length;
+
+    Event event;
+    event.channel = status & 0x0f;
+    event.time = time;
+    switch (kind) {
+    case 0x90:
+    case 0x80:
+      event.type = kind == 0x90 && data[1] > 0 ? Event::Type::NoteOn
+                                                : Event::Type::NoteOff;
+      event.data1 = data[0] & 0x7f;
+      event.data2 = data[1] & 0x7f;
+      break;
+    case 0xb0:
+      event.type = Event::Type::Control;
+      event.data1 = data[0] & 0x7f;
+      event.data2 = data[1] & 0x7f;
+      break;
+    case 0xe0:
+      event.type = Event::Type::PitchBend;
+      event.data1 = (((data[1] & 0x7f) << 7) | (data[0] & 0x7f)) - 8192;
+      event.data2 = 0;
+      break;
+    default:
+      continue;
+    }
+    events.push_back(event);
+  }
+}
+
+#ifdef BUILD_WITH_ALSA
+
+bool MidiInput::open(const std::string &source) {
+  close();
+
+  snd_seq_t *seq = nullptr;
+  if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) <
+      0) {
+    std::cerr << "Error: Unable to open the ALSA sequencer" << std::endl;
+    return false;
+  }
+  snd_seq_set_client_name(seq, "keyboard-synth");
+  int port = snd_seq_create_simple_port(
+      seq, "input", SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+      SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+  if (port < 0) {
+    std::cerr << "Error: Unable to create an ALSA sequencer port" << std::endl;
+    snd_seq_close(seq);
+    return false;
+  }
+
+  if (!source.empty()) {
+    snd_seq_addr_t addr;
+    if (snd_seq_parse_address(seq, &addr, source.c_str()) < 0 ||
+        snd_seq_connect_from(seq, port, addr.client, addr.port) < 0) {
+      std::cerr << "Error: Unable to connect to MIDI source: " << source
+                << std::endl;
+      snd_seq_close(seq);
+      return false;
+    }
+  }
+
+  seq_ = seq;
+  port_ = port;
+  running_ = true;
+  reader_ = std::thread(&MidiInput::readLoop, this);
+  return true;
+}
+
+void MidiInput::close() {
+  running_ = false;
+  if (reader_.joinable())
+    reader_.join();
+  if (seq_) {
+    snd_seq_close(static_cast<snd_seq_t *>(seq_));
+    seq_ = nullptr;
+    port_ = -1;
+  }
+}
+
+void MidiInput::readLoop() {
+  auto *seq = static_cast<snd_seq_t *>(seq_);
+  const int count = snd_seq_poll_descriptors_count(seq, POLLIN);
+  std::vector<pollfd> fds(count);
+  snd_seq_poll_descriptors(seq, fds.data(), count, POLLIN);
+
+  while (running_) {
+    // Wakes up now and then to see if it should stop
+    if (poll(fds.data(), count, 100) <= 0)
+      continue;
+
+    snd_seq_event_t *ev = nullptr;
+    int result;
+    while ((result = snd_seq_event_input(seq, &ev)) >= 0 || result == -ENOSPC) {
+      // -ENOSPC: the input queue overran and events were lost, keep going
+      if (result < 0 || !ev)
+        continue;
+
+      Event event;
+      event.time = Clock::now();
+      switch (ev->type) {
+      case SND_SEQ_EVENT_NOTEON:
+      case SND_SEQ_EVENT_NOTEOFF:
+        // A note on without velocity is a note off
+        event.type = ev->type == SND_SEQ_EVENT_NOTEON && ev->data.note.velocity
+                         ? Event::Type::NoteOn
+                         : Event::Type::NoteOff;
+        event.channel = ev->data.note.channel;
+        event.data1 = ev->data.note.note;
+        event.data2 = ev->data.note.velocity;
+        break;
+      case SND_SEQ_EVENT_PITCHBEND:
+        event.type = Event::Type::PitchBend;
+        event.channel = ev->data.control.channel;
+        event.data1 = ev->data.control.value;
+        event.data2 = 0;
+        break;
+      case SND_SEQ_EVENT_CONTROLLER:
+        event.type = Event::Type::Control;
+        event.channel = ev->data.control.channel;
+        event.data1 = static_cast<int>(ev->data.control.param);
+        event.data2 = ev->data.control.value;
+        break;
+      default:
+        continue;
+      }
+      handler_(event);
+    }
+  }
+}
+
+std::vector<std::string> MidiInput::listSources() {
+  std::vector<std::string> sources;
+  snd_seq_t *seq = nullptr;
+  if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, 0) < 0)
+    return sources;
+
+  snd_seq_client_info_t *client;
+  snd_seq_port_info_t *port;
+  snd_seq_client_info_alloca(&client);
+  snd_seq_port_info_alloca(&port);
+  const unsigned readable = SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+
+  snd_seq_client_info_set_client(client, -1);
+  while (snd_seq_query_next_client(seq, client) >= 0) {
+    const int id = snd_seq_client_info_get_client(client);
+    if (id == SND_SEQ_CLIENT_SYSTEM || id == snd_seq_client_id(seq))
+      continue;
+    snd_seq_port_info_set_client(port, id);
+    snd_seq_port_info_set_port(port, -1);
+    while (snd_seq_query_next_port(seq, port) >= 0) {
+      if ((snd_seq_port_info_get_capability(port) & readable) != readable)
+        continue;
+      sources.push_back(std::to_string(id) + ":" +
+                        std::to_string(snd_seq_port_info_get_port(port)) +
+                        " " + snd_seq_port_info_get_name(port));
+    }
+  }
+
+  snd_seq_close(seq);
+  return sources;
+}
+
+#else
+
+bool MidiInput::open(const std::string &) {
+  std::cerr << "Error: Built without ALSA, no live MIDI input" << std::endl;
+  return false;
+}
+
+void MidiInput::close() {}
+
+void MidiInput::readLoop() {}
+
+std::vector<std::string> MidiInput::listSources() { return {}; }
+
+#endif
@@ -0,0 +1,155 @@
+#include "networksink.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+void putLE(std::string &out, std::uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    out += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+} // namespace
+
+NetworkSink::NetworkSink(int sampleRate, int channels)
+    : sampleRate_(sampleRate), channels_(std::max(channels, 1)),
+      // Half a second of audio, many times what the encoder drains at once
+      ring_(static_cast<std::size_t>(sampleRate) * channels_ / 2),
+      history_(static_cast<std::size_t>(sampleRate) * channels_ * 2 *
+               HISTORY_MS / 1000) {
+  incoming_.resize(ring_.capacity());
+  encoded_.resize(ring_.capacity() * 2);
+}
+
+NetworkSink::~NetworkSink() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closing_ = true;
+    running_ = false;
+    wake_.notify_all();
+    // The listeners' read() return false now, but they run on the server's
+    // threads and still hold the sink until they leave()
+    wake_.wait(lock, [this] { return listeners_ == 0; });
+  }
+  if (thread_.joinable())
+    thread_.join();
+}
+
+// --- Audio thread ---
+void NetworkSink::write(const float *interleaved, int frames) {
+  if (!active_.load(std::memory_order_relaxed))
+    return;
+  // Whole blocks or nothing, so that the channels stay in step
+  const std::size_t count = static_cast<std::size_t>(frames) * channels_;
+  if (ring_.writeAvailable() < count) {
+    dropped_++;
+    return;
+  }
+  ring_.push(interleaved, count);
+}
+
+// --- Listeners ---
+std::uint64_t NetworkSink::join() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!running_ && !closing_) {
+    // The encoder stops when the last listener leaves
+    if (thread_.joinable())
+      thread_.join();
+    running_ = true;
+    thread_ = std::thread(&NetworkSink::run, this);
+  }
+  listeners_++;
+  active_ = true;
+  return written_;
+}
+
+void NetworkSink::leave() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  listeners_ = std::max(listeners_ - 1, 0);
+  active_ = listeners_ > 0;
+  if (listeners_ == 0)
+    wake_.notify_all();
+}
+
+bool NetworkSink::read(std::uint64_t &position, std::vector<char> &out,
+                       std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  wake_.wait_for(lock, timeout,
+                 [&] { return closing_ || written_ > position; });
+  out.clear();
+  if (closing_)
+    return false;
+
+  const std::uint64_t size = history_.size();
+  if (written_ - position > size) {
+    // Too far behind, the oldest audio is gone. Carries on from half a
+    // history back, on a frame boundary.
+    const std::uint64_t frame = static_cast<std::uint64_t>(channels_) * 2;
+    position = written_ - (size / 2) / frame * frame;
+  }
+  out.resize(static_cast<std::size_t>(written_ - position));
+  // At most two spans, the second from the start of the ring
+  const std::size_t start = static_cast<std::size_t>(position % size);
+  const std::size_t first = std::min(out.size(), history_.size() - start);
+  std::memcpy(out.data(), history_.data() + start, first);
+  std::memcpy(out.data() + first, history_.data(), out.size() - first);
+  position = written_;
+  return true;
+}
+
+std::string NetworkSink::waveHeader() const {
+  // The sizes are left at their largest, the stream has no end
+  const std::uint32_t blockAlign = channels_ * 2;
+  std::string header = "RIFF";
+  putLE(header, 0xffffffff, 4);
+  header += "WAVEfmt ";
+  putLE(header, 16, 4);
+  putLE(header, 1, 2); // PCM
+  putLE(header, channels_, 2);
+  putLE(header, sampleRate_, 4);
+  putLE(header, sampleRate_ * blockAlign, 4);
+  putLE(header, blockAlign, 2);
+  putLE(header, 16, 2);
+  header += "data";
+  putLE(header, 0xffffffff, 4);
+  return header;
+}
+
+// --- Encoder thread ---
+void NetworkSink::run() {
+  const auto period = std::chrono::milliseconds(ENCODE_MS);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    wake_.wait_for(lock, period,
+                   [this] { return !running_ || listeners_ == 0; });
+    if (listeners_ == 0) {
+      // No one to encode for. What the audio thread wrote before it saw
+      // that is stale by the time anyone listens again.
+      running_ = false;
+      while (ring_.pop(incoming_.data(), incoming_.size()) > 0) {
+      }
+    }
+    if (!running_)
+      break;
+    lock.unlock();
+
+    const std::size_t n = ring_.pop(incoming_.data(), incoming_.size());
+    for (std::size_t i = 0; i < n; i++) {
+      const float s = std::clamp(incoming_[i], -1.0f, 1.0f);
+      const auto value = static_cast<std::uint16_t>(
+          static_cast<std::int16_t>(s * 32767.0f));
+      encoded_[2 * i] = static_cast<char>(value & 0xff);
+      encoded_[2 * i + 1] = static_cast<char>(value >> 8);
+    }
+
+    lock.lock();
+    const std::size_t bytes = 2 * n;
+    const std::size_t start =
+        static_cast<std::size_t>(written_ % history_.size());
+    const std::size_t first = std::min(bytes, history_.size() - start);
+    std::memcpy(history_.data() + start, encoded_.data(), first);
+    std::memcpy(history_.data(), encoded_.data() + first, bytes - first);
+    written_ += bytes;
+    if (n > 0)
+      wake_.notify_all();
+  }
+  wake_.notify_all();
+}
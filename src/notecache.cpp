@@ -0,0 +1,208 @@
+#include "notecache.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+constexpr char MAGIC[4] = {'K', 'S', 'N', 'C'};
+constexpr std::uint32_t VERSION = 1;
+constexpr const char *EXTENSION = ".notes";
+
+// Size of a note in the table
+constexpr std::size_t ENTRY_SIZE = 4 + 4 + 8 + 8;
+
+template <typename T> void put(std::string &out, T value) {
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, &value, sizeof(T));
+  out.append(bytes, sizeof(T));
+}
+
+// Reads a T at 'offset' of the mapping, false past its end
+template <typename T>
+bool get(const char *data, std::size_t size, std::size_t &offset, T &value) {
+  if (size < sizeof(T) || offset > size - sizeof(T))
+    return false;
+  std::memcpy(&value, data + offset, sizeof(T));
+  offset += sizeof(T);
+  return true;
+}
+
+std::size_t align(std::size_t offset) {
+  return (offset + NoteCache::ALIGNMENT - 1) / NoteCache::ALIGNMENT *
+         NoteCache::ALIGNMENT;
+}
+
+// FNV-1a, the same on every run and every machine
+std::uint64_t hashOf(const std::string &text) {
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : text) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+} // namespace
+
+NoteCache::Mapping::~Mapping() {
+  if (address_)
+    munmap(address_, size_);
+}
+
+NoteCache::NoteCache(const std::filesystem::path &directory)
+    : directory_(directory) {
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+  if (error) {
+    std::cerr << "Error: Unable to create the note cache directory "
+              << directory_ << ": " << error.message() << std::endl;
+  }
+}
+
+std::filesystem::path
+NoteCache::fileFor(const std::string &description) const {
+  char hash[20];
+  std::snprintf(hash, sizeof(hash), "%016llx",
+                static_cast<unsigned long long>(hashOf(description)));
+  return directory_ / (std::string(hash) + EXTENSION);
+}
+
+std::unique_ptr<NoteCache::Mapping>
+NoteCache::load(const nlohmann::json &description) {
+  const std::string text = description.dump();
+  const std::filesystem::path file = fileFor(text);
+
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    ::close(fd);
+    return nullptr;
+  }
+  const std::size_t size = static_cast<std::size_t>(info.st_size);
+  void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (address == MAP_FAILED)
+    return nullptr;
+
+  std::unique_ptr<Mapping> mapping(new Mapping());
+  mapping->address_ = address;
+  mapping->size_ = size;
+  const char *data = static_cast<const char *>(address);
+
+  std::size_t offset = 0;
+  char magic[4];
+  std::uint32_t version, length, count;
+  if (!get(data, size, offset, magic) ||
+      std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      !get(data, size, offset, version) || version != VERSION ||
+      !get(data, size, offset, length) || length != text.size() ||
+      size - offset < length ||
+      std::memcmp(data + offset, text.data(), length) != 0)
+    return nullptr;
+  offset += length;
+  if (!get(data, size, offset, count))
+    return nullptr;
+
+  mapping->notes_.reserve(count);
+  for (std::uint32_t i = 0; i < count; i++) {
+    Note note;
+    std::uint64_t start, bytes;
+    if (!get(data, size, offset, note.format) ||
+        !get(data, size, offset, note.sampleRate) ||
+        !get(data, size, offset, start) || !get(data, size, offset, bytes) ||
+        start > size || bytes > size - start)
+      return nullptr;
+    note.data = data + start;
+    note.bytes = static_cast<std::size_t>(bytes);
+    mapping->notes_.push_back(note);
+  }
+
+  // Every note is about to be read
+  madvise(address, size, MADV_WILLNEED);
+  // Used, so it is the last to be evicted
+  std::error_code error;
+  std::filesystem::last_write_time(
+      file, std::filesystem::file_time_type::clock::now(), error);
+  return mapping;
+}
+
+bool NoteCache::save(const nlohmann::json &description,
+                     const std::vector<Note> &notes) {
+  const std::string text = description.dump();
+  const std::filesystem::path file = fileFor(text);
+
+  std::string header(MAGIC, sizeof(MAGIC));
+  put<std::uint32_t>(header, VERSION);
+  put<std::uint32_t>(header, static_cast<std::uint32_t>(text.size()));
+  header += text;
+  put<std::uint32_t>(header, static_cast<std::uint32_t>(notes.size()));
+
+  std::size_t offset = align(header.size() + notes.size() * ENTRY_SIZE);
+  std::vector<std::size_t> offsets;
+  offsets.reserve(notes.size());
+  for (const Note &note : notes) {
+    offsets.push_back(offset);
+    put<std::uint32_t>(header, note.format);
+    put<std::uint32_t>(header, note.sampleRate);
+    put<std::uint64_t>(header, offset);
+    put<std::uint64_t>(header, note.bytes);
+    offset = align(offset + note.bytes);
+  }
+
+  // Written aside and renamed over, a crash leaves no half written cache
+  std::filesystem::path tmp = file;
+  tmp += ".tmp";
+  {
+    std::ofstream stream(tmp, std::ios::binary | std::ios::trunc);
+    stream.write(header.data(), static_cast<std::streamsize>(header.size()));
+    std::size_t written = header.size();
+    const char padding[ALIGNMENT] = {0};
+    for (std::size_t i = 0; i < notes.size(); i++) {
+      stream.write(padding,
+                   static_cast<std::streamsize>(offsets[i] - written));
+      stream.write(static_cast<const char *>(notes[i].data),
+                   static_cast<std::streamsize>(notes[i].bytes));
+      written = offsets[i] + notes[i].bytes;
+    }
+    if (!stream) {
+      std::cerr << "Error: Unable to write the note cache " << tmp
+                << std::endl;
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp, file, error);
+  if (error) {
+    std::cerr << "Error: Unable to write the note cache " << file << ": "
+              << error.message() << std::endl;
+    return false;
+  }
+
+  evict();
+  return true;
+}
+
+void NoteCache::evict() {
+  std::error_code error;
+  std::vector<std::pair<std::filesystem::file_time_type,
+                        std::filesystem::path>>
+      files;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(directory_, error)) {
+    if (entry.path().extension() == EXTENSION)
+      files.emplace_back(entry.last_write_time(error), entry.path());
+  }
+  if (files.size() <= MAX_FILES)
+    return;
+  std::sort(files.begin(), files.end(),
+            [](const auto &a, const auto &b) { return a.first > b.first; });
+  for (std::size_t i = MAX_FILES; i < files.size(); i++)
+    std::filesystem::remove(files[i].second, error);
+}
@@ -0,0 +1,319 @@
+#include "presetstore.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace {
+constexpr char MAGIC[4] = {'K', 'S', 'P', 'R'};
+constexpr std::uint32_t VERSION = 1;
+constexpr std::uint8_t BLOB_F32 = 1;
+constexpr std::uint8_t BLOB_I16 = 2;
+constexpr const char *EXTENSION = ".preset";
+
+struct Blob {
+  std::uint8_t type;
+  std::vector<char> data;
+};
+
+void putU32(std::string &out, std::uint32_t value) {
+  char bytes[4];
+  std::memcpy(bytes, &value, 4);
+  out.append(bytes, 4);
+}
+
+bool getU32(std::istream &in, std::uint32_t &value) {
+  char bytes[4];
+  if (!in.read(bytes, 4))
+    return false;
+  std::memcpy(&value, bytes, 4);
+  return true;
+}
+
+// Whether 'array' is long enough, and all numbers, to go into a blob
+bool isBlobArray(const nlohmann::json &array) {
+  if (!array.is_array() || array.size() < PresetStore::MIN_BLOB_SIZE)
+    return false;
+  return std::all_of(array.begin(), array.end(),
+                     [](const nlohmann::json &v) { return v.is_number(); });
+}
+
+// Replaces the long arrays of 'j' with blob references, in place
+void extractBlobs(nlohmann::json &j, std::vector<Blob> &blobs) {
+  if (isBlobArray(j)) {
+    // Whole numbers that fit keep being whole numbers
+    const bool shorts =
+        std::all_of(j.begin(), j.end(), [](const nlohmann::json &v) {
+          if (!v.is_number_integer())
+            return false;
+          const auto i = v.get<std::int64_t>();
+          return i >= std::numeric_limits<std::int16_t>::min() &&
+                 i <= std::numeric_limits<std::int16_t>::max();
+        });
+    Blob blob;
+    blob.type = shorts ? BLOB_I16 : BLOB_F32;
+    const std::size_t size = shorts ? sizeof(std::int16_t) : sizeof(float);
+    blob.data.resize(j.size() * size);
+    for (std::size_t i = 0; i < j.size(); i++) {
+      if (shorts) {
+        const auto value = j[i].get<std::int16_t>();
+        std::memcpy(&blob.data[i * size], &value, size);
+      } else {
+        const auto value = j[i].get<float>();
+        std::memcpy(&blob.data[i * size], &value, size);
+      }
+    }
+    j = {{"$blob", blobs.size()}};
+    blobs.push_back(std::move(blob));
+    return;
+  }
+  if (j.is_object() || j.is_array()) {
+    for (auto &child : j)
+      extractBlobs(child, blobs);
+  }
+}
+
+// Puts the blobs back where 'j' refers to them, false on a bad reference
+bool insertBlobs(nlohmann::json &j, const std::vector<Blob> &blobs) {
+  if (j.is_object() && j.size() == 1 && j.contains("$blob")) {
+    if (!j["$blob"].is_number_unsigned() ||
+        j["$blob"].get<std::size_t>() >= blobs.size())
+      return false;
+    const Blob &blob = blobs[j["$blob"].get<std::size_t>()];
+    nlohmann::json array = nlohmann::json::array();
+    if (blob.type == BLOB_I16) {
+      for (std::size_t i = 0; i < blob.data.size(); i += 2) {
+        std::int16_t value;
+        std::memcpy(&value, &blob.data[i], 2);
+        array.push_back(value);
+      }
+    } else {
+      for (std::size_t i = 0; i < blob.data.size(); i += 4) {
+        float value;
+        std::memcpy(&value, &blob.data[i], 4);
+        array.push_back(value);
+      }
+    }
+    j = std::move(array);
+    return true;
+  }
+  if (j.is_object() || j.is_array()) {
+    for (auto &child : j) {
+      if (!insertBlobs(child, blobs))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool validRecord(const nlohmann::json &record) {
+  return record.is_object() && record.contains("name") &&
+         record["name"].is_string() && record.contains("configuration");
+}
+
+std::string datetimeOf(const nlohmann::json &record) {
+  if (record.contains("datetime") && record["datetime"].is_string())
+    return record["datetime"];
+  return "";
+}
+} // namespace
+
+PresetStore::PresetStore(const std::filesystem::path &directory,
+                         const std::filesystem::path &legacyFile)
+    : directory_(directory) {
+  std::error_code error;
+  const bool existed = std::filesystem::exists(directory_, error);
+  std::filesystem::create_directories(directory_, error);
+  if (error) {
+    std::cerr << "Error: Unable to create the preset directory "
+              << directory_ << ": " << error.message() << std::endl;
+    return;
+  }
+
+  for (const auto &file :
+       std::filesystem::directory_iterator(directory_, error)) {
+    if (file.path().extension() != EXTENSION)
+      continue;
+    auto record = read(file.path(), true);
+    if (!record) {
+      std::cerr << "Error: Ignoring unreadable preset " << file.path()
+                << std::endl;
+      continue;
+    }
+    const std::string name = (*record)["name"];
+    records_[name] = Record{{name, datetimeOf(*record)}, file.path(), nullptr};
+  }
+
+  if (!existed && !legacyFile.empty())
+    importLegacy(legacyFile);
+}
+
+void PresetStore::importLegacy(const std::filesystem::path &legacyFile) {
+  std::ifstream in(legacyFile);
+  if (!in.good())
+    return;
+  nlohmann::json legacy = nlohmann::json::parse(in, nullptr, false);
+  if (!legacy.is_object() || !legacy.contains("presets") ||
+      !legacy["presets"].is_array())
+    return;
+  for (const auto &preset : legacy["presets"]) {
+    if (validRecord(preset))
+      save(preset["name"], datetimeOf(preset), preset["configuration"]);
+  }
+}
+
+std::filesystem::path PresetStore::fileFor(const std::string &name) const {
+  // Readable, and told apart by a hash when names only differ in the
+  // characters that are left out
+  std::string stem;
+  for (char c : name) {
+    if (std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_')
+      stem += c;
+    if (stem.size() == 48)
+      break;
+  }
+  char hash[20];
+  std::snprintf(hash, sizeof(hash), "%08x",
+                static_cast<unsigned>(std::hash<std::string>{}(name)));
+  return directory_ / (stem + "-" + hash + EXTENSION);
+}
+
+bool PresetStore::save(const std::string &name, const std::string &datetime,
+                       const nlohmann::json &configuration) {
+  nlohmann::json record = {{"name", name},
+                           {"datetime", datetime},
+                           {"configuration", configuration}};
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = records_.find(name);
+  const std::filesystem::path file =
+      it != records_.end() ? it->second.file : fileFor(name);
+  if (!write(file, record))
+    return false;
+  records_[name] =
+      Record{{name, datetime},
+             file,
+             std::make_shared<const nlohmann::json>(configuration)};
+  return true;
+}
+
+std::optional<nlohmann::json> PresetStore::load(const std::string &name) {
+  std::filesystem::path file;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = records_.find(name);
+    if (it == records_.end())
+      return std::nullopt;
+    if (it->second.configuration)
+      return *it->second.configuration;
+    file = it->second.file;
+  }
+
+  // Read without holding the store
+  auto record = read(file, false);
+  if (!record)
+    return std::nullopt;
+  auto configuration =
+      std::make_shared<const nlohmann::json>((*record)["configuration"]);
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = records_.find(name);
+  // Unless it was saved over meanwhile
+  if (it != records_.end() && it->second.file == file &&
+      !it->second.configuration)
+    it->second.configuration = configuration;
+  return *configuration;
+}
+
+std::vector<PresetStore::Entry> PresetStore::list() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::vector<Entry> entries;
+  entries.reserve(records_.size());
+  for (const auto &[name, record] : records_)
+    entries.push_back(record.entry);
+  return entries;
+}
+
+bool PresetStore::write(const std::filesystem::path &file,
+                        const nlohmann::json &record) {
+  nlohmann::json header = record;
+  std::vector<Blob> blobs;
+  extractBlobs(header, blobs);
+  const std::string text = header.dump();
+
+  std::string out(MAGIC, sizeof(MAGIC));
+  putU32(out, VERSION);
+  putU32(out, static_cast<std::uint32_t>(text.size()));
+  out += text;
+  putU32(out, static_cast<std::uint32_t>(blobs.size()));
+  for (const Blob &blob : blobs) {
+    out += static_cast<char>(blob.type);
+    const std::size_t size =
+        blob.type == BLOB_I16 ? sizeof(std::int16_t) : sizeof(float);
+    putU32(out, static_cast<std::uint32_t>(blob.data.size() / size));
+    out.append(blob.data.data(), blob.data.size());
+  }
+
+  // Written aside and renamed over, a crash leaves the old preset
+  std::filesystem::path tmp = file;
+  tmp += ".tmp";
+  {
+    std::ofstream stream(tmp, std::ios::binary | std::ios::trunc);
+    if (!stream.write(out.data(), static_cast<std::streamsize>(out.size()))) {
+      std::cerr << "Error: Unable to write preset " << tmp << std::endl;
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp, file, error);
+  if (error) {
+    std::cerr << "Error: Unable to write preset " << file << ": "
+              << error.message() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::optional<nlohmann::json>
+PresetStore::read(const std::filesystem::path &file, bool headerOnly) {
+  std::ifstream in(file, std::ios::binary);
+  char magic[4];
+  std::uint32_t version, length;
+  if (!in.read(magic, 4) || std::memcmp(magic, MAGIC, 4) != 0 ||
+      !getU32(in, version) || version != VERSION || !getU32(in, length))
+    return std::nullopt;
+
+  std::string text(length, '\0');
+  if (!in.read(text.data(), length))
+    return std::nullopt;
+  nlohmann::json record = nlohmann::json::parse(text, nullptr, false);
+  if (!validRecord(record))
+    return std::nullopt;
+  if (headerOnly)
+    return record;
+
+  std::uint32_t count;
+  if (!getU32(in, count))
+    return std::nullopt;
+  std::vector<Blob> blobs(count);
+  for (Blob &blob : blobs) {
+    char type;
+    std::uint32_t values;
+    if (!in.get(type) || !getU32(in, values))
+      return std::nullopt;
+    blob.type = static_cast<std::uint8_t>(type);
+    if (blob.type != BLOB_F32 && blob.type != BLOB_I16)
+      return std::nullopt;
+    const std::size_t size =
+        blob.type == BLOB_I16 ? sizeof(std::int16_t) : sizeof(float);
+    blob.data.resize(static_cast<std::size_t>(values) * size);
+    if (!in.read(blob.data.data(),
+                 static_cast<std::streamsize>(blob.data.size())))
+      return std::nullopt;
+  }
+  if (!insertBlobs(record, blobs))
+    return std::nullopt;
+  return record;
+}
@@ -0,0 +1,275 @@
+#include "resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define RESAMPLER_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#endif
+
+namespace {
+// Zero crossings of the sinc on each side, at the lower of the two rates
+constexpr int ZERO_CROSSINGS = 16;
+// Passband edge relative to the lower Nyquist frequency
+constexpr double ROLLOFF = 0.94;
+// Kaiser beta, about 90 dB stopband attenuation
+constexpr double KAISER_BETA = 8.6;
+// Ratios with more phases than this round to the nearest phase
+constexpr int MAX_PHASES = 4096;
+// Consumed input kept in the history before it is dropped
+constexpr std::size_t COMPACT_SIZE = 4096;
+
+double besselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+double sinc(double x) {
+  if (std::abs(x) < 1e-9)
+    return 1.0;
+  return std::sin(M_PI * x) / (M_PI * x);
+}
+
+// n is a multiple of 8
+inline float dot(const float *a, const float *b, int n) {
+#if defined(RESAMPLER_SSE)
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  for (int i = 0; i < n; i += 8) {
+    acc0 =
+        _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                       _mm_loadu_ps(b + i + 4)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(RESAMPLER_NEON)
+  float32x4_t acc0 = vdupq_n_f32(0.0f);
+  float32x4_t acc1 = vdupq_n_f32(0.0f);
+  for (int i = 0; i < n; i += 8) {
+    acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  float32x4_t acc = vaddq_f32(acc0, acc1);
+  return (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) +
+         (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#else
+  float acc[4] = {0, 0, 0, 0};
+  for (int i = 0; i < n; i += 4) {
+    acc[0] += a[i] * b[i];
+    acc[1] += a[i + 1] * b[i + 1];
+    acc[2] += a[i + 2] * b[i + 2];
+    acc[3] += a[i + 3] * b[i + 3];
+  }
+  return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+}
+} // namespace
+
+// --------------------------- Filter banks ----------------------------
+
+std::shared_ptr<const Resampler::FilterBank>
+Resampler::getFilterBank(int up, int down) {
+  static std::mutex mtx;
+  static std::map<std::pair<int, int>, std::shared_ptr<const FilterBank>>
+      banks;
+
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = banks.find({up, down});
+  if (it != banks.end())
+    return it->second;
+
+  auto bank = std::make_shared<FilterBank>();
+  bank->up = up;
+  bank->down = down;
+  bank->phases = std::min(up, MAX_PHASES);
+
+  // Cutoff in input samples, lowered when decimating to reject aliases
+  const double fc = ROLLOFF * std::min(1.0, static_cast<double>(up) /
+                                                 static_cast<double>(down));
+  bank->halfTaps = static_cast<int>(std::ceil(ZERO_CROSSINGS / fc));
+  bank->taps = (2 * bank->halfTaps + 7) / 8 * 8;
+
+  // One extra row so that rounding up to 'phases' never reads out of range
+  const int rows = bank->phases + 1;
+  bank->coefficients.assign(static_cast<std::size_t>(rows) * bank->taps, 0.0f);
+
+  const double H = bank->halfTaps;
+  const double i0Beta = besselI0(KAISER_BETA);
+  for (int p = 0; p < rows; p++) {
+    const double frac = static_cast<double>(p) / bank->phases;
+    float *row = &bank->coefficients[static_cast<std::size_t>(p) * bank->taps];
+
+    double sum = 0.0;
+    for (int j = 0; j < 2 * bank->halfTaps; j++) {
+      // Distance from the output position to input sample j
+      double t = frac + H - 1.0 - j;
+      double r = t / H;
+      double w = (std::abs(r) < 1.0)
+                     ? besselI0(KAISER_BETA * std::sqrt(1.0 - r * r)) / i0Beta
+                     : 0.0;
+      double h = fc * sinc(fc * t) * w;
+      row[j] = static_cast<float>(h);
+      sum += h;
+    }
+    // Unity gain at DC for every phase
+    if (sum != 0.0) {
+      for (int j = 0; j < 2 * bank->halfTaps; j++)
+        row[j] = static_cast<float>(row[j] / sum);
+    }
+  }
+
+  banks[{up, down}] = bank;
+  return bank;
+}
+
+// --------------------------- Resampler -------------------------------
+
+Resampler::Resampler(int srcRate, int dstRate)
+    : srcRate_(srcRate), dstRate_(dstRate) {
+  int g = std::gcd(srcRate, dstRate);
+  bank_ = getFilterBank(dstRate / g, srcRate / g);
+  reset();
+}
+
+void Resampler::reset() {
+  history_.assign(bank_->halfTaps - 1, 0.0f);
+  base_ = bank_->halfTaps - 1;
+  acc_ = 0;
+}
+
+int Resampler::getLatency() const { return bank_->taps - bank_->halfTaps; }
+
+void Resampler::process(const float *in, std::size_t len,
+                        std::vector<float> &out) {
+  const FilterBank &bank = *bank_;
+  history_.insert(history_.end(), in, in + len);
+
+  const std::size_t right = bank.taps - bank.halfTaps;
+  const std::size_t left = bank.halfTaps - 1;
+  const bool exact = bank.phases == bank.up;
+
+  // The dot product reads history_[base_ - left] to history_[base_ + right]
+  while (base_ + right < history_.size()) {
+    long long phase =
+        exact ? acc_ : (acc_ * bank.phases + bank.up / 2) / bank.up;
+    const float *coefficients =
+        &bank.coefficients[static_cast<std::size_t>(phase) * bank.taps];
+    out.push_back(dot(coefficients, &history_[base_ - left], bank.taps));
+
+    acc_ += bank.down;
+    base_ += acc_ / bank.up;
+    acc_ %= bank.up;
+  }
+
+  // Drop the input that no future output can reach, once it is at least
+  // half of the history, so that it is moved a bounded number of times
+  std::size_t consumed = std::min(base_ - left, history_.size());
+  if (consumed >= COMPACT_SIZE && 2 * consumed >= history_.size()) {
+    history_.erase(history_.begin(), history_.begin() + consumed);
+    base_ -= consumed;
+  }
+}
+
+void Resampler::flush(std::vector<float> &out) {
+  std::vector<float> tail(bank_->taps, 0.0f);
+  process(tail.data(), tail.size(), out);
+}
+
+std::vector<float> Resampler::convert(const std::vector<float> &in,
+                                      int srcRate, int dstRate) {
+  if (srcRate == dstRate || srcRate <= 0 || dstRate <= 0 || in.empty())
+    return in;
+
+  Resampler resampler(srcRate, dstRate);
+  std::size_t expected = static_cast<std::size_t>(
+      std::ceil(static_cast<double>(in.size()) * dstRate / srcRate));
+
+  std::vector<float> out;
+  out.reserve(expected + resampler.getLatency());
+  resampler.process(in.data(), in.size(), out);
+  resampler.flush(out);
+  out.resize(expected, 0.0f);
+  return out;
+}
+
+std::vector<short> Resampler::convert(const std::vector<short> &in,
+                                      int channels, int srcRate,
+                                      int dstRate) {
+  if (srcRate == dstRate || srcRate <= 0 || dstRate <= 0 || in.empty() ||
+      channels <= 0)
+    return in;
+
+  const std::size_t frames = in.size() / channels;
+  std::vector<std::vector<float>> converted(channels);
+  for (int c = 0; c < channels; c++) {
+    std::vector<float> channel(frames);
+    for (std::size_t i = 0; i < frames; i++)
+      channel[i] = static_cast<float>(in[i * channels + c]);
+    converted[c] = convert(channel, srcRate, dstRate);
+  }
+
+  const std::size_t outFrames = converted[0].size();
+  const float min = static_cast<float>(std::numeric_limits<short>::min());
+  const float max = static_cast<float>(std::numeric_limits<short>::max());
+  std::vector<short> out(outFrames * channels);
+  for (std::size_t i = 0; i < outFrames; i++) {
+    for (int c = 0; c < channels; c++) {
+      out[i * channels + c] = static_cast<short>(
+          std::lround(std::clamp(converted[c][i], min, max)));
+    }
+  }
+  return out;
+}
+
+std::vector<short> Resampler::convertCached(const std::string &key,
+                                            const std::vector<short> &in,
+                                            int channels, int srcRate,
+                                            int dstRate) {
+  if (srcRate == dstRate)
+    return in;
+
+  static std::mutex mtx;
+  static std::map<std::string, std::vector<short>> cache;
+
+  // A file that is changed on disk is converted again
+  std::string modified;
+  std::error_code error;
+  auto time = std::filesystem::last_write_time(key, error);
+  if (!error)
+    modified = std::to_string(time.time_since_epoch().count());
+
+  const std::string cacheKey = key + "|" + modified + "|" +
+                               std::to_string(channels) + "|" +
+                               std::to_string(srcRate) + ">" +
+                               std::to_string(dstRate);
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = cache.find(cacheKey);
+    if (it != cache.end())
+      return it->second;
+  }
+
+  std::vector<short> out = convert(in, channels, srcRate, dstRate);
+
+  std::lock_guard<std::mutex> lock(mtx);
+  cache[cacheKey] = out;
+  return out;
+}
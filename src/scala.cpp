@@ -0,0 +1,240 @@
+#include "scala.hpp"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace scala {
+
+namespace {
+// Lines of the file that are not comments, without trailing whitespace
+bool readLines(const std::string &file, std::vector<std::string> &lines,
+               std::string &error) {
+  std::ifstream in(file);
+  if (!in) {
+    error = "Unable to open " + file;
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line[0] == '!')
+      continue;
+    while (!line.empty() &&
+           std::isspace(static_cast<unsigned char>(line.back())))
+      line.pop_back();
+    lines.push_back(line);
+  }
+  return true;
+}
+
+// First whitespace separated token of a line
+std::string firstToken(const std::string &line) {
+  std::istringstream ss(line);
+  std::string token;
+  ss >> token;
+  return token;
+}
+
+bool parseInt(const std::string &line, int &value) {
+  std::string token = firstToken(line);
+  if (token.empty())
+    return false;
+  char *end = nullptr;
+  long v = std::strtol(token.c_str(), &end, 10);
+  if (*end != '\0')
+    return false;
+  value = static_cast<int>(v);
+  return true;
+}
+
+bool parseDouble(const std::string &line, double &value) {
+  std::string token = firstToken(line);
+  if (token.empty())
+    return false;
+  char *end = nullptr;
+  value = std::strtod(token.c_str(), &end);
+  return *end == '\0';
+}
+
+// A pitch is in cents if it contains a period, otherwise it is a ratio such
+// as 3/2 or 2
+bool parsePitch(const std::string &line, double &cents) {
+  std::string token = firstToken(line);
+  if (token.empty())
+    return false;
+  if (token.find('.') != std::string::npos)
+    return parseDouble(token, cents);
+
+  std::size_t slash = token.find('/');
+  int numerator = 0;
+  int denominator = 1;
+  if (!parseInt(token.substr(0, slash), numerator))
+    return false;
+  if (slash != std::string::npos &&
+      !parseInt(token.substr(slash + 1), denominator))
+    return false;
+  if (numerator <= 0 || denominator <= 0)
+    return false;
+  cents = 1200.0 * std::log2(static_cast<double>(numerator) / denominator);
+  return true;
+}
+
+long floorDiv(long a, long b) {
+  long q = a / b;
+  if ((a % b != 0) && ((a < 0) != (b < 0)))
+    q--;
+  return q;
+}
+} // namespace
+
+std::optional<Scale> Scale::fromFile(const std::string &file,
+                                     std::string &error) {
+  std::vector<std::string> lines;
+  if (!readLines(file, lines, error))
+    return std::nullopt;
+
+  Scale scale;
+  int count = 0;
+  if (lines.size() < 2 || !parseInt(lines[1], count) || count < 1) {
+    error = file + ": expected a description and a number of notes";
+    return std::nullopt;
+  }
+  scale.description = lines[0];
+
+  for (std::size_t l = 2;
+       l < lines.size() && static_cast<int>(scale.cents.size()) < count; l++) {
+    if (lines[l].empty())
+      continue;
+    double cents;
+    if (!parsePitch(lines[l], cents)) {
+      error = file + ": invalid pitch '" + lines[l] + "'";
+      return std::nullopt;
+    }
+    scale.cents.push_back(cents);
+  }
+  if (static_cast<int>(scale.cents.size()) != count) {
+    error = file + ": expected " + std::to_string(count) + " pitches, found " +
+            std::to_string(scale.cents.size());
+    return std::nullopt;
+  }
+  return scale;
+}
+
+std::optional<KeyboardMapping>
+KeyboardMapping::fromFile(const std::string &file, std::string &error) {
+  std::vector<std::string> lines;
+  if (!readLines(file, lines, error))
+    return std::nullopt;
+
+  std::vector<std::string> values;
+  for (const std::string &line : lines) {
+    if (!firstToken(line).empty())
+      values.push_back(line);
+  }
+
+  KeyboardMapping kbm;
+  int size = 0;
+  if (values.size() < 7 || !parseInt(values[0], size) || size < 0 ||
+      !parseInt(values[1], kbm.firstNote) ||
+      !parseInt(values[2], kbm.lastNote) ||
+      !parseInt(values[3], kbm.middleNote) ||
+      !parseInt(values[4], kbm.referenceNote) ||
+      !parseDouble(values[5], kbm.referenceFrequency) ||
+      !parseInt(values[6], kbm.octaveDegree) ||
+      kbm.referenceFrequency <= 0) {
+    error = file + ": invalid keyboard mapping header";
+    return std::nullopt;
+  }
+
+  // Keys without an entry at the end of the mapping are unmapped
+  kbm.mapping.assign(size, -1);
+  for (int i = 0; i < size && 7 + i < static_cast<int>(values.size()); i++) {
+    const std::string token = firstToken(values[7 + i]);
+    if (token == "x")
+      continue;
+    if (!parseInt(token, kbm.mapping[i]) || kbm.mapping[i] < 0) {
+      error = file + ": invalid mapping entry '" + token + "'";
+      return std::nullopt;
+    }
+  }
+  return kbm;
+}
+
+std::optional<notes::FrequencyTable>
+computeFrequencies(const Scale &scale, const KeyboardMapping &kbm,
+                   std::string &error) {
+  const long steps = static_cast<long>(scale.cents.size());
+  if (steps == 0) {
+    error = "The scale is empty";
+    return std::nullopt;
+  }
+  const double period = scale.cents.back();
+  const long mapSize = static_cast<long>(kbm.mapping.size());
+  const long octaveDegree = kbm.octaveDegree > 0 ? kbm.octaveDegree : steps;
+
+  auto degreeCents = [&](long degree) {
+    long octave = floorDiv(degree, steps);
+    long step = degree - octave * steps;
+    return octave * period + (step == 0 ? 0.0 : scale.cents[step - 1]);
+  };
+  auto keyDegree = [&](int key, long &degree) {
+    long offset = key - kbm.middleNote;
+    if (mapSize == 0) {
+      degree = offset;
+      return true;
+    }
+    long repeat = floorDiv(offset, mapSize);
+    int entry = kbm.mapping[offset - repeat * mapSize];
+    if (entry < 0)
+      return false;
+    degree = repeat * octaveDegree + entry;
+    return true;
+  };
+
+  long referenceDegree;
+  if (!keyDegree(kbm.referenceNote, referenceDegree)) {
+    error = "The reference note " + std::to_string(kbm.referenceNote) +
+            " is not mapped";
+    return std::nullopt;
+  }
+  const double referenceCents = degreeCents(referenceDegree);
+
+  notes::FrequencyTable frequencies{};
+  for (int n = notes::LOWEST_NOTE; n <= notes::HIGHEST_NOTE; n++) {
+    long degree;
+    if (n < kbm.firstNote || n > kbm.lastNote || !keyDegree(n, degree))
+      continue;
+    frequencies[n] =
+        kbm.referenceFrequency *
+        std::pow(2.0, (degreeCents(degree) - referenceCents) / 1200.0);
+  }
+  return frequencies;
+}
+
+bool load(const std::string &sclFile, const std::string &kbmFile,
+          std::string &error) {
+  std::optional<Scale> scale = Scale::fromFile(sclFile, error);
+  if (!scale)
+    return false;
+
+  KeyboardMapping kbm;
+  if (!kbmFile.empty()) {
+    std::optional<KeyboardMapping> loaded =
+        KeyboardMapping::fromFile(kbmFile, error);
+    if (!loaded)
+      return false;
+    kbm = *loaded;
+  }
+
+  std::optional<notes::FrequencyTable> frequencies =
+      computeFrequencies(*scale, kbm, error);
+  if (!frequencies)
+    return false;
+
+  notes::setScalaTuning(*frequencies, scale->description);
+  return true;
+}
+
+} // namespace scala
@@ -0,0 +1,264 @@
+#include "sequencer.hpp"
+#include "notes.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Frame of the block 'beat' falls on, or past it. A beat that rounding put
+// just before the block lands on its first frame.
+double frameOf(const Transport &transport, double beat) {
+  return std::ceil(transport.offsetOf(beat) - 1e-6);
+}
+} // namespace
+
+// --- Settings ---
+void Sequencer::setMode(Mode mode) {
+  if (mode == mode_)
+    return;
+  mode_ = mode;
+  // Whatever the old mode was playing stops, the new one starts on the
+  // next step
+  flush_ = true;
+  resync_ = true;
+  arpCounter_ = 0;
+  if (mode != Mode::Arp)
+    numHeld_ = 0;
+}
+
+void Sequencer::setSteps(const std::vector<Step> &steps) {
+  steps_.assign(steps.begin(),
+                steps.begin() + std::min<std::size_t>(steps.size(), MAX_STEPS));
+}
+
+void Sequencer::setStepLength(double beats) {
+  if (!(beats > 0.0))
+    return;
+  stepLength_ = std::clamp(beats, 1.0 / 64.0, 16.0);
+  resync_ = true;
+}
+
+void Sequencer::setGate(double gate) {
+  if (!(gate > 0.0))
+    return;
+  gate_ = std::clamp(gate, 0.01, 1.0);
+}
+
+void Sequencer::setPattern(Pattern pattern) {
+  pattern_ = pattern;
+  arpCounter_ = 0;
+}
+
+void Sequencer::setOctaves(int octaves) {
+  octaves_ = std::clamp(octaves, 1, 4);
+}
+
+// --- Arp input ---
+void Sequencer::hold(int pitch, int velocity) {
+  if (pitch < 0)
+    return;
+  release(pitch);
+  // A new chord starts the pattern over
+  if (numHeld_ == 0)
+    arpCounter_ = 0;
+  if (numHeld_ == MAX_HELD) {
+    std::copy(held_.begin() + 1, held_.end(), held_.begin());
+    std::copy(heldVelocity_.begin() + 1, heldVelocity_.end(),
+              heldVelocity_.begin());
+    numHeld_--;
+  }
+  held_[numHeld_] = pitch;
+  heldVelocity_[numHeld_] = velocity;
+  numHeld_++;
+}
+
+void Sequencer::release(int pitch) {
+  for (int i = 0; i < numHeld_; i++) {
+    if (held_[i] != pitch)
+      continue;
+    std::copy(held_.begin() + i + 1, held_.begin() + numHeld_,
+              held_.begin() + i);
+    std::copy(heldVelocity_.begin() + i + 1, heldVelocity_.begin() + numHeld_,
+              heldVelocity_.begin() + i);
+    numHeld_--;
+    return;
+  }
+}
+
+// --- Audio thread ---
+void Sequencer::push(const Event &event) {
+  if (numEvents_ < MAX_EVENTS)
+    events_[numEvents_++] = event;
+}
+
+// The note of step 'nextStep_', false for a rest
+bool Sequencer::nextNote(int &pitch, int &velocity) {
+  if (mode_ == Mode::Steps) {
+    if (steps_.empty())
+      return false;
+    const Step &step = steps_[nextStep_ % static_cast<long>(steps_.size())];
+    pitch = step.pitch;
+    velocity = step.velocity;
+    return pitch >= 0;
+  }
+
+  const int n = numHeld_;
+  if (n == 0)
+    return false;
+  // Held keys by pitch, unless played in the order they were pressed
+  std::array<int, MAX_HELD> order;
+  for (int i = 0; i < n; i++)
+    order[i] = i;
+  if (pattern_ != Pattern::Played) {
+    std::sort(order.begin(), order.begin() + n,
+              [this](int a, int b) { return held_[a] < held_[b]; });
+  }
+
+  const long length = static_cast<long>(n) * octaves_;
+  long i = 0;
+  switch (pattern_) {
+  case Pattern::Up:
+  case Pattern::Played:
+    i = arpCounter_ % length;
+    break;
+  case Pattern::Down:
+    i = length - 1 - arpCounter_ % length;
+    break;
+  case Pattern::UpDown: {
+    // Up and back down, without playing the top and bottom twice
+    const long cycle = length > 1 ? 2 * length - 2 : 1;
+    const long c = arpCounter_ % cycle;
+    i = c < length ? c : cycle - c;
+    break;
+  }
+  case Pattern::Random:
+    random_ ^= random_ << 13;
+    random_ ^= random_ >> 17;
+    random_ ^= random_ << 5;
+    i = static_cast<long>(random_ % static_cast<std::uint32_t>(length));
+    break;
+  }
+  arpCounter_++;
+
+  const int held = order[i % n];
+  pitch = held_[held] + 12 * static_cast<int>(i / n);
+  velocity = heldVelocity_[held];
+  return pitch <= notes::HIGHEST_NOTE;
+}
+
+void Sequencer::beginBlock(const Transport &transport) {
+  numEvents_ = 0;
+  if (flush_) {
+    push({0, -1, 0, false});
+    numPending_ = 0;
+    flush_ = false;
+  }
+
+  const int frames = transport.blockFrames();
+  if (mode_ == Mode::Off || transport.blockSamplesPerBeat() <= 0.0)
+    return;
+
+  // Notes of earlier blocks ending in this one
+  for (int p = 0; p < numPending_;) {
+    const double frame = frameOf(transport, pending_[p].beat);
+    if (frame < frames) {
+      push({std::max(static_cast<int>(frame), 0), pending_[p].pitch, 0,
+            false});
+      pending_[p] = pending_[--numPending_];
+    } else {
+      p++;
+    }
+  }
+
+  if (resync_) {
+    nextStep_ = static_cast<long>(
+        std::ceil(transport.blockBeat() / stepLength_ - 1e-9));
+    resync_ = false;
+  }
+
+  // Steps starting in this block, leaving room for a note on and its off
+  while (numEvents_ + 2 <= MAX_EVENTS) {
+    const double beat = nextStep_ * stepLength_;
+    const double frame = frameOf(transport, beat);
+    if (frame >= frames)
+      break;
+    const int at = std::max(static_cast<int>(frame), 0);
+
+    int pitch, velocity;
+    if (nextNote(pitch, velocity)) {
+      const double end = beat + gate_ * stepLength_;
+      const double endFrame = frameOf(transport, end);
+      if (endFrame < frames) {
+        push({at, pitch, velocity, true});
+        push({std::max(static_cast<int>(endFrame), at), pitch, 0, false});
+      } else if (numPending_ < MAX_EVENTS) {
+        push({at, pitch, velocity, true});
+        pending_[numPending_++] = {end, pitch};
+      }
+    }
+    nextStep_++;
+  }
+
+  // In frame order. Stable, so a note off of an earlier step comes before
+  // a note on of the same frame.
+  for (int i = 1; i < numEvents_; i++) {
+    const Event event = events_[i];
+    int j = i;
+    for (; j > 0 && events_[j - 1].offset > event.offset; j--)
+      events_[j] = events_[j - 1];
+    events_[j] = event;
+  }
+}
+
+// --- Names ---
+std::optional<Sequencer::Mode> Sequencer::modeFromString(const std::string &s) {
+  if (s == "off")
+    return Mode::Off;
+  if (s == "steps")
+    return Mode::Steps;
+  if (s == "arp")
+    return Mode::Arp;
+  return std::nullopt;
+}
+
+std::string Sequencer::modeToString(Mode mode) {
+  switch (mode) {
+  case Mode::Off:
+    return "off";
+  case Mode::Steps:
+    return "steps";
+  case Mode::Arp:
+    return "arp";
+  }
+  return "invalid";
+}
+
+std::optional<Sequencer::Pattern>
+Sequencer::patternFromString(const std::string &s) {
+  if (s == "up")
+    return Pattern::Up;
+  if (s == "down")
+    return Pattern::Down;
+  if (s == "updown")
+    return Pattern::UpDown;
+  if (s == "random")
+    return Pattern::Random;
+  if (s == "played")
+    return Pattern::Played;
+  return std::nullopt;
+}
+
+std::string Sequencer::patternToString(Pattern pattern) {
+  switch (pattern) {
+  case Pattern::Up:
+    return "up";
+  case Pattern::Down:
+    return "down";
+  case Pattern::UpDown:
+    return "updown";
+  case Pattern::Random:
+    return "random";
+  case Pattern::Played:
+    return "played";
+  }
+  return "invalid";
+}
@@ -0,0 +1,137 @@
+#include "session.hpp"
+#include "config.hpp"
+#include <chrono>
+#include <ctime>
+#include <iostream>
+
+namespace {
+std::uint64_t threadCpuNanos() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return static_cast<std::uint64_t>(now.tv_sec) * 1000000000ull +
+         static_cast<std::uint64_t>(now.tv_nsec);
+}
+} // namespace
+
+Session::Session(int id, Output output, const std::string &file)
+    : id_(id), output_(output), file_(file),
+      stream_(std::make_unique<KeyboardStream>(
+          Config::instance().getSampleRate(),
+          notes::TuningSystem::EqualTemperament)),
+      channels_(std::max(Config::instance().getChannels(), 1)) {
+  if (output_ == Output::Wave &&
+      !wave_.open(file_, channels_, Config::instance().getSampleRate())) {
+    std::cerr << "Error: Unable to open " << file_ << " for session " << id_
+              << std::endl;
+  }
+}
+
+Session::~Session() { wave_.close(); }
+
+const char *Session::outputStr(Output output) {
+  switch (output) {
+  case Output::Wave:
+    return "wav";
+  case Output::Null:
+  default:
+    return "null";
+  }
+}
+
+std::optional<Session::Output>
+Session::outputFromString(const std::string &name) {
+  if (name == "null")
+    return Output::Null;
+  if (name == "wav")
+    return Output::Wave;
+  return std::nullopt;
+}
+
+Session::Stats Session::getStats() const {
+  Stats stats;
+  stats.blocks = blocks_;
+  stats.cpuSeconds = static_cast<double>(cpuNanos_) / 1e9;
+  const double audioSeconds = static_cast<double>(frames_) /
+                              Config::instance().getSampleRate();
+  stats.load = audioSeconds > 0.0 ? stats.cpuSeconds / audioSeconds : 0.0;
+  return stats;
+}
+
+// --- Render threads ---
+void Session::renderBlock(int frames) {
+  const std::size_t samples = static_cast<std::size_t>(frames) * channels_;
+  if (buffer_.size() < samples)
+    buffer_.resize(samples);
+
+  const std::uint64_t before = threadCpuNanos();
+  stream_->lock();
+  stream_->fillBuffer(buffer_.data(), static_cast<int>(samples));
+  stream_->unlock();
+  cpuNanos_ += threadCpuNanos() - before;
+  frames_ += frames;
+  blocks_++;
+
+  if (output_ == Output::Wave)
+    wave_.write(buffer_.data(), samples);
+}
+
+SessionServer::SessionServer(int count, Session::Output output,
+                             const std::string &directory, int workers,
+                             Setup setup)
+    : pool_(workers < 0 ? WorkerPool::defaultWorkers() : workers),
+      blockFrames_(static_cast<int>(Config::instance().getBufferSize())) {
+  sessions_.reserve(count);
+  for (int id = 0; id < count; id++) {
+    const std::string file =
+        directory + "/session-" + std::to_string(id) + ".wav";
+    sessions_.push_back(std::make_unique<Session>(id, output, file));
+    setup(sessions_.back()->getStream());
+  }
+}
+
+SessionServer::~SessionServer() { stop(); }
+
+void SessionServer::start() {
+  stop();
+  running_ = true;
+  thread_ = std::thread(&SessionServer::run, this);
+}
+
+void SessionServer::stop() {
+  running_ = false;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+Session *SessionServer::getSession(int id) {
+  if (id < 0 || id >= static_cast<int>(sessions_.size()))
+    return nullptr;
+  return sessions_[id].get();
+}
+
+void SessionServer::renderJob(void *context, int index) {
+  auto *self = static_cast<SessionServer *>(context);
+  self->sessions_[index]->renderBlock(self->blockFrames_);
+}
+
+// --- Server thread ---
+void SessionServer::run() {
+  const std::chrono::duration<double> block(
+      static_cast<double>(blockFrames_) / Config::instance().getSampleRate());
+  const auto period =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(block);
+  auto next = std::chrono::steady_clock::now();
+  while (running_) {
+    pool_.run(static_cast<int>(sessions_.size()), &SessionServer::renderJob,
+              this);
+    next += period;
+    const auto now = std::chrono::steady_clock::now();
+    if (now > next + period) {
+      // Too far behind to catch up, the time lost is let go
+      late_++;
+      next = now;
+      continue;
+    }
+    std::this_thread::sleep_until(next);
+  }
+}
@@ -3,6 +3,7 @@
 #include "note.hpp"
 #include <cmath>
 #include <functional>
+#include <random>
 #include <thread>
 #include <type_traits>
 #include <variant>
@@ -88,7 +89,10 @@ float Sound::saw(float f) {
 }
 
 float Sound::white_noise(float f) {
-  return (float)(rand() % 2001 - 1000) /
+  // Per thread generator, rand() serializes the render workers on a lock
+  thread_local std::minstd_rand rng(
+      std::hash<std::thread::id>{}(std::this_thread::get_id()));
+  return (float)(static_cast<int>(rng() % 2001) - 1000) /
          1000.0; // Random value between -1.0 and 1.0
 }
 
@@ -166,6 +170,27 @@ float Sound::applyPostEffects(float sample,
   return result;
 }
 
+void Sound::applyPostEffectsStereo(float &left, float &right,
+                                   std::vector<Effect<float>> &effects) {
+  for (std::size_t e = 0; e < effects.size(); e++) {
+    if (auto echo = std::get_if<EchoEffect<float>>(&effects[e].config)) {
+      echo->processStereo(left, right);
+    } else if (auto allpass =
+                   std::get_if<AllPassEffect<float>>(&effects[e].config)) {
+      allpass->processStereo(left, right);
+    } else if (auto sum = std::get_if<Adder<float>>(&effects[e].config)) {
+      sum->processStereo(left, right);
+    } else if (auto pipe = std::get_if<Piper<float>>(&effects[e].config)) {
+      pipe->processStereo(left, right);
+    } else if (auto conf =
+                   std::get_if<typename Effect<float>::GainDistHardClipConfig>(
+                       &effects[e].config)) {
+      left = hardClip(left * conf->gain, 1.0);
+      right = hardClip(right * conf->gain, 1.0);
+    }
+  }
+}
+
 template <>
 short Sound::applyPostEffects(short sample,
                               std::vector<Effect<short>> &effects) {
@@ -284,79 +309,69 @@ Sound::generateWhiteNoiseWave(Note &note, ADSR &adsr,
 
 template <typename T> int sign(T val) { return (T(0) < val) - (val < T(0)); }
 
-template <> float Sound::Rank<float>::generateRankSample() {
-  float val = 0;
-  for (int i = 0; i < this->pipes.size(); i++) {
-    Pipe &pipe = this->pipes[i];
-    Note &note = pipe.first;
-    Sound::WaveForm form = pipe.second;
-    float deltaT = 1.0f / Config::instance().getSampleRate();
-    float addition = 0.0f;
-    float frequency = note.frequency;
-    if (note.frequencyAltered > 0) {
-      frequency = note.frequencyAltered;
-    }
-
-    float t = this->generatorIndex_ * deltaT;
-    float phase = 2.0f * PI * frequency * t;
-    if (legato_.has_value()) {
-      if (legato_->targetFrequencies[i] > legato_->currentFrequencies[i]) {
-        if (legato_->deltas[i] < 0) {
-          legato_->deltas[i] = 0;
-          legato_->currentFrequencies[i] = legato_->targetFrequencies[i];
-        }
-      } else if (legato_->targetFrequencies[i] <
-                 legato_->currentFrequencies[i]) {
-        if (legato_->deltas[i] > 0) {
-          legato_->deltas[i] = 0;
-          legato_->currentFrequencies[i] = legato_->targetFrequencies[i];
-        }
-      }
-
-      legato_->currentFrequencies[i] += legato_->deltas[i];
+template <>
+float Sound::Rank<float>::shapePipeSample(std::size_t i, float t,
+                                           float phase) {
+  Pipe &pipe = this->pipes[i];
+  Note &note = pipe.first;
+  Sound::WaveForm form = pipe.second;
+  float addition = 0.0f;
+
+  float duty = 1.0;
+  short envelope = adsr.amplitude *
+                   note.volume; // TODO: adsr.response(this->generatorIndex_);
+  applyEffects(t, phase, duty, envelope, effects);
 
-      frequency = legato_->currentFrequencies[i];
+  switch (form) {
+  case Sound::WaveForm::Sine: {
+    addition = generateWaveBit(phase, duty, Sound::sinus);
+    break;
+  }
+  case Sound::WaveForm::Triangular: {
+    addition = generateWaveBit(phase, duty, Sound::triangular);
+    break;
+  }
+  case Sound::WaveForm::Square: {
+    addition =
+        generateWaveBit(phase, duty, static_cast<BinaryOp>(&Sound::square));
+    break;
+  }
+  case Sound::WaveForm::Saw: {
+    addition = generateWaveBit(phase, duty, Sound::saw);
+    break;
+  }
+  case Sound::WaveForm::WhiteNoise: {
+    addition = generateWaveBit(phase, duty, Sound::white_noise);
+    break;
+  }
+  case Sound::WaveForm::WaveFile:
+    break;
+  }
 
-      note.frequencyAltered = frequency;
-      note.frequency = frequency;
-      phases[i] += 2.0f * PI * frequency * deltaT;
-      if (phases[i] > 2.0f * PI)
-        phases[i] -= 2.0f * PI;
-      phase = phases[i];
-    }
+  return (static_cast<float>(envelope) / adsr.amplitude) * addition;
+}
 
-    float duty = 1.0;
-    short envelope = adsr.amplitude *
-                     note.volume; // TODO: adsr.response(this->generatorIndex_);
-    applyEffects(t, phase, duty, envelope, effects);
+template <>
+float Sound::Rank<float>::generatePipeSample(std::size_t i,
+                                              unsigned int index,
+                                              float ratio) {
+  const Note &note = this->pipes[i].first;
+  float deltaT = 1.0f / Config::instance().getSampleRate();
+  float frequency = note.frequency;
+  if (note.frequencyAltered > 0) {
+    frequency = note.frequencyAltered;
+  }
+  frequency *= ratio;
 
-    switch (form) {
-    case Sound::WaveForm::Sine: {
-      addition = generateWaveBit(phase, duty, Sound::sinus);
-      break;
-    }
-    case Sound::WaveForm::Triangular: {
-      addition = generateWaveBit(phase, duty, Sound::triangular);
-      break;
-    }
-    case Sound::WaveForm::Square: {
-      addition =
-          generateWaveBit(phase, duty, static_cast<BinaryOp>(&Sound::square));
-      break;
-    }
-    case Sound::WaveForm::Saw: {
-      addition = generateWaveBit(phase, duty, Sound::saw);
-      break;
-    }
-    case Sound::WaveForm::WhiteNoise: {
-      addition = generateWaveBit(phase, duty, Sound::white_noise);
-      break;
-    }
-    case Sound::WaveForm::WaveFile:
-      break;
-    }
+  float t = index * deltaT;
+  float phase = 2.0f * PI * frequency * t;
+  return this->shapePipeSample(i, t, phase);
+}
 
-    val += (static_cast<float>(envelope) / adsr.amplitude) * addition;
+template <> float Sound::Rank<float>::generateRankSample() {
+  float val = 0;
+  for (std::size_t i = 0; i < this->pipes.size(); i++) {
+    val += this->generatePipeSample(i, this->generatorIndex_);
   }
 
   this->generatorIndex_++;
@@ -368,6 +383,64 @@ template <> float Sound::Rank<float>::generateRankSampleIndex(int index) {
   return this->generateRankSample();
 }
 
+template <>
+void Sound::Rank<float>::generateRankFrameIndex(int index, float &left,
+                                                float &right, float ratio) {
+  left = 0;
+  right = 0;
+  for (std::size_t i = 0; i < this->pipes.size(); i++) {
+    float sample = this->generatePipeSample(i, index, ratio);
+    left += this->panLeft[i] * sample;
+    right += this->panRight[i] * sample;
+  }
+}
+
+template <>
+void Sound::Rank<float>::generateRankFrameGlide(int index, float ratio,
+                                                float *phases,
+                                                std::size_t count, float &left,
+                                                float &right) {
+  left = 0;
+  right = 0;
+  const float deltaT = 1.0f / Config::instance().getSampleRate();
+  const float t = index * deltaT;
+  const float step = 2.0f * PI * ratio * deltaT;
+  const std::size_t n = std::min(count, this->pipes.size());
+  for (std::size_t i = 0; i < n; i++) {
+    const Note &note = this->pipes[i].first;
+    float frequency =
+        note.frequencyAltered > 0 ? note.frequencyAltered : note.frequency;
+    float phase = phases[i] + step * frequency;
+    phase -= 2.0f * PI * std::floor(phase / (2.0f * PI));
+    phases[i] = phase;
+
+    float sample = this->shapePipeSample(i, t, phase);
+    left += this->panLeft[i] * sample;
+    right += this->panRight[i] * sample;
+  }
+}
+
+template <>
+void Sound::Rank<float>::glidePhases(int index, float ratio, float *phases,
+                                     std::size_t count) {
+  const double t =
+      static_cast<double>(index) / Config::instance().getSampleRate();
+  const std::size_t n = std::min(count, this->pipes.size());
+  for (std::size_t i = 0; i < n; i++) {
+    const Note &note = this->pipes[i].first;
+    float frequency =
+        note.frequencyAltered > 0 ? note.frequencyAltered : note.frequency;
+    phases[i] = static_cast<float>(
+        std::fmod(2.0 * PI * frequency * ratio * t, 2.0 * PI));
+  }
+}
+
+template <>
+void Sound::Rank<float>::generateRankFrame(float &left, float &right) {
+  this->generateRankFrameIndex(this->generatorIndex_, left, right);
+  this->generatorIndex_++;
+}
+
 std::vector<short> Sound::generateWave(Rank<short> &rank) {
   int sampleCount = 0;
   for (const auto &pipe : rank.pipes) {
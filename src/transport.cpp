@@ -0,0 +1,83 @@
+#include "transport.hpp"
+#include <algorithm>
+#include <cmath>
+
+Transport::Transport(int sampleRate, double bpm, int beatsPerBar)
+    : sampleRate_(sampleRate), beatsPerBar_(std::max(beatsPerBar, 1)),
+      requestedTempo_(0.0) {
+  setTempo(bpm);
+}
+
+// --- Tempo ---
+void Transport::setTempo(double bpm) {
+  if (!(bpm > 0.0))
+    bpm = 0.0;
+  requestedTempo_.store(std::min(bpm, MAX_TEMPO), std::memory_order_relaxed);
+}
+
+double Transport::getTempo() const {
+  return requestedTempo_.load(std::memory_order_relaxed);
+}
+
+double Transport::getSamplesPerBeat(double bpm) const {
+  return bpm > 0.0 ? 60.0 * sampleRate_ / bpm : 0.0;
+}
+
+// --- Position ---
+double Transport::getBeat() const {
+  return publishedBeat_.load(std::memory_order_relaxed);
+}
+
+long Transport::getBar() const {
+  return static_cast<long>(std::floor(getBeat() / beatsPerBar_));
+}
+
+double Transport::getBeatInBar() const {
+  const double beat = getBeat();
+  return beat - std::floor(beat / beatsPerBar_) * beatsPerBar_;
+}
+
+std::uint64_t Transport::getSampleTime() const {
+  return publishedSample_.load(std::memory_order_relaxed);
+}
+
+// --- Audio thread ---
+void Transport::beginBlock(int frames) {
+  frames_ = std::max(frames, 0);
+
+  const double tempo = requestedTempo_.load(std::memory_order_relaxed);
+  if (tempo != tempo_) {
+    anchorBeat_ = beat_;
+    anchorSample_ = sample_;
+    tempo_ = tempo;
+    samplesPerBeat_ = getSamplesPerBeat(tempo);
+    beatsPerSample_ = tempo > 0.0 ? 1.0 / samplesPerBeat_ : 0.0;
+  }
+
+  // Where the beats of this block fall, one multiplication per beat. A beat
+  // that rounding put just before the block still lands on its first frame.
+  numBeats_ = 0;
+  if (beatsPerSample_ <= 0.0)
+    return;
+  while (numBeats_ < MAX_BEATS_PER_BLOCK) {
+    const double offset =
+        std::ceil(offsetOf(static_cast<double>(nextBeat_)) - 1e-6);
+    if (offset >= frames_)
+      break;
+    beats_[numBeats_++] = {std::max(static_cast<int>(offset), 0), nextBeat_,
+                           beatInBar_ == 0};
+    nextBeat_++;
+    if (++beatInBar_ == beatsPerBar_)
+      beatInBar_ = 0;
+  }
+}
+
+void Transport::endBlock() {
+  sample_ += static_cast<std::uint64_t>(frames_);
+  beat_ = anchorBeat_ + static_cast<double>(sample_ - anchorSample_) *
+                            beatsPerSample_;
+  frames_ = 0;
+  numBeats_ = 0;
+  publishedSample_.store(sample_, std::memory_order_relaxed);
+  publishedBeat_.store(beat_, std::memory_order_relaxed);
+}
@@ -1,4 +1,5 @@
 #include "waveread.hpp"
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -118,3 +119,56 @@ void splitChannels(const char *data, size_t dataSize, std::vector<short> &left,
                            static_cast<unsigned char>(data[i + 2]));
   }
 }
+
+namespace {
+void putLE(FILE *f, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    fputc((value >> (8 * i)) & 0xff, f);
+}
+} // namespace
+
+bool WaveWriter::open(const std::string &filename, int channels,
+                      int sampleRate) {
+  close();
+  file_ = fopen(filename.c_str(), "wb");
+  if (!file_)
+    return false;
+  dataBytes_ = 0;
+
+  const uint32_t blockAlign = channels * 2;
+  fwrite("RIFF", 1, 4, file_);
+  putLE(file_, 36, 4); // patched by close()
+  fwrite("WAVEfmt ", 1, 8, file_);
+  putLE(file_, 16, 4);
+  putLE(file_, 1, 2); // PCM
+  putLE(file_, channels, 2);
+  putLE(file_, sampleRate, 4);
+  putLE(file_, sampleRate * blockAlign, 4);
+  putLE(file_, blockAlign, 2);
+  putLE(file_, 16, 2);
+  fwrite("data", 1, 4, file_);
+  putLE(file_, 0, 4); // patched by close()
+  return true;
+}
+
+void WaveWriter::write(const float *samples, size_t count) {
+  if (!file_)
+    return;
+  for (size_t i = 0; i < count; i++) {
+    float s = std::clamp(samples[i], -1.0f, 1.0f);
+    putLE(file_, static_cast<uint16_t>(static_cast<int16_t>(s * 32767.0f)),
+          2);
+  }
+  dataBytes_ += static_cast<uint32_t>(count * 2);
+}
+
+void WaveWriter::close() {
+  if (!file_)
+    return;
+  fseek(file_, 4, SEEK_SET);
+  putLE(file_, 36 + dataBytes_, 4);
+  fseek(file_, 40, SEEK_SET);
+  putLE(file_, dataBytes_, 4);
+  fclose(file_);
+  file_ = nullptr;
+}
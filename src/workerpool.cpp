@@ -0,0 +1,173 @@
+#include "workerpool.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+// Pause iterations a thread spins waiting before it starts to yield
+constexpr int SPIN_ITERATIONS = 4096;
+// Idle workers spin a quarter longer than the time between runs, up to
+// MAX_SPIN, so that a late block still finds them awake. SPIN until there
+// have been two runs.
+constexpr std::chrono::nanoseconds SPIN = std::chrono::microseconds(500);
+constexpr std::chrono::nanoseconds MAX_SPIN = std::chrono::milliseconds(25);
+
+// The next item of a job closed to claims
+constexpr std::uint64_t NO_ITEMS = 0x7fffffff;
+
+inline unsigned generationOf(std::uint64_t state) {
+  return static_cast<unsigned>(state >> 32);
+}
+
+inline void cpuRelax() {
+#if defined(__SSE2__) || defined(_M_X64)
+  _mm_pause();
+#else
+  std::this_thread::yield();
+#endif
+}
+} // namespace
+
+WorkerPool::WorkerPool(int workers) : spinNanos_(SPIN.count()) {
+  threads_.reserve(std::max(workers, 0));
+  for (int i = 0; i < workers; i++) {
+    threads_.emplace_back(&WorkerPool::workerLoop, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread &t : threads_) {
+    t.join();
+  }
+}
+
+int WorkerPool::defaultWorkers() {
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  return std::clamp(cores - 1, 0, 15);
+}
+
+void WorkerPool::run(int count, Job job, void *context) {
+  if (count <= 0)
+    return;
+  if (threads_.empty() || count == 1) {
+    for (int i = 0; i < count; i++)
+      job(context, i);
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (lastRun_.time_since_epoch().count() != 0) {
+    const auto spin =
+        std::min<std::chrono::nanoseconds>((now - lastRun_) * 5 / 4, MAX_SPIN);
+    spinNanos_.store(spin.count(), std::memory_order_relaxed);
+  }
+  lastRun_ = now;
+
+  // Every item of the previous job is done, but a worker may still be
+  // trying to claim one. A generation without items comes first, so that it
+  // can't claim one against the new count.
+  state_.store(static_cast<std::uint64_t>(++generation_) << 32 | NO_ITEMS);
+  job_ = job;
+  context_ = context;
+  count_.store(count, std::memory_order_relaxed);
+  done_.store(0, std::memory_order_relaxed);
+  const unsigned generation = ++generation_;
+  state_.store(static_cast<std::uint64_t>(generation) << 32);
+
+  // The workers still spinning pick the job up on their own. Parked ones are
+  // woken if there are items left for them, under the mutex so that none
+  // parks between the job being published and being told about it.
+  const int helpers = std::min(count - 1, getNumWorkers());
+  const int sleeping = sleepers_.load();
+  const int wake = std::min(helpers - (getNumWorkers() - sleeping), sleeping);
+  if (wake > 0) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (int i = 0; i < wake; i++)
+      wake_.notify_one();
+  }
+
+  drain(generation);
+  // The remaining items are already being rendered, so this wait is short
+  // unless a worker has been preempted, in which case give it the core
+  int spins = 0;
+  while (done_.load(std::memory_order_acquire) < count) {
+    if (spins++ < SPIN_ITERATIONS)
+      cpuRelax();
+    else
+      std::this_thread::yield();
+  }
+}
+
+// Claims the next item of job 'generation', false once they are all
+// claimed or another job has been published
+bool WorkerPool::claim(unsigned generation, int &index) {
+  std::uint64_t state = state_.load(std::memory_order_acquire);
+  while (generationOf(state) == generation) {
+    const int next = static_cast<int>(state & 0xffffffffu);
+    if (next >= count_.load(std::memory_order_relaxed))
+      return false;
+    if (state_.compare_exchange_weak(state, state + 1,
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_acquire)) {
+      index = next;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkerPool::drain(unsigned generation) {
+  int i;
+  while (claim(generation, i)) {
+    job_(context_, i);
+    done_.fetch_add(1, std::memory_order_release);
+  }
+}
+
+void WorkerPool::workerLoop() {
+  unsigned seen = 0;
+  while (true) {
+    const auto idle = std::chrono::steady_clock::now();
+    const std::chrono::nanoseconds spin(
+        spinNanos_.load(std::memory_order_relaxed));
+    unsigned generation;
+    int spins = 0;
+    while ((generation = generationOf(state_.load(
+                std::memory_order_acquire))) == seen) {
+      // Gives up the core past the first few, in case the job is waiting
+      // on a thread that shares it
+      if (spins < SPIN_ITERATIONS)
+        cpuRelax();
+      else
+        std::this_thread::yield();
+      // The clock is read now and then only
+      if (++spins % 256 == 0 && std::chrono::steady_clock::now() - idle > spin)
+        break;
+    }
+
+    if (generation == seen) {
+      std::unique_lock<std::mutex> lock(mtx_);
+      // Ordered with run() publishing a job and then reading sleepers_,
+      // either it sees this worker parked or this worker sees the job
+      sleepers_.fetch_add(1);
+      wake_.wait(lock, [&] {
+        return stop_ || generationOf(state_.load()) != seen;
+      });
+      sleepers_.fetch_sub(1);
+      if (stop_)
+        return;
+      generation = generationOf(state_.load(std::memory_order_acquire));
+    }
+
+    seen = generation;
+    drain(generation);
+  }
+}
@@ -0,0 +1,70 @@
+// KeyboardStream::fillBuffer() playing overlapping chords of a preset, with
+// and without the render pool, and legato phrases, without allocating on
+// the audio thread. Built with -DWITH_ALLOC_CHECK=ON.
+#include "alloccheck.hpp"
+#include "keyboardstream.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static int failures = 0;
+
+static void play(bool legato, int workers, const char *what) {
+  Config::instance().setRenderWorkers(workers);
+  KeyboardStream ks(44100, notes::TuningSystem::EqualTemperament);
+  ADSR adsr(32767, 1, 1, 3, 3, 0.8, 44100);
+  std::vector<Effect<float>> effects;
+  Effect<float> chorus;
+  chorus.effectType = Effect<float>::Type::Chorus;
+  chorus.config = Effect<float>::ChorusConfig{0.02f, 3.0f, 3};
+  effects.push_back(chorus);
+  effects.push_back(PresetEffects::syntheticReverb(1.0, 0.7));
+  ks.prepareSound(44100, adsr, effects);
+  if (legato)
+    ks.setLegato(true, 100);
+  // The ranks are built by prepareSound(), a new preset is swapped in
+  const auto preset = Sound::Rank<float>::Preset::SuperSaw;
+  ks.swapSynth([preset](std::vector<KeyboardStream::Oscillator> &bank) {
+    bank[0].sound = preset;
+  });
+  ks.waitForSwaps();
+  ks.gain = 1.0f / 32767;
+
+  std::vector<float> buffer(512 * 2);
+  ks.fillBuffer(buffer.data(), static_cast<int>(buffer.size()));
+  const long before = alloccheck::getViolations();
+  float peak = 0.0f;
+  // Three note chords, each held into the next
+  const char *chords[][3] = {{"C3", "E3", "G3"},
+                             {"F3", "A3", "C4"},
+                             {"G3", "B3", "D4"},
+                             {"C4", "E4", "G4"}};
+  for (int block = 0; block < 600; block++) {
+    const int chord = (block / 20) % 4;
+    if (block % 20 == 0) {
+      for (const char *note : chords[chord])
+        ks.registerNote(note);
+    }
+    if (block % 20 == 10 && block >= 20) {
+      for (const char *note : chords[(chord + 3) % 4])
+        ks.registerNoteRelease(note);
+    }
+    ks.fillBuffer(buffer.data(), static_cast<int>(buffer.size()));
+    for (float v : buffer)
+      peak = std::max(peak, std::abs(v));
+  }
+
+  const long allocations = alloccheck::getViolations() - before;
+  if (allocations != 0 || peak == 0.0f || ks.synth[0].sound != preset) {
+    std::fprintf(stderr, "FAIL: %s, %ld allocations, peak %g\n", what,
+                 allocations, peak);
+    failures++;
+  }
+}
+
+int main() {
+  play(false, 0, "poly");
+  play(false, 3, "poly with the render pool");
+  play(true, 0, "legato");
+  return failures == 0 ? 0 : 1;
+}